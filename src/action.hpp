@@ -2,17 +2,57 @@
 #define ACTION_HPP
 
 #include <string>
+#include <string_view>
 
-#include <boost/program_options.hpp>
+#include "program-options.hpp"
+#include "sink.hpp"
 
+// Each action's perform writes what it has to say to `out`, including why it
+// failed, and returns false if it did: invalid options, or a file it couldn't
+// read or write. A result like "no duplicates" or "sizes differ" is a success.
 namespace action {
-  std::string repeat_perform(int argc, char const* const* argv);
+  bool repeat_perform(int argc, char const* const* argv, sink::base &out);
   std::string repeat_help_msg();
-  boost::program_options::options_description repeat_options_desc();
+  opts::table repeat_options_desc();
 
-  std::string sizerank_perform(int argc, char const* const* argv);
+  bool sizerank_perform(int argc, char const* const* argv, sink::base &out);
   std::string sizerank_help_msg();
-  boost::program_options::options_description sizerank_options_desc();
+  opts::table sizerank_options_desc();
+
+  bool dupes_perform(int argc, char const* const* argv, sink::base &out);
+  std::string dupes_help_msg();
+  opts::table dupes_options_desc();
+
+  bool snapdiff_perform(int argc, char const* const* argv, sink::base &out);
+  std::string snapdiff_help_msg();
+  opts::table snapdiff_options_desc();
+
+  bool cmp_perform(int argc, char const* const* argv, sink::base &out);
+  std::string cmp_help_msg();
+  opts::table cmp_options_desc();
+
+  // Runs a script of the other actions' command lines in one process, failing
+  // if any line did.
+  bool batch_perform(int argc, char const* const* argv, sink::base &out);
+  std::string batch_help_msg();
+  opts::table batch_options_desc();
+
+  // An action's entry points, for dispatching on its name. Plain function
+  // pointers in a constant table, nothing is constructed to look an action up.
+  struct entry {
+    std::string_view name;
+    std::string (*help_fn)();
+    bool (*perform_fn)(int, char const *const *, sink::base &);
+  };
+
+  inline constexpr entry entries[] {
+    { "repeat", repeat_help_msg, repeat_perform },
+    { "sizerank", sizerank_help_msg, sizerank_perform },
+    { "dupes", dupes_help_msg, dupes_perform },
+    { "snapdiff", snapdiff_help_msg, snapdiff_perform },
+    { "cmp", cmp_help_msg, cmp_perform },
+    { "batch", batch_help_msg, batch_perform },
+  };
 }
 
 #endif // ACTION_HPP
\ No newline at end of file
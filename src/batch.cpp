@@ -0,0 +1,336 @@
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <filesystem>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "action.hpp"
+#include "text_file.hpp"
+#include "thread_pool.hpp"
+#include "util.hpp"
+
+namespace fs = std::filesystem;
+
+static constexpr opts::option batch_options[] {
+  { "jobs", 'j', opts::arg::unsigned_int, "Number of lines run concurrently, lines before a \"wait\" line finish before any after it start, default=1" },
+};
+
+opts::table action::batch_options_desc() {
+  return { "BATCH OPTIONS (fileutil batch <file|-> [options...])", batch_options };
+}
+
+std::string action::batch_help_msg() {
+  return opts::help_msg(batch_options_desc());
+}
+
+struct batch_config {
+  // empty for stdin
+  fs::path script_path;
+  size_t num_jobs;
+};
+
+static
+batch_config parse_config(
+  int const argc,
+  char const *const *const argv,
+  opts::parsed const &var_map,
+  std::vector<std::string> &errors)
+{
+  using util::get_nonrequired_option;
+
+  batch_config cfg{};
+
+  {
+    // the script is the first argument rather than an option, like a shell's
+    std::string_view const script = argc >= 3 ? argv[2] : "";
+
+    if (script.empty() || (script.front() == '-' && script != "-")) {
+      errors.emplace_back("(script) path missing, - for stdin");
+    } else if (script != "-") {
+      if (!fs::is_regular_file(script)) {
+        errors.emplace_back("(script) file not found");
+      } else {
+        cfg.script_path = script;
+      }
+    }
+  }
+  {
+    auto num_jobs = get_nonrequired_option<size_t>("jobs", "j", var_map, errors);
+
+    if (num_jobs.has_value() && num_jobs.value() == 0) {
+      errors.emplace_back("(--jobs, -j) value must be > 0");
+    } else {
+      cfg.num_jobs = num_jobs.value_or(1);
+    }
+  }
+
+  return cfg;
+}
+
+namespace {
+
+  struct command {
+    // 1-based, in the script
+    size_t line_num;
+    std::string line;
+    std::vector<std::string> args;
+    // number of commands before it, up to the last "wait" line, which must be done before it starts
+    size_t wait_for;
+  };
+
+  // Splits a command line on whitespace. Double quotes group words, so paths with
+  // spaces can be passed, and are removed. Backslashes are literal, they're path
+  // separators on Windows.
+  std::vector<std::string> split_args(std::string_view const line) {
+    std::vector<std::string> args{};
+    std::string arg{};
+    bool in_arg = false, quoted = false;
+
+    for (char const c : line) {
+      if (c == '"') {
+        quoted = !quoted;
+        in_arg = true;
+      } else if (!quoted && (c == ' ' || c == '\t')) {
+        if (in_arg) {
+          args.push_back(std::move(arg));
+          arg.clear();
+          in_arg = false;
+        }
+      } else {
+        arg += c;
+        in_arg = true;
+      }
+    }
+    if (in_arg) {
+      args.push_back(std::move(arg));
+    }
+    return args;
+  }
+
+  std::vector<command> parse_script(std::string const &script) {
+    std::vector<command> commands{};
+    size_t wait_for = 0;
+    size_t line_num = 0;
+
+    for (size_t pos = 0; pos < script.size();) {
+      size_t const end = std::min(script.find('\n', pos), script.size());
+      std::string_view line(script.data() + pos, end - pos);
+      pos = end + 1;
+      ++line_num;
+
+      while (!line.empty() && (line.front() == ' ' || line.front() == '\t'))
+        line.remove_prefix(1);
+      while (!line.empty() && (line.back() == ' ' || line.back() == '\t' || line.back() == '\r'))
+        line.remove_suffix(1);
+
+      if (line.empty() || line.front() == '#') {
+        continue;
+      }
+      if (line == "wait") {
+        wait_for = commands.size();
+        continue;
+      }
+
+      std::vector<std::string> args = split_args(line);
+      // lines copied from a shell script may still name the program
+      if (args.size() > 1 && args.front() == "fileutil") {
+        args.erase(args.begin());
+      }
+      commands.push_back({ line_num, std::string(line), std::move(args), wait_for });
+    }
+
+    return commands;
+  }
+
+  // Runs one command, as main would with its args, writing what it outputs to `out`.
+  // Returns false if it names no action, or the action failed or threw.
+  bool run_command(command const &cmd, sink::base &out) {
+    std::string_view const name = cmd.args.empty() ? "" : cmd.args.front();
+
+    if (name == "batch") {
+      out << "batch can't be nested\n";
+      return false;
+    }
+
+    for (auto const &[action_name, help_fn, perform_fn] : action::entries) {
+      if (name != action_name) {
+        continue;
+      }
+
+      std::vector<char const *> argv{};
+      argv.reserve(cmd.args.size() + 1);
+      argv.push_back("fileutil");
+      for (auto const &arg : cmd.args) {
+        argv.push_back(arg.c_str());
+      }
+
+      try {
+        if (argv.size() == 3 && std::string_view(argv[2]) == "help") {
+          out << help_fn();
+          return true;
+        }
+        return perform_fn(static_cast<int>(argv.size()), argv.data(), out);
+      } catch (std::exception const &except) {
+        out << except.what() << '\n';
+        return false;
+      }
+    }
+
+    out << "unknown action \"" << name << "\"\n";
+    return false;
+  }
+
+  // A command's output, passed on to `dest` as it's written or, without one,
+  // collected. Remembers how it ended, so results are separated by exactly one
+  // blank line.
+  class result_sink : public sink::base {
+  public:
+    explicit result_sink(sink::base *const dest) : m_dest(dest) {}
+    ~result_sink() override { flush_buffer(); }
+
+    // Ends the output with a newline if it doesn't already.
+    void finish() {
+      flush_buffer();
+      if (m_last != '\n') {
+        consume("\n");
+      }
+    }
+
+    std::string &collected() { return m_collected; }
+
+  protected:
+    void consume(std::string_view const chunk) override {
+      if (m_dest != nullptr) {
+        *m_dest << chunk;
+      } else {
+        m_collected.append(chunk);
+      }
+      m_last = chunk.back();
+    }
+
+    void sync() override {
+      if (m_dest != nullptr) {
+        m_dest->flush();
+      }
+    }
+
+  private:
+    sink::base *const m_dest;
+    std::string m_collected{};
+    char m_last = '\n';
+  };
+
+} // namespace
+
+bool action::batch_perform(int const argc, char const *const *const argv, sink::base &out) {
+  opts::parsed var_map;
+  try {
+    var_map = opts::parse(action::batch_options_desc(), argc, argv);
+  } catch (std::exception const &err) {
+    out << err.what() << '\n';
+    return false;
+  }
+
+  std::vector<std::string> errors{};
+  batch_config const cfg = parse_config(argc, argv, var_map, errors);
+  if (!errors.empty()) {
+    for (auto const &err : errors)
+      out << err << '\n';
+    return false;
+  }
+
+  std::string script{};
+  try {
+    if (cfg.script_path.empty()) {
+      script.assign(std::istreambuf_iterator<char>(std::cin), std::istreambuf_iterator<char>());
+    } else {
+      script = util::load_text_file(cfg.script_path, util::cr_removal::crlf);
+    }
+  } catch (std::exception const &except) {
+    out << except.what() << '\n';
+    return false;
+  }
+
+  std::vector<command> const commands = parse_script(script);
+  size_t num_failed = 0;
+
+  auto const print_header = [&out](command const &cmd) {
+    out << "[" << cmd.line_num << "] " << cmd.line << '\n';
+  };
+
+  if (cfg.num_jobs == 1) {
+    // streamed, so progress reports and long outputs show up as they're written
+    for (size_t i = 0; i < commands.size(); ++i) {
+      print_header(commands[i]);
+      result_sink result(&out);
+      num_failed += run_command(commands[i], result) ? 0 : 1;
+      result.finish();
+      out << '\n';
+      out.flush();
+    }
+  } else {
+    // Each command's output is collected on its own and printed in script order,
+    // as soon as it and every command before it are done.
+    struct pending_result {
+      std::string output;
+      bool ok;
+      bool done;
+    };
+    std::vector<pending_result> results(commands.size());
+    std::mutex results_mutex{};
+    std::condition_variable result_done{};
+
+    // Commands between "wait" lines run at once, on `num_jobs` pool tasks which
+    // take them in order, and each such segment starts once the one before is done.
+    for (size_t first = 0; first < commands.size();) {
+      size_t last = first + 1;
+      while (last < commands.size() && commands[last].wait_for == commands[first].wait_for) {
+        ++last;
+      }
+
+      std::atomic<size_t> next_command = first;
+      auto const run_commands = [&]() {
+        for (size_t idx; (idx = next_command.fetch_add(1)) < last;) {
+          result_sink result(nullptr);
+          bool const ok = run_command(commands[idx], result);
+          result.finish();
+
+          {
+            std::lock_guard<std::mutex> const lock(results_mutex);
+            results[idx] = { std::move(result.collected()), ok, true };
+          }
+          result_done.notify_all();
+        }
+      };
+
+      util::task_group running{};
+      for (size_t i = 0; i < std::min(cfg.num_jobs, last - first); ++i) {
+        running.run(run_commands);
+      }
+
+      for (size_t i = first; i < last; ++i) {
+        {
+          std::unique_lock<std::mutex> lock(results_mutex);
+          result_done.wait(lock, [&]() { return results[i].done; });
+        }
+        print_header(commands[i]);
+        out << results[i].output << '\n';
+        out.flush();
+        num_failed += results[i].ok ? 0 : 1;
+        std::string().swap(results[i].output);
+      }
+      running.wait();
+
+      first = last;
+    }
+  }
+
+  out << commands.size() << " commands, " << num_failed << " failed\n";
+
+  return num_failed == 0;
+}
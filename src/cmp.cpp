@@ -0,0 +1,247 @@
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "action.hpp"
+#include "fileutil.hpp"
+#include "mapped_file.hpp"
+#include "thread_pool.hpp"
+#include "util.hpp"
+
+namespace fs = std::filesystem;
+
+// 1 GiB, bigger chunks only split the work more unevenly
+static constexpr size_t max_chunk_kib = 1024 * 1024;
+
+static constexpr opts::option cmp_options[] {
+  { "first", 'a', opts::arg::string, "Path of the first file" },
+  { "second", 'b', opts::arg::string, "Path of the second file" },
+  { "threads", 't', opts::arg::unsigned_int, "Number of comparing tasks, the global --threads sets how many threads run them, default=hardware concurrency" },
+  { "chunk", 'c', opts::arg::unsigned_int, "Size in KiB of the chunks tasks take turns comparing, at most 1048576, default=8192" },
+};
+
+opts::table action::cmp_options_desc() {
+  return { "CMP OPTIONS", cmp_options };
+}
+
+std::string action::cmp_help_msg() {
+  return opts::help_msg(cmp_options_desc());
+}
+
+static
+fileutil::cmp_config parse_config(opts::parsed const &var_map, std::vector<std::string> &errors) {
+  using util::get_required_option;
+  using util::get_nonrequired_option;
+
+  fileutil::cmp_config cfg{};
+
+  {
+    auto first_path = get_required_option<std::string>("first", "a", var_map, errors);
+
+    if (first_path.has_value()) {
+      if (!fs::exists(first_path.value()) || fs::is_directory(first_path.value())) {
+        errors.emplace_back("(--first, -a) file not found");
+      } else {
+        cfg.first_path = std::move(first_path.value());
+      }
+    }
+  }
+  {
+    auto second_path = get_required_option<std::string>("second", "b", var_map, errors);
+
+    if (second_path.has_value()) {
+      if (!fs::exists(second_path.value()) || fs::is_directory(second_path.value())) {
+        errors.emplace_back("(--second, -b) file not found");
+      } else {
+        cfg.second_path = std::move(second_path.value());
+      }
+    }
+  }
+  {
+    auto num_threads = get_nonrequired_option<size_t>("threads", "t", var_map, errors);
+
+    if (num_threads.has_value() && num_threads.value() == 0) {
+      errors.emplace_back("(--threads, -t) value must be > 0");
+    } else {
+      cfg.num_threads = num_threads.value_or(
+        std::max(std::thread::hardware_concurrency(), 1u));
+    }
+  }
+  {
+    auto chunk_kib = get_nonrequired_option<size_t>("chunk", "c", var_map, errors);
+
+    if (chunk_kib.has_value() && chunk_kib.value() == 0) {
+      errors.emplace_back("(--chunk, -c) value must be > 0");
+    } else if (chunk_kib.has_value() && chunk_kib.value() > max_chunk_kib) {
+      errors.emplace_back("(--chunk, -c) value must be <= " + std::to_string(max_chunk_kib));
+    } else {
+      cfg.chunk_size = chunk_kib.value_or(8192) * 1024;
+    }
+  }
+
+  return cfg;
+}
+
+// Returns the offset of the first byte where `a` and `b`, both `size` bytes, differ,
+// or SIZE_MAX if they don't. Threads take chunks in ascending order and stop once
+// their chunk starts past a difference another thread found, so the result is the
+// lowest differing offset however the work got split. Once `stop` is requested
+// threads give up at their next block, and the result means nothing.
+static
+size_t find_first_difference(
+  unsigned char const *const a,
+  unsigned char const *const b,
+  size_t const size,
+  size_t const chunk_size,
+  size_t const num_threads,
+  std::stop_token const &stop)
+{
+  // checks for a stop, or a lower difference found by another task, between blocks
+  size_t const block_size = std::min<size_t>(chunk_size, 64 * 1024);
+  // rounded up without `size + chunk_size - 1`, which overflows for huge chunks
+  size_t const num_chunks = size / chunk_size + (size % chunk_size != 0);
+
+  std::atomic<size_t> next_chunk = 0;
+  std::atomic<size_t> first_difference = SIZE_MAX;
+
+  auto const compare_chunks = [&]() {
+    for (;;) {
+      size_t const chunk = next_chunk.fetch_add(1, std::memory_order_relaxed);
+      if (chunk >= num_chunks) {
+        return;
+      }
+
+      size_t const chunk_begin = chunk * chunk_size;
+      size_t const chunk_end = chunk_begin + std::min(chunk_size, size - chunk_begin);
+      for (size_t pos = chunk_begin; pos < chunk_end; pos += block_size) {
+        if (pos >= first_difference.load(std::memory_order_relaxed)) {
+          // a lower difference was found, this and every later chunk can't matter
+          return;
+        }
+        if (stop.stop_requested()) {
+          return;
+        }
+
+        size_t const len = std::min(block_size, chunk_end - pos);
+        if (std::memcmp(a + pos, b + pos, len) == 0) {
+          continue;
+        }
+
+        auto const mismatch = std::mismatch(a + pos, a + pos + len, b + pos);
+        size_t const difference = static_cast<size_t>(mismatch.first - a);
+
+        size_t lowest = first_difference.load();
+        while (difference < lowest && !first_difference.compare_exchange_weak(lowest, difference)) {}
+        return;
+      }
+    }
+  };
+
+  // the calling thread compares too, the rest run on the pool
+  size_t const threads_needed = std::min(num_threads, num_chunks);
+  if (threads_needed <= 1) {
+    compare_chunks();
+  } else {
+    util::task_group comparing{};
+    for (size_t i = 1; i < threads_needed; ++i) {
+      comparing.run(compare_chunks);
+    }
+    compare_chunks();
+    comparing.wait();
+  }
+
+  return first_difference.load();
+}
+
+fileutil::cmp_result fileutil::cmp(cmp_config const &cfg, std::stop_token const stop) {
+  if (cfg.chunk_size == 0) {
+    throw std::invalid_argument("chunk size must be > 0");
+  }
+  size_t const num_threads = cfg.num_threads != 0
+    ? cfg.num_threads
+    : std::max(std::thread::hardware_concurrency(), 1u);
+
+  // mapping reads nothing yet, so differing sizes are reported without touching the contents
+  util::mapped_file const first(cfg.first_path);
+  util::mapped_file const second(cfg.second_path);
+
+  cmp_result result{};
+  result.first_size = first.size();
+  result.second_size = second.size();
+  result.first_difference = SIZE_MAX;
+  if (first.size() != second.size()) {
+    return result;
+  }
+
+  auto const *const first_bytes = reinterpret_cast<unsigned char const *>(first.bytes().data());
+  auto const *const second_bytes = reinterpret_cast<unsigned char const *>(second.bytes().data());
+
+  size_t const difference = find_first_difference(
+    first_bytes, second_bytes, first.size(), cfg.chunk_size, num_threads, stop);
+
+  if (stop.stop_requested()) {
+    result.cancelled = true;
+  } else if (difference != SIZE_MAX) {
+    result.first_difference = difference;
+    result.first_byte = first_bytes[difference];
+    result.second_byte = second_bytes[difference];
+  }
+  return result;
+}
+
+bool action::cmp_perform(int const argc, char const *const *const argv, sink::base &out) {
+  opts::parsed var_map;
+  try {
+    var_map = opts::parse(action::cmp_options_desc(), argc, argv);
+  } catch (std::exception const &err) {
+    out << err.what() << '\n';
+    return false;
+  }
+
+  std::vector<std::string> errors{};
+  fileutil::cmp_config const cfg = parse_config(var_map, errors);
+  if (!errors.empty()) {
+    for (auto const &err : errors)
+      out << err << '\n';
+    return false;
+  }
+
+  try {
+    fileutil::cmp_result const result = fileutil::cmp(cfg);
+
+    if (result.first_size != result.second_size) {
+      out
+        << "sizes differ, " << cfg.first_path.string() << " is " << result.first_size << " B, "
+        << cfg.second_path.string() << " is " << result.second_size << " B\n";
+      return true;
+    }
+
+    if (result.first_difference == SIZE_MAX) {
+      char size_buf[util::max_file_size_len];
+      out << "identical, " << util::format_file_size(result.first_size, size_buf) << " compared\n";
+      return true;
+    }
+
+    auto const hex = [](unsigned char const byte) {
+      char digits[2] = { '0', '0' };
+      std::to_chars(digits + (byte < 0x10 ? 1 : 0), digits + 2, byte, 16);
+      return std::string("0x") + digits[0] + digits[1];
+    };
+
+    out
+      << "first difference at offset " << result.first_difference << ": "
+      << hex(result.first_byte) << " vs " << hex(result.second_byte) << '\n';
+  } catch (std::exception const &except) {
+    out << except.what() << '\n';
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,482 @@
+#include <algorithm>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "action.hpp"
+#include "fileutil.hpp"
+#include "thread_pool.hpp"
+#include "util.hpp"
+#include "walk.hpp"
+
+namespace fs = std::filesystem;
+
+static constexpr opts::option dupes_options[] {
+  { "dir", 'd', opts::arg::string, "Search directory, default=cwd" },
+  { "recurse", 'r', opts::arg::none, "Enables recursive search through child directories, default=false" },
+  { "top", 'n', opts::arg::unsigned_int, "Number of duplicate groups to rank, default=10" },
+  { "followsymlinks", 'l', opts::arg::none, "Enables following symbolic links, default=false" },
+  { "threads", 't', opts::arg::unsigned_int, "Number of hashing tasks, the global --threads sets how many threads run them, default=hardware concurrency" },
+};
+
+opts::table action::dupes_options_desc() {
+  return { "DUPES OPTIONS", dupes_options };
+}
+
+std::string action::dupes_help_msg() {
+  return opts::help_msg(dupes_options_desc());
+}
+
+// What the action takes on top of what fileutil::dupes does.
+struct dupes_config {
+  fileutil::dupes_config search;
+  size_t top_n;
+};
+
+static
+dupes_config parse_config(opts::parsed const &var_map, std::vector<std::string> &errors) {
+  using util::get_nonrequired_option;
+  using util::get_flag_option;
+
+  dupes_config cfg{};
+
+  {
+    auto search_path = get_nonrequired_option<std::string>("dir", "d", var_map, errors);
+
+    if (search_path.has_value()) {
+      if (!fs::is_directory(search_path.value())) {
+        errors.emplace_back("(--dir, -d) is not a directory");
+      } else {
+        cfg.search.search_path = std::move(search_path.value());
+      }
+    } else {
+      cfg.search.search_path = fs::current_path();
+    }
+  }
+  {
+    auto top_n = get_nonrequired_option<size_t>("top", "n", var_map, errors);
+    cfg.top_n = top_n.value_or(10);
+  }
+  {
+    auto num_threads = get_nonrequired_option<size_t>("threads", "t", var_map, errors);
+
+    if (num_threads.has_value() && num_threads.value() == 0) {
+      errors.emplace_back("(--threads, -t) value must be > 0");
+    } else {
+      cfg.search.num_threads = num_threads.value_or(
+        std::max(std::thread::hardware_concurrency(), 1u));
+    }
+  }
+  {
+    bool const recurse = get_flag_option("recurse", var_map);
+    cfg.search.recurse = recurse;
+  }
+  {
+    bool const follow_sym_links = get_flag_option("followsymlinks", var_map);
+    cfg.search.follow_sym_links = follow_sym_links;
+  }
+
+  return cfg;
+}
+
+// Files no bigger than this are hashed whole by the partial (edge) stage.
+static size_t constexpr s_edge_len = 4 * 1024;
+
+static
+bool hash_file_edges(fs::path const &path, uintmax_t const size, uint64_t &hash) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file.is_open()) {
+    return false;
+  }
+
+  char buffer[2 * s_edge_len];
+
+  if (size <= sizeof(buffer)) {
+    auto const len = static_cast<std::streamsize>(size);
+    if (!file.read(buffer, len)) {
+      return false;
+    }
+    hash = util::hash64(buffer, static_cast<size_t>(size));
+    return true;
+  }
+
+  if (!file.read(buffer, s_edge_len)) {
+    return false;
+  }
+  file.seekg(-static_cast<std::streamoff>(s_edge_len), std::ios::end);
+  if (!file.read(buffer + s_edge_len, s_edge_len)) {
+    return false;
+  }
+
+  hash = util::hash64(buffer, sizeof(buffer));
+
+  return true;
+}
+
+static
+bool hash_file_contents(fs::path const &path, uint64_t &hash) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file.is_open()) {
+    return false;
+  }
+
+  size_t constexpr chunk_size = 1024 * 1024;
+  std::vector<char> buffer(chunk_size);
+
+  // each chunk is hashed on its own and folded into the running hash,
+  // so memory use is independent of file size
+  uint64_t running[2] { 0, 0 };
+
+  while (file) {
+    file.read(buffer.data(), chunk_size);
+    auto const num_read = static_cast<size_t>(file.gcount());
+    if (num_read == 0) {
+      break;
+    }
+    running[1] = util::hash64(buffer.data(), num_read);
+    running[0] = util::hash64(running, sizeof(running));
+  }
+
+  if (file.bad()) {
+    return false;
+  }
+
+  hash = running[0];
+
+  return true;
+}
+
+namespace {
+
+  enum class hash_stage { edges, contents };
+
+  struct hash_job {
+    size_t file_idx;
+    fs::path path;
+    uintmax_t size;
+    hash_stage stage;
+  };
+
+  // Jobs waiting to be hashed. Hashing tasks are started on the thread pool as jobs
+  // are queued, at most `max_tasks` at once, and each runs until the queue is empty.
+  // So no task ever waits for work, a pool thread is only held while there's hashing
+  // to do.
+  class job_queue {
+  public:
+    explicit job_queue(size_t const max_tasks) : m_max_tasks(max_tasks) {}
+
+    // Returns true if a task should be started to run it.
+    bool push(hash_job &&job) {
+      std::lock_guard<std::mutex> const lock(m_mutex);
+      m_jobs.push_back(std::move(job));
+      if (m_num_tasks < m_max_tasks) {
+        ++m_num_tasks;
+        return true;
+      }
+      return false;
+    }
+
+    // Returns false once the queue is empty, the calling task must then end.
+    bool pop(hash_job &job) {
+      std::lock_guard<std::mutex> const lock(m_mutex);
+      if (m_jobs.empty()) {
+        --m_num_tasks;
+        return false;
+      }
+      job = std::move(m_jobs.front());
+      m_jobs.pop_front();
+      return true;
+    }
+
+  private:
+    std::mutex m_mutex{};
+    std::deque<hash_job> m_jobs{};
+    size_t const m_max_tasks;
+    size_t m_num_tasks = 0;
+  };
+
+  struct candidate {
+    // the first, in path order, of the paths leading to the file
+    fs::path path;
+    uintmax_t size;
+    walk::file_id id;
+    uint64_t edges_hash;
+    uint64_t contents_hash;
+    bool hash_failed;
+  };
+
+  struct size_and_hash {
+    uintmax_t size;
+    uint64_t hash;
+
+    bool operator<(size_and_hash const &other) const {
+      return size != other.size ? size < other.size : hash < other.hash;
+    }
+  };
+
+} // namespace
+
+fileutil::dupes_result fileutil::dupes(dupes_config const &cfg, std::stop_token const stop) {
+  if (!fs::is_directory(cfg.search_path)) {
+    throw std::invalid_argument("\"" + cfg.search_path.string() + "\" is not a directory");
+  }
+
+  // Stage 1 (traversal, this thread): group files by size. The first time a size
+  // is seen twice, both files are queued for stage 2. A path to a file already in
+  // the group, a hard link or a symlink to it, isn't a copy and joins its candidate.
+  // Stage 2 (pool tasks): hash the first and last 4 KB. The first time a (size, edges hash)
+  // pair is seen twice, both files are queued for stage 3. Files small enough to be
+  // covered by the edges are already fully hashed and skip stage 3.
+  // Stage 3 (pool tasks): hash the full contents.
+
+  std::mutex state_mutex{};
+  std::deque<candidate> files{};
+  std::map<size_and_hash, std::vector<size_t>> by_edges{};
+  // only touched by the traversal, which runs on this thread alone
+  std::unordered_map<uintmax_t, std::vector<size_t>> by_size{};
+  std::map<walk::file_id, size_t> by_id{};
+
+  size_t const num_threads = cfg.num_threads != 0
+    ? cfg.num_threads
+    : std::max(std::thread::hardware_concurrency(), 1u);
+
+  job_queue queue(num_threads);
+  // declared before the group, which waits for its tasks on the way out, since they call these
+  std::function<void (size_t, hash_stage)> enqueue{};
+  std::function<void ()> hash_jobs{};
+  util::task_group hashing{};
+
+  enqueue = [&](size_t const file_idx, hash_stage const stage) {
+    // caller holds `state_mutex`
+    auto const &file = files[file_idx];
+    if (queue.push({ file_idx, file.path, file.size, stage })) {
+      hashing.run(hash_jobs);
+    }
+  };
+
+  hash_jobs = [&]() {
+    hash_job job{};
+    while (queue.pop(job)) {
+      if (stop.stop_requested()) {
+        // drain the queue without hashing, the file is left out of any group
+        std::lock_guard<std::mutex> const lock(state_mutex);
+        files[job.file_idx].hash_failed = true;
+        continue;
+      }
+
+      uint64_t hash = 0;
+
+      if (job.stage == hash_stage::edges) {
+        bool const ok = hash_file_edges(job.path, job.size, hash);
+
+        std::lock_guard<std::mutex> const lock(state_mutex);
+        auto &file = files[job.file_idx];
+        if (!ok) {
+          file.hash_failed = true;
+        } else {
+          file.edges_hash = hash;
+
+          auto &group = by_edges[{ job.size, hash }];
+          group.push_back(job.file_idx);
+
+          if (job.size <= 2 * s_edge_len) {
+            file.contents_hash = hash;
+          } else if (group.size() == 2) {
+            enqueue(group[0], hash_stage::contents);
+            enqueue(group[1], hash_stage::contents);
+          } else if (group.size() > 2) {
+            enqueue(job.file_idx, hash_stage::contents);
+          }
+        }
+      } else {
+        bool const ok = hash_file_contents(job.path, hash);
+
+        std::lock_guard<std::mutex> const lock(state_mutex);
+        auto &file = files[job.file_idx];
+        if (!ok) {
+          file.hash_failed = true;
+        } else {
+          file.contents_hash = hash;
+        }
+      }
+    }
+  };
+
+  walk::options walk_opts{};
+  walk_opts.roots = { cfg.search_path };
+  walk_opts.recurse = cfg.recurse;
+  walk_opts.follow_sym_links = cfg.follow_sym_links;
+  walk_opts.stop = stop;
+
+  walk::files(
+    walk_opts,
+    [&](walk::file_info const &file) {
+      fs::path const &path = file.path;
+      uintmax_t const size = file.size;
+
+      // empty files are all identical and waste nothing, ignore them
+      if (size == 0) {
+        return;
+      }
+
+      auto &group = by_size[size];
+
+      // Only files sharing a size can be copies, so only theirs are told apart by id,
+      // which the walk doesn't provide on every platform. `files` is only added to
+      // on this thread, reading it here needs no lock.
+      if (!group.empty()) {
+        auto const id_of = [](walk::file_id const id, fs::path const &file_path) {
+          return id != walk::unknown_file_id ? id : walk::file_id_of(file_path);
+        };
+
+        if (group.size() == 1) {
+          candidate const &first = files[group[0]];
+          walk::file_id const first_id = id_of(first.id, first.path);
+          if (first_id != walk::unknown_file_id) {
+            by_id.emplace(first_id, group[0]);
+          }
+        }
+
+        walk::file_id const id = id_of(file.id, path);
+        if (id != walk::unknown_file_id) {
+          auto const [it, inserted] = by_id.try_emplace(id, files.size());
+          if (!inserted) {
+            // another path to a file already found, a hard link or a symlink to it
+            std::lock_guard<std::mutex> const lock(state_mutex);
+            candidate &same_file = files[it->second];
+            if (path < same_file.path) {
+              same_file.path = path;
+            }
+            return;
+          }
+        }
+      }
+
+      std::lock_guard<std::mutex> const lock(state_mutex);
+
+      size_t const file_idx = files.size();
+      files.push_back({ path, size, file.id, 0, 0, false });
+      group.push_back(file_idx);
+
+      if (group.size() == 2) {
+        enqueue(group[0], hash_stage::edges);
+        enqueue(group[1], hash_stage::edges);
+      } else if (group.size() > 2) {
+        enqueue(file_idx, hash_stage::edges);
+      }
+    });
+
+  // jobs only queue more jobs from tasks of the same group, so once it's done they all are
+  hashing.wait();
+
+  dupes_result result{};
+  std::vector<dupe_group> &groups = result.groups;
+  {
+    std::map<size_and_hash, std::vector<size_t>> by_contents{};
+
+    for (auto const &[key, members] : by_edges) {
+      if (members.size() < 2) {
+        continue;
+      }
+      for (size_t const file_idx : members) {
+        auto const &file = files[file_idx];
+        if (!file.hash_failed) {
+          by_contents[{ file.size, file.contents_hash }].push_back(file_idx);
+        }
+      }
+    }
+
+    for (auto const &[key, members] : by_contents) {
+      if (members.size() < 2) {
+        continue;
+      }
+
+      dupe_group group{ key.size, key.size * (members.size() - 1), {} };
+      group.paths.reserve(members.size());
+      for (size_t const file_idx : members) {
+        group.paths.emplace_back(
+          files[file_idx].path.lexically_relative(cfg.search_path).string());
+      }
+      std::sort(group.paths.begin(), group.paths.end());
+
+      groups.emplace_back(std::move(group));
+    }
+  }
+
+  std::sort(groups.begin(), groups.end(), [](dupe_group const &lhs, dupe_group const &rhs) {
+    if (lhs.wasted_bytes != rhs.wasted_bytes)
+      return lhs.wasted_bytes > rhs.wasted_bytes;
+    if (lhs.file_size != rhs.file_size)
+      return lhs.file_size > rhs.file_size;
+    return lhs.paths.front() < rhs.paths.front();
+  });
+
+  for (auto const &group : groups) {
+    result.total_wasted_bytes += group.wasted_bytes;
+  }
+  result.cancelled = stop.stop_requested();
+
+  return result;
+}
+
+bool action::dupes_perform(int const argc, char const *const *const argv, sink::base &out) {
+  opts::parsed var_map;
+  try {
+    var_map = opts::parse(action::dupes_options_desc(), argc, argv);
+  } catch (std::exception const &err) {
+    out << err.what() << '\n';
+    return false;
+  }
+
+  std::vector<std::string> errors{};
+  dupes_config const cfg = parse_config(var_map, errors);
+  if (!errors.empty()) {
+    for (auto const &err : errors)
+      out << err << '\n';
+    return false;
+  }
+
+  fileutil::dupes_result result{};
+  try {
+    result = fileutil::dupes(cfg.search);
+  } catch (std::exception const &except) {
+    out << except.what() << '\n';
+    return false;
+  }
+
+  std::vector<fileutil::dupe_group> const &groups = result.groups;
+  if (groups.empty()) {
+    out << "No duplicate files found";
+    return true;
+  }
+
+  size_t const num_ranked = std::min(cfg.top_n, groups.size());
+  for (size_t i = 0; i < num_ranked; ++i) {
+    auto const &group = groups[i];
+    char wasted_sz[util::max_file_size_len], file_sz[util::max_file_size_len];
+
+    out
+      << (i + 1) << ". "
+      << '(' << util::format_file_size(group.wasted_bytes, wasted_sz) << " wasted) "
+      << group.paths.size() << " x " << util::format_file_size(group.file_size, file_sz) << '\n';
+
+    for (auto const &path : group.paths) {
+      out << "  " << path << '\n';
+    }
+  }
+
+  out
+    << groups.size() << " duplicate groups, "
+    << util::format_file_size(result.total_wasted_bytes) << " wasted in total\n";
+
+  return true;
+}
@@ -0,0 +1,288 @@
+#ifndef FILEUTIL_HPP
+#define FILEUTIL_HPP
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <stop_token>
+#include <string>
+#include <vector>
+
+// In-process API of the actions, which the command line actions are thin wrappers
+// over. Calls take a typed config and return typed results, nothing is printed or
+// formatted. The libfileutil project builds these into a static library.
+//
+// Calls throw std::invalid_argument for a config they can't run with and
+// std::runtime_error for a file they can't read or write. The ones which may run
+// long take a std::stop_token; once a stop is requested they return early, with
+// `cancelled` set and whatever was gathered until then.
+namespace fileutil {
+
+// ---------------------------------------------------------------------------- repeat
+
+struct repeat_config {
+  std::filesystem::path in_path;
+  std::filesystem::path out_path;
+  // 1 = copy
+  std::size_t num_repeats = 1;
+};
+
+struct repeat_result {
+  std::uintmax_t num_bytes_written;
+  // the partly written output file was removed
+  bool cancelled;
+};
+
+// Writes the contents of `in_path` to `out_path` `num_repeats` times over.
+repeat_result repeat(repeat_config const &cfg, std::stop_token stop = {});
+
+// ---------------------------------------------------------------------------- sizerank
+
+enum class timestamp {
+  access,
+  modify,
+  // creation time, files whose filesystem doesn't record it are left out
+  birth,
+};
+
+struct ranked_file {
+  std::filesystem::path path;
+  std::uintmax_t size;
+  // what files are ranked by, the size or with `score` size x age
+  double rank;
+  std::int64_t age_secs;
+  // index into sizerank_config::roots
+  std::size_t root_idx;
+};
+
+// Distribution of file sizes in log2 buckets: bucket 0 holds empty files,
+// bucket i holds sizes in [2^(i-1), 2^i). Fixed-size so that each traversal
+// thread can own one and they can be merged cheaply once the walk is done.
+struct size_histogram {
+  static std::size_t constexpr num_buckets = 65;
+
+  struct bucket {
+    std::uintmax_t count;
+    std::uintmax_t bytes;
+    std::uintmax_t min;
+    std::uintmax_t max;
+  };
+
+  std::array<bucket, num_buckets> buckets{};
+  std::uintmax_t total_count = 0;
+  std::uintmax_t total_bytes = 0;
+
+  static std::size_t bucket_idx(std::uintmax_t const size) {
+    return static_cast<std::size_t>(std::bit_width(size));
+  }
+
+  static std::uintmax_t bucket_lower_bound(std::size_t const idx) {
+    return idx == 0 ? 0 : std::uintmax_t(1) << (idx - 1);
+  }
+
+  static std::uintmax_t bucket_upper_bound(std::size_t const idx) {
+    return idx == 0 ? 0 : (std::uintmax_t(1) << (idx - 1)) + ((std::uintmax_t(1) << (idx - 1)) - 1);
+  }
+
+  void add(std::uintmax_t size);
+  void merge(size_histogram const &other);
+
+  // Estimates the size at percentile `p` (0-100] by locating the bucket containing
+  // that rank and interpolating linearly between the bucket's observed min and max.
+  [[nodiscard]] std::uintmax_t percentile(double p) const;
+};
+
+// An extrapolated total, see sizerank_config::sample_fraction.
+struct estimate {
+  double est;
+  // of `est`, so a 95% confidence interval is est +- 1.96 sqrt(var)
+  double var;
+  // what was actually visited, a floor for the estimate
+  double seen;
+};
+
+struct sizerank_progress {
+  double elapsed_secs;
+  std::size_t num_dirs_listed;
+  std::size_t num_files_found;
+  std::uintmax_t num_bytes_found;
+  // the top files so far
+  std::vector<ranked_file> ranking;
+};
+
+struct sizerank_config {
+  // Roots on the same device share one walk, roots on different devices are walked concurrently.
+  std::vector<std::filesystem::path> roots;
+  // 0 ranks nothing, for only the histogram, estimates or snapshot
+  std::size_t top_n = 10;
+  // inclusive
+  std::uintmax_t min_size = 0;
+  std::uintmax_t max_size = UINTMAX_MAX;
+  // regular expression file names must match whole, empty or ".*" matches every file
+  std::string pattern;
+  bool recurse = false;
+  bool follow_sym_links = false;
+  // see walk::options::inode_order
+  bool inode_order = false;
+  // threads listing directories per walk
+  std::size_t threads_per_device = 1;
+
+  // what older_than_secs, newer_than_secs and score go by
+  timestamp time = timestamp::modify;
+  // 0 to not filter by age
+  std::int64_t older_than_secs = 0;
+  std::int64_t newer_than_secs = 0;
+  // ranks by size x age instead of size
+  bool score = false;
+
+  // when exceeded, results are of what was visited so far and `complete` is false, 0 = none
+  double budget_secs = 0;
+  // Fraction (0, 1] of subdirectories to descend into, totals are then extrapolated.
+  double sample_fraction = 1;
+  std::uint64_t sample_seed = 0;
+
+  // fills sizerank_result::histogram with every matching file
+  bool histogram = false;
+  // Saves a snapshot of every file found here, for snapdiff, if not empty. Only
+  // once the walk completes, so not with budget_secs or sample_fraction < 1.
+  std::filesystem::path snapshot_path;
+
+  // Called with the provisional results every `progress_secs` seconds and/or every
+  // `progress_files` files found (0 = never), from the thread which called sizerank.
+  std::function<void (sizerank_progress const &)> on_progress;
+  double progress_secs = 0;
+  std::size_t progress_files = 0;
+};
+
+struct sizerank_result {
+  // highest rank first
+  std::vector<ranked_file> top_files;
+  // including those filtered out
+  std::size_t num_files_found;
+  // empty unless sizerank_config::histogram was set
+  size_histogram histogram;
+  std::size_t num_dirs_visited;
+  // not descended into because of sampling
+  std::size_t num_dirs_skipped;
+  // false if the time budget ran out or it was cancelled
+  bool complete;
+  // of all matching files, set when sampling or with a time budget
+  estimate est_files;
+  estimate est_bytes;
+  // 0 unless a snapshot was saved
+  std::size_t num_snapshot_rows;
+  // the snapshot wasn't saved
+  bool cancelled;
+};
+
+// Ranks the largest (or largest x oldest) files under `cfg.roots`.
+sizerank_result sizerank(sizerank_config const &cfg, std::stop_token stop = {});
+
+// ---------------------------------------------------------------------------- dupes
+
+struct dupes_config {
+  std::filesystem::path search_path;
+  bool recurse = false;
+  bool follow_sym_links = false;
+  // hashing tasks, 0 = hardware concurrency. They run on the shared thread pool,
+  // whose size caps how many run at once, see util::thread_pool::configure_shared.
+  std::size_t num_threads = 0;
+};
+
+struct dupe_group {
+  std::uintmax_t file_size;
+  // file_size x (number of files - 1)
+  std::uintmax_t wasted_bytes;
+  // relative to dupes_config::search_path, sorted. One per file: of several paths
+  // to one file (hard links, or a symlink and its target), only the first is listed.
+  std::vector<std::string> paths;
+};
+
+struct dupes_result {
+  // most wasted bytes first
+  std::vector<dupe_group> groups;
+  std::uintmax_t total_wasted_bytes;
+  // files not hashed by then aren't in any group
+  bool cancelled;
+};
+
+// Finds files with identical contents, narrowing candidates by size, then by a hash
+// of their first and last 4 KB, then by a hash of their whole contents.
+dupes_result dupes(dupes_config const &cfg, std::stop_token stop = {});
+
+// ---------------------------------------------------------------------------- snapdiff
+
+enum class change_rank {
+  // bytes grown, so the most shrunk files rank last
+  growth,
+  // growth relative to the old size, new files first
+  relative_growth,
+  // bytes changed, grown or shrunk
+  abs_delta,
+};
+
+struct snapdiff_config {
+  std::filesystem::path old_path;
+  std::filesystem::path new_path;
+  std::size_t top_n = 10;
+  change_rank rank = change_rank::growth;
+};
+
+struct size_change {
+  std::string path;
+  std::uintmax_t old_size;
+  std::uintmax_t new_size;
+  // absent from one of the snapshots
+  bool added;
+  bool deleted;
+  double rank;
+};
+
+struct snapdiff_result {
+  // highest rank first, ties broken by the bigger change in bytes then by path
+  std::vector<size_change> top_changes;
+  std::size_t num_grown;
+  std::size_t num_shrunk;
+  std::size_t num_added;
+  std::size_t num_deleted;
+  std::uintmax_t bytes_before;
+  std::uintmax_t bytes_after;
+  // the counts and totals only cover the rows read by then
+  bool cancelled;
+};
+
+// Ranks the size changes between two snapshots saved by sizerank.
+snapdiff_result snapdiff(snapdiff_config const &cfg, std::stop_token stop = {});
+
+// ---------------------------------------------------------------------------- cmp
+
+struct cmp_config {
+  std::filesystem::path first_path;
+  std::filesystem::path second_path;
+  // comparing tasks, 0 = hardware concurrency. They run on the shared thread pool,
+  // whose size caps how many run at once, see util::thread_pool::configure_shared.
+  std::size_t num_threads = 0;
+  // bytes tasks take turns comparing
+  std::size_t chunk_size = 8 * 1024 * 1024;
+};
+
+struct cmp_result {
+  std::size_t first_size;
+  std::size_t second_size;
+  // Offset of the first differing byte, SIZE_MAX if there's none or the sizes
+  // differ, as then the contents aren't compared.
+  std::size_t first_difference;
+  unsigned char first_byte;
+  unsigned char second_byte;
+  bool cancelled;
+};
+
+// Compares two files byte for byte.
+cmp_result cmp(cmp_config const &cfg, std::stop_token stop = {});
+
+} // namespace fileutil
+
+#endif // FILEUTIL_HPP
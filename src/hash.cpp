@@ -0,0 +1,85 @@
+#include <bit>
+#include <cstring>
+
+#include "hash.hpp"
+
+uint64_t util::hash64(void const *const data, size_t const len, uint64_t const seed) {
+  uint64_t constexpr
+    prime1 = 11400714785074694791ULL,
+    prime2 = 14029467366897019727ULL,
+    prime3 = 1609587929392839161ULL,
+    prime4 = 9650029242287828579ULL,
+    prime5 = 2870177450012600261ULL;
+
+  auto const read64 = [](uint8_t const *p) {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+  };
+  auto const read32 = [](uint8_t const *p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+  };
+  auto const round = [](uint64_t acc, uint64_t const input) {
+    acc += input * prime2;
+    acc = std::rotl(acc, 31);
+    return acc * prime1;
+  };
+  auto const merge_round = [&round](uint64_t acc, uint64_t const val) {
+    acc ^= round(0, val);
+    return acc * prime1 + prime4;
+  };
+
+  auto const *p = static_cast<uint8_t const *>(data);
+  auto const *const end = p + len;
+  uint64_t h;
+
+  if (len >= 32) {
+    uint64_t
+      v1 = seed + prime1 + prime2,
+      v2 = seed + prime2,
+      v3 = seed,
+      v4 = seed - prime1;
+
+    do {
+      v1 = round(v1, read64(p));
+      v2 = round(v2, read64(p + 8));
+      v3 = round(v3, read64(p + 16));
+      v4 = round(v4, read64(p + 24));
+      p += 32;
+    } while (p + 32 <= end);
+
+    h = std::rotl(v1, 1) + std::rotl(v2, 7) + std::rotl(v3, 12) + std::rotl(v4, 18);
+    h = merge_round(h, v1);
+    h = merge_round(h, v2);
+    h = merge_round(h, v3);
+    h = merge_round(h, v4);
+  } else {
+    h = seed + prime5;
+  }
+
+  h += static_cast<uint64_t>(len);
+
+  for (; p + 8 <= end; p += 8) {
+    h ^= round(0, read64(p));
+    h = std::rotl(h, 27) * prime1 + prime4;
+  }
+  if (p + 4 <= end) {
+    h ^= static_cast<uint64_t>(read32(p)) * prime1;
+    h = std::rotl(h, 23) * prime2 + prime3;
+    p += 4;
+  }
+  for (; p < end; ++p) {
+    h ^= static_cast<uint64_t>(*p) * prime5;
+    h = std::rotl(h, 11) * prime1;
+  }
+
+  h ^= h >> 33;
+  h *= prime2;
+  h ^= h >> 29;
+  h *= prime3;
+  h ^= h >> 32;
+
+  return h;
+}
@@ -0,0 +1,14 @@
+#ifndef HASH_HPP
+#define HASH_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace util {
+
+// Fast non-cryptographic 64-bit hash (XXH64) of `len` bytes at `data`.
+[[nodiscard]] std::uint64_t hash64(void const *data, std::size_t len, std::uint64_t seed = 0);
+
+} // namespace util
+
+#endif // HASH_HPP
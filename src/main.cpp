@@ -1,22 +1,102 @@
-#include <array>
+#include <climits>
 #include <iostream>
+#include <stdexcept>
 #include <string>
-#include <utility>
-#include <functional>
+#include <string_view>
+#include <vector>
 
 #include "action.hpp"
+#include "sink.hpp"
+#include "thread_pool.hpp"
+#include "util.hpp"
+
+// More would only cost memory and switching, and catches a typo'd or negative count.
+static constexpr size_t max_threads = 1024;
+
+// Given before the action's name, they set up what every action shares.
+static constexpr opts::option global_options[] {
+  { "threads", 't', opts::arg::unsigned_int, "Number of threads in the pool the actions run their parallel work on, at most 1024, default=hardware concurrency" },
+  { "pin", 'p', opts::arg::none, "Pins each pool thread to its own CPU, default=false" },
+  { "numa", 'm', opts::arg::unsigned_int, "Keeps the pool threads on the CPUs of this NUMA node, default=any" },
+};
+
+static constexpr opts::table global_options_desc { "GLOBAL OPTIONS", global_options };
+
+// Parses argv[1..argc) as global options and sets up the shared thread pool with them.
+// Returns false, having printed why, if they're invalid.
+static
+bool configure_globals(int const argc, char const *const *const argv) {
+  using util::get_nonrequired_option;
+  using util::get_flag_option;
+
+  opts::parsed var_map;
+  try {
+    var_map = opts::parse(global_options_desc, argc, argv);
+  } catch (std::exception const &err) {
+    std::cout << '\n' << err.what() << '\n';
+    return false;
+  }
+
+  std::vector<std::string> errors{};
+  util::thread_pool::options pool_opts{};
+  {
+    auto const num_threads = get_nonrequired_option<size_t>("threads", "t", var_map, errors);
+
+    if (num_threads.has_value() && num_threads.value() == 0) {
+      errors.emplace_back("(--threads, -t) value must be > 0");
+    } else if (num_threads.has_value() && num_threads.value() > max_threads) {
+      errors.emplace_back("(--threads, -t) value must be <= " + std::to_string(max_threads));
+    } else {
+      pool_opts.num_threads = num_threads.value_or(0);
+    }
+  }
+  pool_opts.pin_to_cpus = get_flag_option("pin", var_map);
+  {
+    // as wide as the parsed value, a narrower type would wrap before the check
+    auto const numa_node = get_nonrequired_option<size_t>("numa", "m", var_map, errors);
+
+    if (numa_node.has_value() && numa_node.value() > size_t(INT_MAX)) {
+      errors.emplace_back("(--numa, -m) value must be <= " + std::to_string(INT_MAX));
+    } else {
+      pool_opts.numa_node = numa_node.has_value() ? static_cast<int>(numa_node.value()) : -1;
+    }
+  }
+
+  if (errors.empty() && argc > 1) {
+    try {
+      util::thread_pool::configure_shared(pool_opts);
+    } catch (std::invalid_argument const &err) {
+      // the NUMA node has no CPUs to run on
+      errors.emplace_back(std::string("(--numa, -m) ") + err.what());
+    } catch (std::exception const &err) {
+      errors.emplace_back(err.what());
+    }
+  }
+
+  if (!errors.empty()) {
+    std::cout << '\n';
+    for (auto const &err : errors)
+      std::cout << err << '\n';
+    return false;
+  }
+  return true;
+}
 
 int main(int const argc, char const *const *const argv) {
-  struct action_bundle {
-    std::string name;
-    std::function< std::string (void) > help_fn;
-    std::function< std::string (int, char const *const *) > perform_fn;
-  };
+  auto const &actions = action::entries;
 
-  action_bundle const actions[] {
-    { "repeat", action::repeat_help_msg, action::repeat_perform },
-    { "sizerank", action::sizerank_help_msg, action::sizerank_perform },
+  // global options come first, so the action is the first argument naming one
+  int action_idx = 1;
+  auto const names_action = [&actions](std::string_view const arg) {
+    for (auto const &action : actions) {
+      if (arg == action.name)
+        return true;
+    }
+    return false;
   };
+  while (action_idx < argc && !names_action(argv[action_idx])) {
+    ++action_idx;
+  }
 
   if (argc < 2) {
     std::string actions_str{};
@@ -27,24 +107,42 @@ int main(int const argc, char const *const *const argv) {
     actions_str.pop_back(); // remove trailing |
 
     std::cout << "\n usage: \n"
-      << "  fileutil " << actions_str << " help\n"
-      << "  fileutil " << actions_str << " [options...]\n\n";
+      << "  fileutil [global options...] " << actions_str << " help\n"
+      << "  fileutil [global options...] " << actions_str << " [options...]\n\n"
+      << opts::help_msg(global_options_desc) << '\n';
 
     return 0;
   }
 
-  std::string const first_arg = argv[1];
-  std::string const second_arg = argc >= 3 ? argv[2] : "";
+  if (action_idx == argc) {
+    return -1;
+  }
+
+  if (!configure_globals(action_idx, argv)) {
+    return -1;
+  }
+
+  // as the action sees it, its name is the first argument
+  std::vector<char const *> action_argv{ argv[0] };
+  action_argv.insert(action_argv.end(), argv + action_idx, argv + argc);
+
+  std::string_view const first_arg = action_argv[1];
+  std::string_view const second_arg = action_argv.size() >= 3 ? action_argv[2] : "";
 
   for (auto const &[name, help_fn, perform_fn] : actions) {
     if (first_arg == name) {
-      std::string out{};
-      if (second_arg == "help")
-        out = help_fn();
-      else
-        out = perform_fn(argc, argv);
-
-      std::cout << '\n' << out << '\n';
+      if (second_arg == "help") {
+        std::cout << '\n' << help_fn() << '\n';
+      } else {
+        // flushed to stdout whenever its buffer fills, not only once the action is done
+        sink::stream out(std::cout);
+        out << '\n';
+        bool const ok = perform_fn(static_cast<int>(action_argv.size()), action_argv.data(), out);
+        out << '\n';
+        if (!ok) {
+          return 1;
+        }
+      }
 
       return 0;
     }
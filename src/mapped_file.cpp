@@ -0,0 +1,166 @@
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "mapped_file.hpp"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+  [[noreturn]] void throw_file_error(char const *const what, fs::path const &path) {
+    throw std::runtime_error(std::string(what) + " '" + path.string() + "'");
+  }
+
+#ifdef _WIN32
+  // Closes a handle at the end of the scope, the view stays valid without them.
+  struct handle_closer {
+    HANDLE handle;
+    ~handle_closer() {
+      if (handle != nullptr && handle != INVALID_HANDLE_VALUE)
+        CloseHandle(handle);
+    }
+  };
+#else
+  struct fd_closer {
+    int fd;
+    ~fd_closer() { close(fd); }
+  };
+#endif
+
+} // namespace
+
+util::mapped_file::mapped_file(fs::path const &path, access const pattern) {
+#ifdef _WIN32
+  DWORD const flags = pattern == access::sequential ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_FLAG_RANDOM_ACCESS;
+  handle_closer const file{ CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+    nullptr, OPEN_EXISTING, flags, nullptr) };
+  if (file.handle == INVALID_HANDLE_VALUE) {
+    throw_file_error("unable to open file", path);
+  }
+
+  LARGE_INTEGER file_size{};
+  if (GetFileType(file.handle) == FILE_TYPE_DISK && GetFileSizeEx(file.handle, &file_size)) {
+    if (file_size.QuadPart == 0) {
+      // CreateFileMapping fails on empty files
+      return;
+    }
+    handle_closer const mapping{ CreateFileMappingW(file.handle, nullptr, PAGE_READONLY, 0, 0, nullptr) };
+    if (mapping.handle != nullptr) {
+      if (void const *const view = MapViewOfFile(mapping.handle, FILE_MAP_READ, 0, 0, 0); view != nullptr) {
+        m_data = view;
+        m_size = static_cast<size_t>(file_size.QuadPart);
+        m_mapped = true;
+        return;
+      }
+    }
+  }
+
+  // not mappable, read until the end instead
+  char chunk[64 * 1024];
+  for (;;) {
+    DWORD num_read = 0;
+    if (!ReadFile(file.handle, chunk, sizeof(chunk), &num_read, nullptr)) {
+      if (GetLastError() == ERROR_BROKEN_PIPE)
+        break; // writer closed its end
+      throw_file_error("unable to read file", path);
+    }
+    if (num_read == 0)
+      break;
+    m_buffer.insert(m_buffer.end(), chunk, chunk + num_read);
+  }
+#else
+  fd_closer const file{ open(path.c_str(), O_RDONLY | O_CLOEXEC) };
+  if (file.fd < 0) {
+    throw_file_error("unable to open file", path);
+  }
+
+  struct stat st{};
+  if (fstat(file.fd, &st) != 0) {
+    throw_file_error("unable to stat file", path);
+  }
+
+  if (S_ISREG(st.st_mode) && st.st_size > 0) {
+    size_t const file_size = static_cast<size_t>(st.st_size);
+    void *const view = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, file.fd, 0);
+    if (view != MAP_FAILED) {
+      // only hints, failures don't matter
+      if (pattern == access::sequential) {
+        madvise(view, file_size, MADV_SEQUENTIAL);
+        madvise(view, file_size, MADV_WILLNEED);
+      } else {
+        madvise(view, file_size, MADV_RANDOM);
+      }
+      m_data = view;
+      m_size = file_size;
+      m_mapped = true;
+      return;
+    }
+  }
+
+  // not mappable, or a special file whose st_size means nothing; read until the end instead
+  if (S_ISREG(st.st_mode) && st.st_size > 0) {
+    m_buffer.reserve(static_cast<size_t>(st.st_size));
+  }
+  char chunk[64 * 1024];
+  for (;;) {
+    ssize_t const num_read = read(file.fd, chunk, sizeof(chunk));
+    if (num_read < 0) {
+      if (errno == EINTR)
+        continue;
+      throw_file_error("unable to read file", path);
+    }
+    if (num_read == 0)
+      break;
+    m_buffer.insert(m_buffer.end(), chunk, chunk + num_read);
+  }
+#endif
+
+  m_data = m_buffer.data();
+  m_size = m_buffer.size();
+}
+
+util::mapped_file::~mapped_file() {
+  unmap();
+}
+
+util::mapped_file::mapped_file(mapped_file &&other) noexcept
+  : m_data(std::exchange(other.m_data, nullptr))
+  , m_size(std::exchange(other.m_size, 0))
+  , m_mapped(std::exchange(other.m_mapped, false))
+  , m_buffer(std::move(other.m_buffer)) // keeps its storage, so m_data stays valid
+{}
+
+util::mapped_file &util::mapped_file::operator=(mapped_file &&other) noexcept {
+  if (this != &other) {
+    unmap();
+    m_data = std::exchange(other.m_data, nullptr);
+    m_size = std::exchange(other.m_size, 0);
+    m_mapped = std::exchange(other.m_mapped, false);
+    m_buffer = std::move(other.m_buffer);
+  }
+  return *this;
+}
+
+void util::mapped_file::unmap() noexcept {
+  if (m_mapped) {
+#ifdef _WIN32
+    UnmapViewOfFile(m_data);
+#else
+    munmap(const_cast<void *>(m_data), m_size);
+#endif
+    m_mapped = false;
+  }
+}
@@ -0,0 +1,59 @@
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP
+
+#include <cstddef>
+#include <filesystem>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace util {
+
+// Read-only view of a whole file's contents. Regular files are memory mapped, so
+// nothing is copied and pages are only read as they're touched. Files which can't
+// be mapped (pipes, devices, files reporting size 0 like those in /proc) are read
+// into a buffer instead.
+class mapped_file {
+public:
+  enum class access {
+    // read front to back once, the kernel may read ahead aggressively
+    sequential,
+    random,
+  };
+
+  // Throws std::runtime_error if the file cannot be opened or read.
+  explicit mapped_file(std::filesystem::path const &path, access pattern = access::sequential);
+  ~mapped_file();
+
+  mapped_file(mapped_file &&other) noexcept;
+  mapped_file &operator=(mapped_file &&other) noexcept;
+
+  mapped_file(mapped_file const &) = delete;
+  mapped_file &operator=(mapped_file const &) = delete;
+
+  [[nodiscard]] std::span<std::byte const> bytes() const {
+    return { static_cast<std::byte const *>(m_data), m_size };
+  }
+
+  [[nodiscard]] std::string_view chars() const {
+    return { static_cast<char const *>(m_data), m_size };
+  }
+
+  [[nodiscard]] std::size_t size() const { return m_size; }
+
+  // False if the contents were read into a buffer instead.
+  [[nodiscard]] bool is_mapped() const { return m_mapped; }
+
+private:
+  void unmap() noexcept;
+
+  void const *m_data = nullptr;
+  std::size_t m_size = 0;
+  bool m_mapped = false;
+  // the contents when they couldn't be mapped
+  std::vector<char> m_buffer{};
+};
+
+} // namespace util
+
+#endif // MAPPED_FILE_HPP
@@ -1,17 +1,40 @@
 #define _CRT_SECURE_NO_WARNINGS
 
+#include <algorithm>
+#include <atomic>
+#include <cctype>
 #include <chrono>
 #include <cstdarg>
 #include <cstdio>
+#include <cstring>
+#include <deque>
 #include <filesystem>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <regex>
+#include <span>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "hash.hpp"
+#include "mapped_file.hpp"
 #include "ntest.hpp"
+#include "text_file.hpp"
 
 template <typename Ty, size_t Length>
 consteval
@@ -28,14 +51,70 @@ using std::stringstream;
 using std::runtime_error;
 using std::fstream;
 using ntest::internal::assertion;
+using ntest::internal::passed_assertion;
+using ntest::internal::preview_kind;
+
+namespace {
+
+  // The assertions made by a test case, or outside of one.
+  struct recording
+  {
+    vector<assertion> failed{};
+    vector<passed_assertion> passed{};
+    // blocks never move once allocated, so previews can point into them
+    vector<std::unique_ptr<char[]>> preview_blocks{};
+    size_t preview_block_used = 0;
+    vector<ntest::bench_result> benches{};
+    // counted separately, as they aren't kept while streaming
+    size_t num_passed = 0;
+    // for each of s_streams, what hasn't been written yet
+    vector<string> stream_buffers{};
+    size_t num_buffered = 0;
+    size_t num_buffered_failed = 0;
+  };
+
+  struct report_stream
+  {
+    ntest::stream_format format;
+    std::ofstream file;
+    // the <testsuite> name of assertions outside of test cases
+    string name;
+  };
+
+  struct test_case
+  {
+    string name;
+    std::function<void ()> fn;
+    source_location loc;
+    fs::path scratch_dir;
+    recording recorded;
+  };
+
+} // namespace
 
 // STATE:
-static vector<assertion> s_failed_assertions{};
-static vector<assertion> s_passed_assertions{};
+// what generate_report reports, test cases' recordings are merged into it
+static recording s_recorded{};
+// where the calling thread's assertions go, its test case's recording if it's running one
+static thread_local recording* t_recording = &s_recorded;
+static thread_local test_case const* t_case = nullptr;
+static vector<test_case> s_cases{};
+// indexed by passed_assertion::type, kept across reports as the tags live in statics
+static std::deque<string> s_type_names{};
+static std::mutex s_type_names_mutex{};
+static size_t constexpr s_preview_block_size = 64 * 1024;
+static char const s_scratch_root[] = "ntest_scratch";
+// benchmark name -> median ns
+static std::unordered_map<string, double> s_bench_baseline{};
+static std::deque<report_stream> s_streams{};
+static std::mutex s_streams_mutex{};
+// buffered assertions outside of test cases are written once there's this much
+static size_t constexpr s_stream_batch_size = 1024 * 1024;
 
 // CONFIGURABLE SETTINGS:
 static size_t s_max_str_preview_len = 20;
 static size_t s_max_arr_preview_len = 10;
+static bool s_update_digests = false;
 
 static std::pair<char, char> constexpr s_special_chars[]{
   { '\a', 'a' },
@@ -58,6 +137,31 @@ void ntest::config::set_max_arr_preview_len(size_t const len)
   s_max_arr_preview_len = len;
 }
 
+void ntest::config::set_update_digests(bool const update)
+{
+  s_update_digests = update;
+}
+
+void ntest::config::set_bench_baseline(char const* const pathname)
+{
+  s_bench_baseline.clear();
+
+  std::ifstream file(pathname);
+  string line{};
+  std::getline(file, line); // header
+
+  while (std::getline(file, line))
+  {
+    // name,num_iters,min_ns,median_ns,...
+    size_t const name_end = line.find(',');
+    size_t const iters_end = line.find(',', name_end + 1);
+    size_t const min_end = line.find(',', iters_end + 1);
+    if (min_end == string::npos)
+      continue;
+    s_bench_baseline[line.substr(0, name_end)] = std::strtod(line.c_str() + min_end + 1, nullptr);
+  }
+}
+
 char const* ntest::internal::preview_style()
 {
   return
@@ -71,6 +175,19 @@ char const* ntest::internal::preview_style()
     ;
 }
 
+char const* ntest::internal::mismatch_style()
+{
+  return
+    "background-color: #fcc;"
+    "border: 1px solid red;"
+    "border-radius: 5px;"
+    "color: black;"
+    "font-family: monospace;"
+    "padding: 1px;"
+    "white-space: pre-wrap;"
+    ;
+}
+
 size_t ntest::internal::max_str_preview_len()
 {
   return s_max_str_preview_len;
@@ -81,18 +198,344 @@ size_t ntest::internal::max_arr_preview_len()
   return s_max_arr_preview_len;
 }
 
+namespace {
+
+  void escape_json(std::string_view const str, string& out)
+  {
+    for (char const ch : str)
+    {
+      switch (ch)
+      {
+        case '"': out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default:
+          if (static_cast<unsigned char>(ch) < 0x20)
+          {
+            char code[7];
+            std::snprintf(code, sizeof(code), "\\u%04x", static_cast<unsigned>(ch));
+            out += code;
+          }
+          else
+            out += ch;
+          break;
+      }
+    }
+  }
+
+  void escape_xml(std::string_view const str, string& out)
+  {
+    for (char const ch : str)
+    {
+      switch (ch)
+      {
+        case '<': out += "&lt;"; break;
+        case '>': out += "&gt;"; break;
+        case '&': out += "&amp;"; break;
+        case '"': out += "&quot;"; break;
+        case '\'': out += "&apos;"; break;
+        case '\n': case '\r': case '\t': out += ch; break;
+        default:
+          // other control chars aren't allowed in XML 1.0, even escaped
+          out += static_cast<unsigned char>(ch) < 0x20 ? '?' : ch;
+          break;
+      }
+    }
+  }
+
+  // Undoes what the markdown report needs: the spans ntest styles previews with go,
+  // <br> becomes a newline, entities and escaped angle brackets are decoded.
+  string markdown_to_text(std::string_view md)
+  {
+    static std::pair<std::string_view, char> constexpr entities[]{
+      { "&lt;", '<' }, { "&gt;", '>' }, { "&amp;", '&' }, { "&#124;", '|' },
+      { "\\<", '<' }, { "\\>", '>' },
+    };
+
+    string text{};
+    text.reserve(md.size());
+
+    while (!md.empty())
+    {
+      if (md.starts_with("<br>"))
+      {
+        text += '\n';
+        md.remove_prefix(4);
+        continue;
+      }
+      if ((md.starts_with("<span") || md.starts_with("</span")) && md.find('>') != std::string_view::npos)
+      {
+        md.remove_prefix(md.find('>') + 1);
+        continue;
+      }
+
+      bool decoded = false;
+      for (auto const& [entity, ch] : entities)
+      {
+        if (md.starts_with(entity))
+        {
+          text += ch;
+          md.remove_prefix(entity.size());
+          decoded = true;
+          break;
+        }
+      }
+      if (!decoded)
+      {
+        text += md[0];
+        md.remove_prefix(1);
+      }
+    }
+
+    return text;
+  }
+
+  // What a passed assertion expected, as plain text.
+  string passed_expected_text(passed_assertion const& assertion)
+  {
+    std::string_view const preview(assertion.preview, assertion.preview_len);
+
+    switch (assertion.kind)
+    {
+      case preview_kind::boolean:
+        return assertion.value != 0 ? "true" : "false";
+      case preview_kind::signed_integral:
+        return std::to_string(static_cast<int64_t>(assertion.value));
+      case preview_kind::unsigned_integral:
+        return std::to_string(assertion.value);
+      case preview_kind::str:
+        if (assertion.value > assertion.preview_len)
+          return string(preview) + "... (" + std::to_string(assertion.value - assertion.preview_len) + " more)";
+        return string(preview);
+      case preview_kind::arr:
+      {
+        string text = "[";
+        size_t num_shown = 0;
+        for (size_t begin = 0; begin < preview.size(); ++num_shown)
+        {
+          size_t const end = preview.find('\0', begin);
+          if (num_shown > 0)
+            text += ", ";
+          text += preview.substr(begin, end - begin);
+          begin = end + 1;
+        }
+        if (assertion.value > num_shown)
+          text += (num_shown > 0 ? ", ... " : "... ") + std::to_string(assertion.value - num_shown) + " more";
+        return text + ']';
+      }
+      case preview_kind::verbatim:
+      case preview_kind::file_link:
+      default:
+        return string(preview);
+    }
+  }
+
+  // Serializes an assertion for every stream into the recording's buffers.
+  void buffer_for_streams(
+    recording& rec,
+    bool const passed,
+    std::string_view const type,
+    std::string_view const expected,
+    std::string_view const actual,
+    source_location const& loc,
+    test_case const* const tc)
+  {
+    rec.stream_buffers.resize(s_streams.size());
+    ++rec.num_buffered;
+    rec.num_buffered_failed += !passed;
+
+    for (size_t i = 0; i < s_streams.size(); ++i)
+    {
+      string& out = rec.stream_buffers[i];
+
+      if (s_streams[i].format == ntest::stream_format::json_lines)
+      {
+        out += "{\"outcome\":\"";
+        out += passed ? "passed" : "failed";
+        out += "\",\"case\":";
+        if (tc == nullptr)
+          out += "null";
+        else
+        {
+          out += '"';
+          escape_json(tc->name, out);
+          out += '"';
+        }
+        out += ",\"type\":\"";
+        escape_json(type, out);
+        out += "\",\"expected\":\"";
+        escape_json(expected, out);
+        out += '"';
+        if (!passed)
+        {
+          out += ",\"actual\":\"";
+          escape_json(actual, out);
+          out += '"';
+        }
+        out += ",\"function\":\"";
+        escape_json(loc.function_name(), out);
+        out += "\",\"file\":\"";
+        escape_json(loc.file_name(), out);
+        out += "\",\"line\":" + std::to_string(loc.line());
+        out += ",\"column\":" + std::to_string(loc.column()) + "}\n";
+      }
+      else // junit_xml
+      {
+        out += "    <testcase classname=\"";
+        escape_xml(fs::path(loc.file_name()).filename().string(), out);
+        out += "\" name=\"";
+        escape_xml(loc.function_name(), out);
+        out += ':' + std::to_string(loc.line()) + ',' + std::to_string(loc.column());
+        out += "\" file=\"";
+        escape_xml(loc.file_name(), out);
+        out += "\" line=\"" + std::to_string(loc.line()) + '"';
+        if (passed)
+        {
+          out += "/>\n";
+          continue;
+        }
+        out += ">\n      <failure type=\"";
+        escape_xml(type, out);
+        out += "\" message=\"assertion failed\">expected: ";
+        escape_xml(expected, out);
+        out += "\nactual: ";
+        escape_xml(actual, out);
+        out += "</failure>\n    </testcase>\n";
+      }
+    }
+  }
+
+  // Writes out a recording's buffered assertions, as one <testsuite> in XML.
+  void flush_streams(recording& rec, test_case const* const tc)
+  {
+    if (rec.num_buffered == 0)
+      return;
+
+    {
+      std::lock_guard const lock(s_streams_mutex);
+
+      for (size_t i = 0; i < s_streams.size(); ++i)
+      {
+        auto& [format, file, name] = s_streams[i];
+
+        if (format == ntest::stream_format::junit_xml)
+        {
+          string header = "  <testsuite name=\"";
+          escape_xml(tc != nullptr ? tc->name : name, header);
+          header += "\" tests=\"" + std::to_string(rec.num_buffered)
+            + "\" failures=\"" + std::to_string(rec.num_buffered_failed) + "\">\n";
+          file << header << rec.stream_buffers[i] << "  </testsuite>\n";
+        }
+        else
+          file << rec.stream_buffers[i];
+      }
+    }
+
+    for (auto& buffer : rec.stream_buffers)
+      buffer.clear();
+    rec.num_buffered = 0;
+    rec.num_buffered_failed = 0;
+  }
+
+  size_t buffered_size(recording const& rec)
+  {
+    size_t size = 0;
+    for (auto const& buffer : rec.stream_buffers)
+      size += buffer.size();
+    return size;
+  }
+
+} // namespace
+
 void ntest::internal::register_failed_assertion(
   stringstream&& ss,
   source_location const& loc)
 {
-  s_failed_assertions.emplace_back(ss.str(), loc);
+  auto& rec = *t_recording;
+  rec.failed.emplace_back(ss.str(), loc);
+
+  if (s_streams.empty())
+    return;
+
+  // "type | expected | actual"
+  std::string_view const vals = rec.failed.back().serialized_vals;
+  size_t const type_end = std::min(vals.find(" | "), vals.size());
+  size_t const expected_end = std::min(vals.find(" | ", type_end + 1), vals.size());
+  auto const field = [&vals](size_t const begin, size_t const end)
+  {
+    return begin < end ? markdown_to_text(vals.substr(begin, end - begin)) : string{};
+  };
+
+  buffer_for_streams(rec, false,
+    field(0, type_end), field(type_end + 3, expected_end), field(expected_end + 3, vals.size()),
+    loc, t_case);
+
+  if (&rec == &s_recorded && buffered_size(rec) >= s_stream_batch_size)
+    flush_streams(rec, nullptr);
 }
 
-void ntest::internal::register_passed_assertion(
-  stringstream&& ss,
-  source_location const& loc)
+void ntest::internal::register_passed_assertion(passed_assertion const& assertion)
+{
+  auto& rec = *t_recording;
+  ++rec.num_passed;
+
+  if (s_streams.empty())
+  {
+    rec.passed.push_back(assertion);
+    return;
+  }
+
+  buffer_for_streams(rec, true,
+    markdown_to_text(type_name(assertion.type)), passed_expected_text(assertion), {},
+    assertion.loc, t_case);
+
+  // passed assertions aren't kept while streaming, so unless some were before,
+  // neither are their previews
+  if (rec.passed.empty())
+  {
+    if (rec.preview_blocks.size() > 1)
+      rec.preview_blocks.erase(rec.preview_blocks.begin(), rec.preview_blocks.end() - 1);
+    rec.preview_block_used = 0;
+  }
+
+  if (&rec == &s_recorded && buffered_size(rec) >= s_stream_batch_size)
+    flush_streams(rec, nullptr);
+}
+
+uint32_t ntest::internal::intern_type_name(string name)
+{
+  std::lock_guard const lock(s_type_names_mutex);
+  s_type_names.push_back(std::move(name));
+  return static_cast<uint32_t>(s_type_names.size() - 1);
+}
+
+string const& ntest::internal::type_name(uint32_t const type)
+{
+  // deque elements stay put as it grows, so the reference outlives the lock
+  std::lock_guard const lock(s_type_names_mutex);
+  return s_type_names[type];
+}
+
+char const* ntest::internal::store_preview(char const* const data, size_t const len)
 {
-  s_passed_assertions.emplace_back(ss.str(), loc);
+  if (len == 0)
+    return nullptr;
+
+  auto& rec = *t_recording;
+
+  if (rec.preview_blocks.empty() || rec.preview_block_used + len > s_preview_block_size)
+  {
+    // a preview too big for a block gets one of its own, which is full right away
+    rec.preview_blocks.emplace_back(new char[std::max(len, s_preview_block_size)]);
+    rec.preview_block_used = 0;
+  }
+
+  char* const dst = rec.preview_blocks.back().get() + rec.preview_block_used;
+  std::memcpy(dst, data, len);
+  rec.preview_block_used += len;
+  return dst;
 }
 
 string ntest::internal::generate_file_pathname(
@@ -150,18 +593,22 @@ void assert_integral(
 {
   bool const passed = actual == expected;
 
-  stringstream serialized_vals{};
-  serialized_vals
-    << ntest::internal::beautify_typeid_name(typeid(expected).name())
-    << " | " << std::to_string(expected);
+  static uint32_t const type = ntest::internal::intern_type_name(
+    ntest::internal::beautify_typeid_name(typeid(Ty).name()));
 
   if (passed)
   {
-    ntest::internal::register_passed_assertion(std::move(serialized_vals), loc);
+    ntest::internal::register_passed_assertion({
+      loc, nullptr, static_cast<uint64_t>(expected), 0, type,
+      std::is_signed_v<Ty> ? preview_kind::signed_integral : preview_kind::unsigned_integral });
   }
   else // failed
   {
-    serialized_vals << " | " << std::to_string(actual);
+    stringstream serialized_vals{};
+    serialized_vals
+      << ntest::internal::type_name(type)
+      << " | " << std::to_string(expected)
+      << " | " << std::to_string(actual);
     ntest::internal::register_failed_assertion(std::move(serialized_vals), loc);
   }
 }
@@ -184,16 +631,19 @@ void ntest::assert_bool(
 {
   bool const passed = actual == expected;
 
-  stringstream serialized_vals{};
-  serialized_vals << "bool | " << bool_to_string(expected);
+  static uint32_t const type = ntest::internal::intern_type_name("bool");
 
   if (passed)
   {
-    ntest::internal::register_passed_assertion(std::move(serialized_vals), loc);
+    ntest::internal::register_passed_assertion({
+      loc, nullptr, expected, 0, type, preview_kind::boolean });
   }
   else // failed
   {
-    serialized_vals << " | " << bool_to_string(actual);
+    stringstream serialized_vals{};
+    serialized_vals
+      << "bool | " << bool_to_string(expected)
+      << " | " << bool_to_string(actual);
     ntest::internal::register_failed_assertion(std::move(serialized_vals), loc);
   }
 }
@@ -262,19 +712,19 @@ void ntest::assert_uint64(
   assert_integral(expected, actual, loc);
 }
 
+// `str` holds the first `max_len` chars of a `len` char string.
 static
 void serialize_str_preview(
   char const* const str,
   size_t const len,
-  stringstream& ss)
+  size_t const max_len,
+  std::ostream& ss)
 {
   ss << "len=" << len;
 
   if (len == 0)
     return;
 
-  size_t const max_len = ntest::internal::max_str_preview_len();
-
   ss << " <span style='" << ntest::internal::preview_style() << "'>";
   {
     std::string_view const content(str, std::min(len, max_len));
@@ -337,16 +787,20 @@ void ntest::assert_cstr(
     (strcmp(expected, actual) == 0)
     ;
 
-  stringstream serialized_vals{};
-  serialized_vals << "char* | ";
+  static uint32_t const type = internal::intern_type_name("char*");
 
   if (passed)
   {
-    serialize_str_preview(expected, expected_len, serialized_vals);
-    internal::register_passed_assertion(std::move(serialized_vals), loc);
+    size_t const preview_len = std::min(expected_len, internal::max_str_preview_len());
+    internal::register_passed_assertion({
+      loc, internal::store_preview(expected, preview_len), expected_len,
+      static_cast<uint32_t>(preview_len), type, preview_kind::str });
   }
   else // failed
   {
+    stringstream serialized_vals{};
+    serialized_vals << "char* | ";
+
     string const
       expected_pathname = internal::generate_file_pathname(loc, "expected"),
       actual_pathname = internal::generate_file_pathname(loc, "actual");
@@ -402,129 +856,495 @@ void ntest::assert_stdstr(
     actual.c_str(), actual.size(), options, loc);
 }
 
-static
-string extract_text_file_contents(
-  string const& pathname,
-  ntest::text_file_opts const& options)
-{
-  fstream file(pathname, std::ios::in);
-  ntest::internal::throw_if_file_not_open(file, pathname.c_str());
-
-  auto const file_size = fs::file_size(pathname);
-  string contents(file_size, '\0');
-  file.read(contents.data(), file_size);
+namespace {
 
-  if (options.canonicalize_newlines)
+  // Reads a text file in blocks, with carriage returns stripped if asked to, so
+  // two files can be compared without holding either in memory.
+  class text_block_reader
   {
-    static std::regex const carriage_returns("\r");
-    contents = std::regex_replace(contents, carriage_returns, "");
-  }
+  public:
+    text_block_reader(fs::path const& pathname, bool const strip_cr)
+      : m_file(pathname, std::ios::binary)
+      , m_strip_cr(strip_cr)
+    {
+      if (!m_file.is_open())
+        throw runtime_error("failed to open file \"" + pathname.generic_string() + '"');
+    }
 
-  return contents;
-}
+    // The unconsumed part of the current block, empty once the file was read entirely.
+    std::string_view peek()
+    {
+      if (m_pos == m_len && !m_file.eof())
+      {
+        m_file.read(m_block.data(), static_cast<std::streamsize>(m_block.size()));
+        auto const num_read = static_cast<size_t>(m_file.gcount());
+        m_len = m_strip_cr
+          ? static_cast<size_t>(util::strip_carriage_returns(
+              m_block.data(), m_block.data(), num_read, util::cr_removal::all) - m_block.data())
+          : num_read;
+        m_pos = 0;
+      }
+      return { m_block.data() + m_pos, m_len - m_pos };
+    }
 
-static
-vector<uint8_t> extract_binary_file_contents(string const& pathname)
-{
-  fstream file(pathname, std::ios::in | std::ios::binary);
-  ntest::internal::throw_if_file_not_open(file, pathname.c_str());
+    void consume(size_t const len) { m_pos += len; }
 
-  auto const file_size = fs::file_size(pathname);
+  private:
+    std::ifstream m_file;
+    bool const m_strip_cr;
+    vector<char> m_block = vector<char>(256 * 1024);
+    size_t m_pos = 0;
+    size_t m_len = 0;
+  };
 
-  std::vector<uint8_t> vec(file_size);
-  file.read(reinterpret_cast<char*>(vec.data()), file_size);
+  bool text_files_equal(fs::path const& a, fs::path const& b, bool const strip_cr)
+  {
+    text_block_reader a_reader(a, strip_cr), b_reader(b, strip_cr);
 
-  return vec;
-}
+    for (;;)
+    {
+      std::string_view const a_block = a_reader.peek(), b_block = b_reader.peek();
+      if (a_block.empty() || b_block.empty())
+        return a_block.empty() && b_block.empty();
+
+      size_t const len = std::min(a_block.size(), b_block.size());
+      if (std::memcmp(a_block.data(), b_block.data(), len) != 0)
+        return false;
+      a_reader.consume(len);
+      b_reader.consume(len);
+    }
+  }
 
-ntest::text_file_opts ntest::default_text_file_opts()
-{
-  static text_file_opts const s_options = { true };
-  return s_options;
-}
+  // A text file's lines, as hashes for the diff to compare and as offsets to
+  // print them from, so diffing doesn't need the text in memory.
+  struct hashed_lines
+  {
+    util::mapped_file file;
+    bool strip_cr;
+    // FNV-1a of each line including its '\n', if any, minus stripped CRs
+    vector<uint64_t> hashes{};
+    // where each line starts, then the end of the file
+    vector<size_t> starts{};
+
+    hashed_lines(fs::path const& pathname, bool const strip_crs)
+      : file(pathname)
+      , strip_cr(strip_crs)
+    {
+      std::string_view const text = file.chars();
+      uint64_t hash = 14695981039346656037ULL;
 
-void ntest::assert_text_file(
-  char const* const expected_pathname,
-  char const* const actual_pathname,
-  text_file_opts const& options,
-  source_location const loc)
-{
-  assert_text_file(
-    fs::path(expected_pathname), fs::path(actual_pathname), options, loc);
-}
+      starts.push_back(0);
+      for (size_t i = 0; i < text.size(); ++i)
+      {
+        char const ch = text[i];
+        if (ch == '\r' && strip_cr)
+          continue;
+        hash = (hash ^ static_cast<unsigned char>(ch)) * 1099511628211ULL;
+        if (ch == '\n')
+        {
+          hashes.push_back(hash);
+          starts.push_back(i + 1);
+          hash = 14695981039346656037ULL;
+        }
+      }
+      if (starts.back() != text.size())
+      {
+        hashes.push_back(hash);
+        starts.push_back(text.size());
+      }
+    }
 
-void ntest::assert_text_file(
-  string const& expected_pathname,
-  string const& actual_pathname,
-  text_file_opts const& options,
-  source_location const loc)
-{
-  assert_text_file(
-    fs::path(expected_pathname), fs::path(actual_pathname), options, loc);
-}
+    size_t size() const { return hashes.size(); }
 
-void ntest::assert_text_file(
-  fs::path const& expected_pathname,
-  fs::path const& actual_pathname,
-  text_file_opts const& options,
-  source_location const loc)
-{
-  bool expected_exists, actual_exists;
-  {
-    std::error_code ec{};
-    expected_exists = fs::is_regular_file(expected_pathname, ec);
-    actual_exists = fs::is_regular_file(actual_pathname, ec);
-  }
+    // Without its '\n' (and CRs, if stripped).
+    string line(size_t const idx) const
+    {
+      std::string_view const text = file.chars().substr(starts[idx], starts[idx + 1] - starts[idx]);
+      string str{};
+      for (char const ch : text)
+        if (ch != '\n' && !(ch == '\r' && strip_cr))
+          str += ch;
+      return str;
+    }
 
-  string const
-    expected_pathname_generic = expected_pathname.generic_string(),
-    actual_pathname_generic = actual_pathname.generic_string();
+    bool ends_with_newline() const
+    {
+      std::string_view const text = file.chars();
+      return text.empty() || text.back() == '\n';
+    }
+  };
 
-  string const
-    expected = expected_exists
-    ? extract_text_file_contents(expected_pathname_generic, options)
-    : "",
-    actual = actual_exists
-    ? extract_text_file_contents(actual_pathname_generic, options)
-    : "";
+  // Myers' O((N+M)D) diff in linear space: finds the middle snake of the edit
+  // graph by searching from both ends, then recurses on the halves either side
+  // of it. Lines which aren't part of the longest common subsequence get flagged
+  // in a_changed and b_changed.
+  class line_differ
+  {
+  public:
+    line_differ(vector<uint64_t> const& a, vector<uint64_t> const& b)
+      : m_a(a), m_b(b)
+      , m_a_changed(a.size(), false), m_b_changed(b.size(), false)
+      , m_forward(2 * (a.size() + b.size()) + 3)
+      , m_backward(2 * (a.size() + b.size()) + 3)
+    {
+      compare(0, a.size(), 0, b.size());
+    }
 
-  bool const passed = expected_exists && actual_exists && expected == actual;
+    vector<bool> const& a_changed() const { return m_a_changed; }
+    vector<bool> const& b_changed() const { return m_b_changed; }
 
-  stringstream serialized_vals{};
+  private:
+    struct snake { size_t x_begin, y_begin, x_end, y_end; };
 
-  serialized_vals << "text file | ";
-  if (!expected_exists)
-  {
-    serialized_vals << "<span style='color:red;'>file not found</span>";
-  }
-  else
-  {
-    serialized_vals
-      << '[' << expected_pathname_generic << "]("
-      << expected_pathname_generic << ')';
-  }
+    // Past this many edits in one subproblem the search gives up and flags the
+    // whole subproblem as replaced, which bounds time on files with little in common.
+    static size_t constexpr s_max_edits = 4096;
 
-  if (passed)
-  {
-    internal::register_passed_assertion(std::move(serialized_vals), loc);
-  }
-  else // failed
-  {
-    serialized_vals << " | ";
-    if (!actual_exists)
-      serialized_vals << "<span style='color:red;'>file not found</span>";
-    else
+    void compare(size_t a_lo, size_t a_hi, size_t b_lo, size_t b_hi)
     {
-      serialized_vals
-        << '[' << actual_pathname_generic << "]("
-        << actual_pathname_generic << ')';
-    }
-    internal::register_failed_assertion(std::move(serialized_vals), loc);
-  }
-}
+      while (a_lo < a_hi && b_lo < b_hi && m_a[a_lo] == m_b[b_lo])
+        ++a_lo, ++b_lo;
+      while (a_lo < a_hi && b_lo < b_hi && m_a[a_hi - 1] == m_b[b_hi - 1])
+        --a_hi, --b_hi;
 
-void ntest::assert_binary_file(
-  char const* const expected_pathname,
+      if (a_lo == a_hi || b_lo == b_hi)
+      {
+        flag(a_lo, a_hi, b_lo, b_hi);
+        return;
+      }
+
+      snake s{};
+      if (!find_middle_snake(a_lo, a_hi, b_lo, b_hi, s)
+        || (s.x_end == a_hi && s.y_end == b_hi && s.x_begin == a_hi && s.y_begin == b_hi)
+        || (s.x_begin == a_lo && s.y_begin == b_lo && s.x_end == a_lo && s.y_end == b_lo))
+      {
+        flag(a_lo, a_hi, b_lo, b_hi);
+        return;
+      }
+
+      compare(a_lo, s.x_begin, b_lo, s.y_begin);
+      compare(s.x_end, a_hi, s.y_end, b_hi);
+    }
+
+    void flag(size_t const a_lo, size_t const a_hi, size_t const b_lo, size_t const b_hi)
+    {
+      for (size_t i = a_lo; i < a_hi; ++i)
+        m_a_changed[i] = true;
+      for (size_t i = b_lo; i < b_hi; ++i)
+        m_b_changed[i] = true;
+    }
+
+    // Diagonals are indexed by k = x - y, backward ones by c = (n - x) - (m - y)
+    // with (x, y) relative to (a_lo, b_lo). Both arrays hold the furthest x reached.
+    bool find_middle_snake(
+      size_t const a_lo, size_t const a_hi,
+      size_t const b_lo, size_t const b_hi,
+      snake& out)
+    {
+      auto const n = static_cast<ptrdiff_t>(a_hi - a_lo);
+      auto const m = static_cast<ptrdiff_t>(b_hi - b_lo);
+      ptrdiff_t const delta = n - m;
+      bool const odd = (delta & 1) != 0;
+      ptrdiff_t const offset = n + m + 1;
+      ptrdiff_t const max_d = std::min<ptrdiff_t>((n + m + 1) / 2, s_max_edits);
+
+      auto const a_at = [&](ptrdiff_t const x) { return m_a[a_lo + static_cast<size_t>(x)]; };
+      auto const b_at = [&](ptrdiff_t const y) { return m_b[b_lo + static_cast<size_t>(y)]; };
+      auto const fwd = [&](ptrdiff_t const k) -> ptrdiff_t& { return m_forward[static_cast<size_t>(k + offset)]; };
+      auto const bwd = [&](ptrdiff_t const c) -> ptrdiff_t& { return m_backward[static_cast<size_t>(c + offset)]; };
+
+      fwd(1) = 0;
+      bwd(1) = 0;
+
+      for (ptrdiff_t d = 0; d <= max_d; ++d)
+      {
+        for (ptrdiff_t k = -d; k <= d; k += 2)
+        {
+          bool const down = k == -d || (k != d && fwd(k - 1) < fwd(k + 1));
+          ptrdiff_t x = down ? fwd(k + 1) : fwd(k - 1) + 1;
+          ptrdiff_t y = x - k;
+          ptrdiff_t const x_begin = x, y_begin = y;
+          while (x < n && y < m && a_at(x) == b_at(y))
+            ++x, ++y;
+          fwd(k) = x;
+
+          ptrdiff_t const c = delta - k;
+          if (odd && c >= -(d - 1) && c <= d - 1 && x + bwd(c) >= n)
+          {
+            out = { a_lo + static_cast<size_t>(x_begin), b_lo + static_cast<size_t>(y_begin),
+              a_lo + static_cast<size_t>(x), b_lo + static_cast<size_t>(y) };
+            return true;
+          }
+        }
+
+        for (ptrdiff_t c = -d; c <= d; c += 2)
+        {
+          bool const down = c == -d || (c != d && bwd(c - 1) < bwd(c + 1));
+          ptrdiff_t x = down ? bwd(c + 1) : bwd(c - 1) + 1;
+          ptrdiff_t y = x - c;
+          ptrdiff_t const x_begin = x, y_begin = y;
+          while (x < n && y < m && a_at(n - 1 - x) == b_at(m - 1 - y))
+            ++x, ++y;
+          bwd(c) = x;
+
+          ptrdiff_t const k = delta - c;
+          if (!odd && k >= -d && k <= d && x + fwd(k) >= n)
+          {
+            out = { a_lo + static_cast<size_t>(n - x), b_lo + static_cast<size_t>(m - y),
+              a_lo + static_cast<size_t>(n - x_begin), b_lo + static_cast<size_t>(m - y_begin) };
+            return true;
+          }
+        }
+      }
+
+      return false;
+    }
+
+    vector<uint64_t> const& m_a;
+    vector<uint64_t> const& m_b;
+    vector<bool> m_a_changed;
+    vector<bool> m_b_changed;
+    vector<ptrdiff_t> m_forward;
+    vector<ptrdiff_t> m_backward;
+  };
+
+  void escape_html(string const& str, stringstream& ss)
+  {
+    for (char const ch : str)
+    {
+      switch (ch)
+      {
+        case '<': ss << "&lt;"; break;
+        case '>': ss << "&gt;"; break;
+        case '&': ss << "&amp;"; break;
+        case '|': ss << "&#124;"; break; // would end the table cell
+        default: ss << ch; break;
+      }
+    }
+  }
+
+  // Renders the start of a unified diff with 3 lines of context, at most
+  // `max_lines` lines of it, as one table cell's worth of html.
+  void serialize_diff_excerpt(
+    hashed_lines const& a,
+    hashed_lines const& b,
+    stringstream& ss)
+  {
+    size_t constexpr context = 3, max_lines = 40;
+
+    line_differ const differ(a.hashes, b.hashes);
+    vector<bool> const& a_changed = differ.a_changed();
+    vector<bool> const& b_changed = differ.b_changed();
+
+    ss << "<br><span style='" << ntest::internal::preview_style() << "'>--- expected<br>+++ actual";
+
+    size_t num_lines = 0;
+    size_t i = 0, j = 0;
+
+    while (i < a.size() || j < b.size())
+    {
+      // skip to the next change, unchanged lines pair up so both run out together
+      while (i < a.size() && j < b.size() && !a_changed[i] && !b_changed[j])
+        ++i, ++j;
+      if ((i == a.size() || !a_changed[i]) && (j == b.size() || !b_changed[j]))
+        break;
+
+      // a hunk runs until `context` * 2 unchanged lines in a row, or the end
+      size_t const hunk_i = i - std::min(i, context), hunk_j = j - std::min(j, context);
+      size_t end_i = i, end_j = j, unchanged_run = 0;
+      while ((end_i < a.size() || end_j < b.size()) && unchanged_run < 2 * context)
+      {
+        if (end_i < a.size() && a_changed[end_i])
+          ++end_i, unchanged_run = 0;
+        else if (end_j < b.size() && b_changed[end_j])
+          ++end_j, unchanged_run = 0;
+        else
+          ++end_i, ++end_j, ++unchanged_run;
+      }
+      size_t const trailing = unchanged_run > context ? unchanged_run - context : 0;
+      end_i = std::min(end_i - trailing, a.size());
+      end_j = std::min(end_j - trailing, b.size());
+
+      ss << "<br>@@ -" << hunk_i + 1 << ',' << end_i - hunk_i << " +" << hunk_j + 1 << ',' << end_j - hunk_j << " @@";
+
+      size_t x = hunk_i, y = hunk_j;
+      while (x < end_i || y < end_j)
+      {
+        if (++num_lines > max_lines)
+        {
+          ss << "<br>*... diff truncated*</span>";
+          return;
+        }
+
+        ss << "<br>";
+        if (x < end_i && a_changed[x])
+        {
+          ss << '-';
+          escape_html(a.line(x++), ss);
+          if (x == a.size() && !a.ends_with_newline())
+            ss << "<br>\\ No newline at end of file";
+        }
+        else if (y < end_j && b_changed[y])
+        {
+          ss << '+';
+          escape_html(b.line(y++), ss);
+          if (y == b.size() && !b.ends_with_newline())
+            ss << "<br>\\ No newline at end of file";
+        }
+        else
+        {
+          ss << ' ';
+          escape_html(a.line(x++), ss);
+          ++y;
+        }
+      }
+
+      i = end_i;
+      j = end_j;
+    }
+
+    ss << "</span>";
+  }
+
+} // namespace
+
+static
+void register_passed_file(
+  uint32_t const type,
+  string const& expected_pathname_generic,
+  source_location const& loc)
+{
+  ntest::internal::register_passed_assertion({
+    loc,
+    ntest::internal::store_preview(expected_pathname_generic.data(), expected_pathname_generic.size()),
+    0,
+    static_cast<uint32_t>(expected_pathname_generic.size()),
+    type,
+    preview_kind::file_link,
+  });
+}
+
+ntest::text_file_opts ntest::default_text_file_opts()
+{
+  static text_file_opts const s_options = { true };
+  return s_options;
+}
+
+void ntest::assert_text_file(
+  char const* const expected_pathname,
+  char const* const actual_pathname,
+  text_file_opts const& options,
+  source_location const loc)
+{
+  assert_text_file(
+    fs::path(expected_pathname), fs::path(actual_pathname), options, loc);
+}
+
+void ntest::assert_text_file(
+  string const& expected_pathname,
+  string const& actual_pathname,
+  text_file_opts const& options,
+  source_location const loc)
+{
+  assert_text_file(
+    fs::path(expected_pathname), fs::path(actual_pathname), options, loc);
+}
+
+void ntest::assert_text_file(
+  fs::path const& expected_pathname,
+  fs::path const& actual_pathname,
+  text_file_opts const& options,
+  source_location const loc)
+{
+  bool expected_exists, actual_exists;
+  {
+    std::error_code ec{};
+    expected_exists = fs::is_regular_file(expected_pathname, ec);
+    actual_exists = fs::is_regular_file(actual_pathname, ec);
+  }
+
+  string const
+    expected_pathname_generic = expected_pathname.generic_string(),
+    actual_pathname_generic = actual_pathname.generic_string();
+
+  // streamed, the diff is only worked out if they differ
+  bool const passed = expected_exists && actual_exists &&
+    text_files_equal(expected_pathname, actual_pathname, options.canonicalize_newlines);
+
+  static uint32_t const file_type = internal::intern_type_name("text file");
+
+  if (passed)
+  {
+    register_passed_file(file_type, expected_pathname_generic, loc);
+    return;
+  }
+
+  stringstream serialized_vals{};
+
+  serialized_vals << "text file | ";
+  if (!expected_exists)
+  {
+    serialized_vals << "<span style='color:red;'>file not found</span>";
+  }
+  else
+  {
+    serialized_vals
+      << '[' << expected_pathname_generic << "]("
+      << expected_pathname_generic << ')';
+  }
+
+  serialized_vals << " | ";
+  if (!actual_exists)
+    serialized_vals << "<span style='color:red;'>file not found</span>";
+  else
+  {
+    serialized_vals
+      << '[' << actual_pathname_generic << "]("
+      << actual_pathname_generic << ')';
+
+    if (expected_exists)
+    {
+      hashed_lines const
+        expected_lines(expected_pathname, options.canonicalize_newlines),
+        actual_lines(actual_pathname, options.canonicalize_newlines);
+      serialize_diff_excerpt(expected_lines, actual_lines, serialized_vals);
+    }
+  }
+  internal::register_failed_assertion(std::move(serialized_vals), loc);
+}
+
+// Hex dump of up to 8 bytes either side of `offset`, with the byte at `offset` in brackets.
+static
+string hex_window(std::span<std::byte const> const bytes, size_t const offset)
+{
+  size_t constexpr radius = 8;
+  size_t const
+    first = offset > radius ? offset - radius : 0,
+    last = std::min(bytes.size(), offset + radius + 1);
+
+  char constexpr digits[] = "0123456789abcdef";
+  string window = first > 0 ? "... " : "";
+
+  for (size_t i = first; i < last; ++i)
+  {
+    auto const byte = static_cast<unsigned>(bytes[i]);
+    if (i == offset)
+      window += '[';
+    window += digits[byte >> 4];
+    window += digits[byte & 0xf];
+    if (i == offset)
+      window += ']';
+    if (i + 1 < last)
+      window += ' ';
+  }
+
+  if (last < bytes.size())
+    window += " ...";
+  return window;
+}
+
+void ntest::assert_binary_file(
+  char const* const expected_pathname,
   char const* const actual_pathname,
   source_location const loc)
 {
@@ -557,26 +1377,54 @@ void ntest::assert_binary_file(
     expected_pathname_generic = expected_pathname.generic_string(),
     actual_pathname_generic = actual_pathname.generic_string();
 
-  vector<uint8_t> const expected = [
-    expected_exists, &expected_pathname_generic]()
-  {
-    if (expected_exists)
-      return extract_binary_file_contents(expected_pathname_generic);
-    else
-      return vector<uint8_t>();
-  }();
+  // the sizes are compared before reading any contents, and the contents are
+  // mapped rather than read, so huge files cost neither a copy nor a full pass
+  // when they differ early
+  string mismatch_details{};
+  bool passed = false;
 
-  vector<uint8_t> const actual = [actual_exists, &actual_pathname_generic]()
+  if (expected_exists && actual_exists)
   {
-    if (actual_exists)
-      return extract_binary_file_contents(actual_pathname_generic);
+    std::error_code ec{};
+    uintmax_t const
+      expected_size = fs::file_size(expected_pathname, ec),
+      actual_size = fs::file_size(actual_pathname, ec);
+
+    if (expected_size != actual_size)
+    {
+      stringstream details{};
+      details << "<br>sizes differ: " << expected_size << " vs " << actual_size << " bytes";
+      mismatch_details = details.str();
+    }
     else
-      return vector<uint8_t>();
-  }();
+    {
+      util::mapped_file const
+        expected(expected_pathname),
+        actual(actual_pathname);
 
-  bool const passed = expected_exists && actual_exists &&
-    internal::arr_eq(expected.data(), expected.size(),
-      actual.data(), actual.size());
+      size_t const offset = internal::arr_mismatch(
+        expected.bytes().data(), expected.size(), actual.bytes().data(), actual.size());
+      passed = offset == SIZE_MAX;
+
+      if (!passed)
+      {
+        stringstream details{};
+        details
+          << "<br>first difference at offset " << offset
+          << "<br>expected `" << hex_window(expected.bytes(), offset) << '`'
+          << "<br>actual `" << hex_window(actual.bytes(), offset) << '`';
+        mismatch_details = details.str();
+      }
+    }
+  }
+
+  static uint32_t const file_type = internal::intern_type_name("binary file");
+
+  if (passed)
+  {
+    register_passed_file(file_type, expected_pathname_generic, loc);
+    return;
+  }
 
   stringstream serialized_vals{};
 
@@ -590,30 +1438,310 @@ void ntest::assert_binary_file(
       << expected_pathname_generic << ')';
   }
 
+  serialized_vals << " | ";
+  if (!actual_exists)
+    serialized_vals << "<span style='color:red;'>file not found</span>";
+  else
+  {
+    serialized_vals
+      << '[' << actual_pathname_generic << "]("
+      << actual_pathname_generic << ')'
+      << mismatch_details;
+  }
+  internal::register_failed_assertion(std::move(serialized_vals), loc);
+}
+
+namespace {
+
+  struct file_digest
+  {
+    uint64_t size;
+    uint64_t chunk_size;
+    // of the chunk hashes, so reordered chunks change it too
+    uint64_t digest;
+    vector<uint64_t> chunk_hashes;
+  };
+
+  file_digest compute_file_digest(fs::path const& pathname, uint64_t const chunk_size)
+  {
+    util::mapped_file const file(pathname);
+    auto const* const data = file.bytes().data();
+
+    file_digest res{ file.size(), chunk_size, 0, {} };
+    size_t const num_chunks = static_cast<size_t>((res.size + chunk_size - 1) / chunk_size);
+    res.chunk_hashes.resize(num_chunks);
+
+    std::atomic<size_t> next_chunk = 0;
+    auto const hash_chunks = [&]()
+    {
+      for (size_t i; (i = next_chunk.fetch_add(1, std::memory_order_relaxed)) < num_chunks;)
+      {
+        uint64_t const begin = i * chunk_size;
+        uint64_t const len = std::min(chunk_size, res.size - begin);
+        res.chunk_hashes[i] = util::hash64(data + static_cast<size_t>(begin), static_cast<size_t>(len), i);
+      }
+    };
+
+    size_t const num_threads = std::min<size_t>(
+      std::max(std::thread::hardware_concurrency(), 1u), num_chunks);
+    {
+      vector<std::jthread> threads{};
+      for (size_t i = 1; i < num_threads; ++i)
+        threads.emplace_back(hash_chunks);
+      hash_chunks();
+    }
+
+    res.digest = util::hash64(
+      res.chunk_hashes.data(), res.chunk_hashes.size() * sizeof(uint64_t), res.size);
+    return res;
+  }
+
+  // The format is line based, "<key> <value>", hashes in hex:
+  //   size 20000
+  //   chunk_size 16777216
+  //   digest 0123456789abcdef
+  //   chunk 0123456789abcdef    (one line per chunk)
+  void write_file_digest(fs::path const& pathname, file_digest const& digest)
+  {
+    std::ofstream file(pathname, std::ios::out | std::ios::trunc);
+    if (!file.is_open())
+      throw runtime_error("failed to open file \"" + pathname.string() + '"');
+
+    file
+      << "size " << digest.size << '\n'
+      << "chunk_size " << digest.chunk_size << '\n'
+      << std::hex << std::setfill('0')
+      << "digest " << std::setw(16) << digest.digest << '\n';
+    for (uint64_t const hash : digest.chunk_hashes)
+      file << "chunk " << std::setw(16) << hash << '\n';
+  }
+
+  file_digest read_file_digest(fs::path const& pathname)
+  {
+    std::ifstream file(pathname);
+    if (!file.is_open())
+      throw runtime_error("failed to open file \"" + pathname.string() + '"');
+
+    file_digest res{};
+    string key{};
+    bool has_size = false, has_chunk_size = false, has_digest = false;
+
+    while (file >> key)
+    {
+      if (key == "size")
+        has_size = static_cast<bool>(file >> res.size);
+      else if (key == "chunk_size")
+        has_chunk_size = static_cast<bool>(file >> res.chunk_size);
+      else if (key == "digest")
+        has_digest = static_cast<bool>(file >> std::hex >> res.digest >> std::dec);
+      else if (uint64_t hash; key == "chunk" && file >> std::hex >> hash >> std::dec)
+        res.chunk_hashes.push_back(hash);
+      else
+        break;
+    }
+
+    bool const complete = file.eof() && has_size && has_chunk_size && has_digest && res.chunk_size > 0 &&
+      res.chunk_hashes.size() == (res.size + res.chunk_size - 1) / res.chunk_size;
+    if (!complete)
+      throw runtime_error("malformed digest \"" + pathname.string() + '"');
+
+    return res;
+  }
+
+} // namespace
+
+void ntest::write_binary_file_digest(
+  fs::path const& digest_pathname,
+  fs::path const& pathname,
+  uint64_t const chunk_size)
+{
+  if (chunk_size == 0)
+    throw runtime_error("digest chunk size must be > 0");
+  write_file_digest(digest_pathname, compute_file_digest(pathname, chunk_size));
+}
+
+void ntest::assert_binary_file_digest(
+  char const* const expected_digest_pathname,
+  char const* const actual_pathname,
+  source_location const loc)
+{
+  assert_binary_file_digest(
+    fs::path(expected_digest_pathname), fs::path(actual_pathname), loc);
+}
+
+void ntest::assert_binary_file_digest(
+  string const& expected_digest_pathname,
+  string const& actual_pathname,
+  source_location const loc)
+{
+  assert_binary_file_digest(
+    fs::path(expected_digest_pathname), fs::path(actual_pathname), loc);
+}
+
+void ntest::assert_binary_file_digest(
+  fs::path const& expected_digest_pathname,
+  fs::path const& actual_pathname,
+  source_location const loc)
+{
+  bool expected_exists, actual_exists;
+  {
+    std::error_code ec{};
+    expected_exists = fs::is_regular_file(expected_digest_pathname, ec);
+    actual_exists = fs::is_regular_file(actual_pathname, ec);
+  }
+
+  if (s_update_digests && actual_exists)
+  {
+    // keeps the chunk size the digest had
+    uint64_t const chunk_size = expected_exists
+      ? read_file_digest(expected_digest_pathname).chunk_size
+      : 16 * 1024 * 1024;
+    write_binary_file_digest(expected_digest_pathname, actual_pathname, chunk_size);
+    expected_exists = true;
+  }
+
+  string const
+    expected_pathname_generic = expected_digest_pathname.generic_string(),
+    actual_pathname_generic = actual_pathname.generic_string();
+
+  bool passed = false;
+  string mismatch_details{};
+
+  if (expected_exists && actual_exists)
+  {
+    file_digest const expected = read_file_digest(expected_digest_pathname);
+    file_digest const actual = compute_file_digest(actual_pathname, expected.chunk_size);
+
+    passed = expected.size == actual.size && expected.digest == actual.digest;
+
+    if (!passed)
+    {
+      stringstream details{};
+      if (expected.size != actual.size)
+        details << "<br>sizes differ, expected " << expected.size << " B, actual " << actual.size << " B";
+
+      size_t num_differing = 0;
+      size_t first_differing = SIZE_MAX;
+      size_t const num_common = std::min(expected.chunk_hashes.size(), actual.chunk_hashes.size());
+      for (size_t i = 0; i < num_common; ++i)
+      {
+        if (expected.chunk_hashes[i] != actual.chunk_hashes[i])
+        {
+          ++num_differing;
+          first_differing = std::min(first_differing, i);
+        }
+      }
+
+      if (num_differing > 0)
+      {
+        uint64_t const begin = first_differing * expected.chunk_size;
+        uint64_t const end = std::min(begin + expected.chunk_size, std::max(expected.size, actual.size));
+        details
+          << "<br>" << num_differing << " of " << num_common << " chunks differ, the first one being bytes ["
+          << begin << ", " << end << ')';
+      }
+      mismatch_details = details.str();
+    }
+  }
+
+  static uint32_t const file_type = internal::intern_type_name("binary file digest");
+
   if (passed)
   {
-    internal::register_passed_assertion(std::move(serialized_vals), loc);
+    register_passed_file(file_type, expected_pathname_generic, loc);
+    return;
   }
-  else // failed
+
+  stringstream serialized_vals{};
+
+  serialized_vals << "binary file digest | ";
+  if (!expected_exists)
+    serialized_vals << "<span style='color:red;'>file not found</span>";
+  else
   {
-    serialized_vals << " | ";
-    if (!actual_exists)
-      serialized_vals << "<span style='color:red;'>file not found</span>";
-    else
+    serialized_vals
+      << '[' << expected_pathname_generic << "]("
+      << expected_pathname_generic << ')';
+  }
+
+  serialized_vals << " | ";
+  if (!actual_exists)
+    serialized_vals << "<span style='color:red;'>file not found</span>";
+  else
+  {
+    serialized_vals
+      << '[' << actual_pathname_generic << "]("
+      << actual_pathname_generic << ')'
+      << mismatch_details;
+  }
+  internal::register_failed_assertion(std::move(serialized_vals), loc);
+}
+
+static
+void serialize_passed_expected(passed_assertion const& assertion, std::ostream& os)
+{
+  std::string_view const preview(assertion.preview, assertion.preview_len);
+
+  switch (assertion.kind)
+  {
+    case preview_kind::verbatim:
+      os << preview;
+      break;
+
+    case preview_kind::boolean:
+      os << bool_to_string(assertion.value != 0);
+      break;
+
+    case preview_kind::signed_integral:
+      os << static_cast<int64_t>(assertion.value);
+      break;
+
+    case preview_kind::unsigned_integral:
+      os << assertion.value;
+      break;
+
+    case preview_kind::str:
+      serialize_str_preview(assertion.preview, assertion.value, assertion.preview_len, os);
+      break;
+
+    case preview_kind::arr:
     {
-      serialized_vals
-        << '[' << actual_pathname_generic << "]("
-        << actual_pathname_generic << ')';
+      os << "sz=" << assertion.value;
+
+      if (assertion.value == 0)
+        break;
+
+      os << " __[__ ";
+
+      size_t i = 0;
+      for (size_t begin = 0; begin < preview.size(); ++i)
+      {
+        size_t const end = preview.find('\0', begin);
+        os
+          << "<span style='" << ntest::internal::preview_style() << "' title='index " << i << "'>"
+          << preview.substr(begin, end - begin) << "</span>, ";
+        begin = end + 1;
+      }
+
+      if (assertion.value > i)
+      {
+        os << " *... " << (assertion.value - i) << " more* ";
+      }
+      os << "__]__";
+      break;
     }
-    internal::register_failed_assertion(std::move(serialized_vals), loc);
+
+    case preview_kind::file_link:
+      os << '[' << preview << "](" << preview << ')';
+      break;
   }
 }
 
 ntest::report_result ntest::generate_report(char const* const name)
 {
   size_t const
-    total_failed = s_failed_assertions.size(),
-    total_passed = s_passed_assertions.size();
+    total_failed = s_recorded.failed.size(),
+    total_passed = s_recorded.num_passed;
 
   string report_path = "./";
   report_path.append(name);
@@ -633,12 +1761,9 @@ ntest::report_result ntest::generate_report(char const* const name)
       ;
   }
 
-  auto const print_table_row = [&ofs](assertion const& assertion, bool const passed)
+  auto const print_location = [&ofs](source_location const& loc)
   {
-    auto const& [serialized_vals, loc] = assertion;
     ofs
-      << "| " << (passed ? "✅" : "❌") << ' ' // Outcome
-      << "| " << serialized_vals << " | " // Type, Expected, [Actual]
       << loc.function_name() << ':' << loc.line() << ',' << loc.column() // Location
       << " | " << loc.file_name() << " |\n" // Source File
       // << " | [" << loc.file_name() << "](" << loc.file_name() << ") |\n" // Source File
@@ -652,28 +1777,59 @@ ntest::report_result ntest::generate_report(char const* const name)
       << "| - | - | - | - | - | - |\n"
       ;
 
-    for (auto const& assertion : s_failed_assertions)
-      print_table_row(assertion, false);
+    for (auto const& [serialized_vals, loc] : s_recorded.failed)
+    {
+      ofs << "| ❌ | " << serialized_vals << " | "; // Outcome, Type, Expected, Actual
+      print_location(loc);
+    }
 
     ofs << '\n';
   }
 
-  if (total_passed > 0)
+  // none are kept while streaming
+  if (!s_recorded.passed.empty())
   {
     ofs
       << "| | Type | Expected | Location (fn:ln,col) | Source File |\n"
       << "| - | - | - | - | - |\n"
       ;
 
-    for (auto const& assertion : s_passed_assertions)
-      print_table_row(assertion, true);
+    for (auto const& assertion : s_recorded.passed)
+    {
+      ofs << "| ✅ | " << internal::type_name(assertion.type) << " | "; // Outcome, Type
+      serialize_passed_expected(assertion, ofs); // Expected
+      ofs << " | ";
+      print_location(assertion.loc);
+    }
 
     ofs << '\n';
   }
 
+  if (!s_recorded.benches.empty())
+  {
+    std::ofstream csv("./" + string(name) + ".bench.csv", std::ios::out);
+    csv
+      << "name,num_iters,min_ns,median_ns,p99_ns,bytes_per_sec,items_per_sec\n"
+      << std::fixed;
+    for (auto const& res : s_recorded.benches)
+    {
+      csv
+        << res.name << ',' << res.num_iters << ',' << std::setprecision(1)
+        << res.min_ns << ',' << res.median_ns << ',' << res.p99_ns << ','
+        << std::setprecision(0) << res.bytes_per_sec << ',' << res.items_per_sec << '\n';
+    }
+  }
+
+  flush_streams(s_recorded, nullptr);
+  for (auto& stream : s_streams)
+  {
+    if (stream.format == stream_format::junit_xml)
+      stream.file << "</testsuites>\n";
+  }
+  s_streams.clear();
+
   // reset state to allow user to generate multiple independent reports
-  s_failed_assertions.clear();
-  s_passed_assertions.clear();
+  s_recorded = {};
 
   return { total_passed, total_failed };
 }
@@ -686,6 +1842,19 @@ ntest::init_result ntest::init(bool const remove_residual_files)
 
   if (remove_residual_files)
   {
+    // remove the scratch directories of failed test cases
+    {
+      std::error_code ec{};
+      auto const num_removed = fs::remove_all(s_scratch_root, ec);
+      if (ec)
+      {
+        std::cerr << "failed to remove " << s_scratch_root << ", " << ec.message() << '\n';
+        ++num_files_failed_to_remove;
+      }
+      else
+        num_files_removed += static_cast<size_t>(num_removed);
+    }
+
     // remove any residual .expected and .actual files
     for (
       auto const& entry :
@@ -724,14 +1893,291 @@ ntest::init_result ntest::init(bool const remove_residual_files)
   return { num_files_removed, num_files_failed_to_remove };
 }
 
-// Returns the number of passed assertions since the last time `ntest::generate_report` was called.
+// Returns the number of passed assertions since the last time `ntest::generate_report` was called,
+// or within a test case, since it started.
 size_t ntest::pass_count()
 {
-  return s_passed_assertions.size();
+  return t_recording->num_passed;
 }
 
-// Returns the number of failed assertions since the last time `ntest::generate_report` was called.
+// Returns the number of failed assertions since the last time `ntest::generate_report` was called,
+// or within a test case, since it started.
 size_t ntest::fail_count()
 {
-  return s_failed_assertions.size();
-}
\ No newline at end of file
+  return t_recording->failed.size();
+}
+
+void ntest::test(
+  char const* const name,
+  std::function<void ()> fn,
+  source_location const loc)
+{
+  // names become directory names
+  string dir_name = name;
+  for (char& ch : dir_name)
+    if (!std::isalnum(static_cast<unsigned char>(ch)) && ch != '-')
+      ch = '_';
+
+  fs::path scratch_dir = fs::path(s_scratch_root) / dir_name;
+  for (auto const& existing : s_cases)
+  {
+    if (existing.scratch_dir == scratch_dir)
+    {
+      stringstream err{};
+      err << "test case name \"" << name << "\" is already taken";
+      throw runtime_error(err.str());
+    }
+  }
+
+  s_cases.push_back({ name, std::move(fn), loc, std::move(scratch_dir), {} });
+}
+
+static
+void run_test_case(test_case& tc)
+{
+  t_recording = &tc.recorded;
+  t_case = &tc;
+
+  auto const fail = [&tc](char const* const what)
+  {
+    stringstream serialized_vals{};
+    serialized_vals << "test case | " << tc.name << " to finish | threw " << what;
+    ntest::internal::register_failed_assertion(std::move(serialized_vals), tc.loc);
+  };
+
+  try
+  {
+    fs::remove_all(tc.scratch_dir);
+    fs::create_directories(tc.scratch_dir);
+    tc.fn();
+  }
+  catch (std::exception const& except)
+  {
+    fail(except.what());
+  }
+  catch (...)
+  {
+    fail("an unknown exception");
+  }
+
+  if (tc.recorded.failed.empty())
+  {
+    // kept otherwise, to look at what went wrong
+    std::error_code ec{};
+    fs::remove_all(tc.scratch_dir, ec);
+  }
+
+  flush_streams(tc.recorded, &tc);
+
+  t_recording = &s_recorded;
+  t_case = nullptr;
+}
+
+ntest::run_result ntest::run_tests(size_t num_threads)
+{
+  vector<test_case> cases = std::move(s_cases);
+  s_cases.clear();
+
+  if (num_threads == 0)
+    num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+  num_threads = std::min(num_threads, cases.size());
+
+  // so the streams have what came before the cases first
+  flush_streams(s_recorded, nullptr);
+
+  std::atomic<size_t> next_case = 0;
+  auto const run_cases = [&cases, &next_case]()
+  {
+    for (size_t i; (i = next_case.fetch_add(1, std::memory_order_relaxed)) < cases.size();)
+      run_test_case(cases[i]);
+  };
+
+  {
+    vector<std::jthread> threads{};
+    for (size_t i = 1; i < num_threads; ++i)
+      threads.emplace_back(run_cases);
+    run_cases();
+  }
+
+  // merged in registration order so reports don't depend on scheduling
+  run_result result{ cases.size(), 0 };
+  for (auto& tc : cases)
+  {
+    auto& rec = tc.recorded;
+
+    if (!rec.failed.empty())
+      ++result.num_cases_failed;
+
+    s_recorded.failed.insert(s_recorded.failed.end(), rec.failed.begin(), rec.failed.end());
+    s_recorded.passed.insert(s_recorded.passed.end(), rec.passed.begin(), rec.passed.end());
+    s_recorded.num_passed += rec.num_passed;
+    for (auto& block : rec.preview_blocks)
+      s_recorded.preview_blocks.push_back(std::move(block));
+    s_recorded.benches.insert(s_recorded.benches.end(), rec.benches.begin(), rec.benches.end());
+  }
+  // the last block is some case's, don't add to it
+  s_recorded.preview_block_used = s_preview_block_size;
+
+  {
+    // only goes if every case's directory did
+    std::error_code ec{};
+    fs::remove(s_scratch_root, ec);
+  }
+
+  return result;
+}
+
+void ntest::stream_report(char const* const pathname, stream_format const format)
+{
+  std::ofstream file(pathname, std::ios::out | std::ios::trunc);
+  if (!file.is_open())
+  {
+    stringstream err{};
+    err << "failed to open file \"" << pathname << '"';
+    throw runtime_error(err.str());
+  }
+
+  // what came before goes to the markdown report only
+  flush_streams(s_recorded, nullptr);
+
+  string name = fs::path(pathname).stem().string();
+  if (format == stream_format::junit_xml)
+  {
+    string header = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<testsuites name=\"";
+    escape_xml(name, header);
+    file << header << "\">\n";
+  }
+
+  s_streams.push_back({ format, std::move(file), std::move(name) });
+}
+
+fs::path const& ntest::scratch_dir()
+{
+  if (t_case == nullptr)
+    throw runtime_error("ntest::scratch_dir called outside of a test case");
+  return t_case->scratch_dir;
+}
+ntest::bench_opts ntest::default_bench_opts()
+{
+  return { 1, 10, 0.5, 1000, 0, 0, {}, 0.1 };
+}
+
+// Best effort, a file which can't be dropped just stays cached.
+static
+void drop_from_file_cache(fs::path const& path)
+{
+#ifdef _WIN32
+  // opening a handle without buffering makes the cache manager flush and purge the file
+  HANDLE const file = CreateFileW(path.c_str(), GENERIC_READ,
+    FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+    OPEN_EXISTING, FILE_FLAG_NO_BUFFERING, nullptr);
+  if (file != INVALID_HANDLE_VALUE)
+    CloseHandle(file);
+#elif defined(POSIX_FADV_DONTNEED)
+  int const fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd >= 0)
+  {
+    // dirty pages aren't dropped, so write them first
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+  }
+#else
+  (void)path;
+#endif
+}
+
+ntest::bench_result ntest::bench(
+  char const* const name,
+  std::function<void ()> const& fn,
+  bench_opts const& options,
+  source_location const loc)
+{
+  using clock = std::chrono::steady_clock;
+
+  if (std::strpbrk(name, ",\n") != nullptr)
+    throw runtime_error("benchmark names can't have commas or newlines");
+
+  for (size_t i = 0; i < options.warmup_iters; ++i)
+    fn();
+
+  bool const cold = !options.cold_files.empty();
+
+  // enough calls per sample for the clock's resolution not to matter
+  size_t batch_size = 1;
+  if (!cold)
+  {
+    auto const start = clock::now();
+    fn();
+    double const call_ns = std::chrono::duration<double, std::nano>(clock::now() - start).count();
+    double constexpr min_sample_ns = 100'000;
+    if (call_ns < min_sample_ns)
+      batch_size = static_cast<size_t>(min_sample_ns / std::max(call_ns, 1.0)) + 1;
+  }
+
+  vector<double> samples{};
+  double total_seconds = 0;
+
+  while (samples.size() < options.max_samples &&
+    (samples.size() < options.min_samples || total_seconds < options.min_seconds))
+  {
+    for (auto const& path : options.cold_files)
+      drop_from_file_cache(path);
+
+    auto const start = clock::now();
+    for (size_t i = 0; i < batch_size; ++i)
+      fn();
+    std::chrono::duration<double> const elapsed = clock::now() - start;
+
+    total_seconds += elapsed.count();
+    samples.push_back(elapsed.count() * 1e9 / static_cast<double>(batch_size));
+  }
+
+  std::sort(samples.begin(), samples.end());
+
+  bench_result res{};
+  res.name = name;
+  res.num_iters = samples.size() * batch_size;
+  if (!samples.empty())
+  {
+    res.min_ns = samples.front();
+    res.median_ns = samples[samples.size() / 2];
+    res.p99_ns = samples[(samples.size() * 99 + 99) / 100 - 1];
+  }
+  if (res.median_ns > 0)
+  {
+    res.bytes_per_sec = static_cast<double>(options.bytes_per_iter) * 1e9 / res.median_ns;
+    res.items_per_sec = static_cast<double>(options.items_per_iter) * 1e9 / res.median_ns;
+  }
+
+  t_recording->benches.push_back(res);
+
+  if (auto const baseline = s_bench_baseline.find(name); baseline != s_bench_baseline.end())
+  {
+    double const limit_ns = baseline->second * (1 + options.tolerance);
+    static uint32_t const type = internal::intern_type_name("benchmark");
+
+    stringstream serialized_vals{};
+    serialized_vals
+      << std::fixed << std::setprecision(1)
+      << name << " median <= " << limit_ns << " ns (baseline "
+      << baseline->second << " ns + " << options.tolerance * 100 << "%)";
+
+    if (res.median_ns <= limit_ns)
+    {
+      string const expected = serialized_vals.str();
+      internal::register_passed_assertion({
+        loc, internal::store_preview(expected.data(), expected.size()), 0,
+        static_cast<uint32_t>(expected.size()), type, internal::preview_kind::verbatim });
+    }
+    else
+    {
+      string const expected = serialized_vals.str();
+      serialized_vals.str({});
+      serialized_vals << "benchmark | " << expected << " | " << res.median_ns << " ns";
+      internal::register_failed_assertion(std::move(serialized_vals), loc);
+    }
+  }
+
+  return res;
+}
@@ -1,14 +1,19 @@
 #ifndef NLUKA_NTEST_HPP
 #define NLUKA_NTEST_HPP
 
+#include <algorithm>
 #include <array>
 #include <concepts>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
 #include <functional>
 #include <source_location>
 #include <sstream>
 #include <string>
 #include <type_traits>
+#include <vector>
 
 namespace ntest {
 
@@ -18,6 +23,14 @@ namespace config {
 
   void set_max_arr_preview_len(size_t);
 
+  // Loads the medians benchmarks are compared against, from a results file
+  // written by generate_report. A missing file means no comparisons.
+  void set_bench_baseline(char const *pathname);
+
+  // Makes assert_binary_file_digest (re)write its digests from the actual files
+  // instead of checking them.
+  void set_update_digests(bool);
+
 } // namespace config
 
 namespace concepts {
@@ -45,6 +58,9 @@ namespace internal {
 
   char const *preview_style();
 
+  // preview_style, but standing out, for the element where arrays differ
+  char const *mismatch_style();
+
   size_t max_str_preview_len();
 
   size_t max_arr_preview_len();
@@ -55,16 +71,55 @@ namespace internal {
 
   struct assertion
   {
-    // for passed assertions: "type | expected"
-    // for failed assertions: "type | expected | actual"
+    // "type | expected | actual"
     std::string serialized_vals;
     std::source_location loc;
   };
 
-  void register_passed_assertion(std::stringstream &&, std::source_location const &);
-
   void register_failed_assertion(std::stringstream &&, std::source_location const &);
 
+  // How generate_report renders a passed assertion's expected value.
+  enum class preview_kind : uint8_t
+  {
+    // `preview` is the text to show, e.g. "to be thrown"
+    verbatim,
+    // `value` holds the value
+    boolean,
+    signed_integral,
+    unsigned_integral,
+    // `preview` holds the first chars, `value` the full length
+    str,
+    // `preview` holds the first elements, each followed by '\0', `value` the full size
+    arr,
+    // `preview` is a pathname to link to
+    file_link,
+  };
+
+  // A passed assertion, which is only rendered to markdown by generate_report
+  // because most never get looked at.
+  struct passed_assertion
+  {
+    std::source_location loc;
+    // in the preview arena, or static
+    char const *preview;
+    uint64_t value;
+    uint32_t preview_len;
+    // from intern_type_name
+    uint32_t type;
+    preview_kind kind;
+  };
+
+  void register_passed_assertion(passed_assertion const &);
+
+  // Stores an already beautified type name and returns its tag. Callers keep the
+  // tag in a static, so each type's name is worked out once.
+  uint32_t intern_type_name(std::string name);
+
+  std::string const &type_name(uint32_t type);
+
+  // Copies a preview into an arena which lives until the next generate_report.
+  char const *store_preview(char const *data, size_t len);
+
   template <typename Ty>
   requires std::integral<Ty>
   auto normalize_integral_type(auto const val)
@@ -75,33 +130,43 @@ namespace internal {
       return static_cast<intmax_t>(val);
   }
 
+  // Element types whose values are equal exactly when their bytes are,
+  // unlike floating point (-0.0 and NaN) or classes with their own operator!=.
   template <typename Ty>
-  requires concepts::printable<Ty>
-  void write_arr_to_file(
-    std::string const &pathname,
-    Ty const *const arr,
-    size_t const size)
+  concept bytewise_comparable =
+    std::is_integral_v<Ty> || std::is_enum_v<Ty> || std::is_pointer_v<Ty>;
+
+  // Returns the index of the first element where the arrays differ, running out of
+  // elements counting as a difference, or SIZE_MAX if they're equal.
+  template <typename Ty>
+  requires concepts::comparable_neq<Ty>
+  size_t arr_mismatch(
+    Ty const *const a1,
+    size_t const a1_size,
+    Ty const *const a2,
+    size_t const a2_size)
   {
-    std::fstream file(pathname, std::ios::out);
-    ntest::internal::throw_if_file_not_open(file, pathname.c_str());
+    size_t const common_size = std::min(a1_size, a2_size);
+    size_t i = 0;
 
-    for (size_t i = 0; i < size; ++i)
+    if constexpr (bytewise_comparable<Ty>)
     {
-      if constexpr (std::is_integral_v<Ty>)
+      // memcmp is vectorized, so it skips over the equal blocks, then the loop
+      // below finds the element within the differing one
+      size_t constexpr block_size = std::max<size_t>(4096 / sizeof(Ty), 1);
+      for (; i < common_size; i += block_size)
       {
-        // some integrals like uint8_t are treated strangely by ostream insertion,
-        // so casting must be done
-        if constexpr (std::is_unsigned_v<Ty>)
-          file << static_cast<uintmax_t>(arr[i]);
-        else
-          file << static_cast<intmax_t>(arr[i]);
+        size_t const len = std::min(block_size, common_size - i);
+        if (std::memcmp(a1 + i, a2 + i, len * sizeof(Ty)) != 0)
+          break;
       }
-      else
-      {
-        file << arr[i];
-      }
-      file << '\n';
     }
+
+    for (; i < common_size; ++i)
+      if (a1[i] != a2[i])
+        return i;
+
+    return a1_size == a2_size ? SIZE_MAX : common_size;
   }
 
   template <typename Ty>
@@ -112,21 +177,35 @@ namespace internal {
     Ty const *const a2,
     size_t const a2_size)
   {
-    if (a1_size != a2_size)
-      return false;
-
-    for (size_t i = 0; i < a1_size; ++i)
-      if (a1[i] != a2[i])
-        return false;
+    return a1_size == a2_size && arr_mismatch(a1, a1_size, a2, a2_size) == SIZE_MAX;
+  }
 
-    return true;
+  template <typename Ty>
+  requires concepts::printable<Ty>
+  void serialize_arr_elem(Ty const &elem, std::ostream &os)
+  {
+    if constexpr (std::is_integral_v<Ty>)
+    {
+      // some integrals like uint8_t are treated strangely by ostream insertion,
+      // so casting must be done
+      if constexpr (std::is_unsigned_v<Ty>)
+        os << static_cast<uintmax_t>(elem);
+      else
+        os << static_cast<intmax_t>(elem);
+    }
+    else
+    {
+      os << elem;
+    }
   }
 
+  // Serializes the elements around `index`, highlighting the one there.
   template <typename Ty>
   requires concepts::printable<Ty>
-  void serialize_arr_preview(
+  void serialize_arr_window(
     Ty const *const arr,
     size_t const size,
+    size_t const index,
     std::stringstream &ss)
   {
     ss << "sz=" << size;
@@ -134,33 +213,94 @@ namespace internal {
     if (size == 0)
       return;
 
+    size_t const window = std::min(size, std::max<size_t>(max_arr_preview_len(), 1));
+    size_t const begin = std::min(index - std::min(index, window / 2), size - window);
+    size_t const end = begin + window;
+
     ss << " __[__ ";
+    if (begin > 0)
+      ss << '*' << begin << " before ...* ";
+
+    for (size_t i = begin; i < end; ++i)
+    {
+      ss << "<span style='" << (i == index ? mismatch_style() : preview_style()) << "' title='index " << i << "'>";
+      serialize_arr_elem(arr[i], ss);
+      ss << "</span>, ";
+    }
+
+    if (end < size)
+      ss << " *... " << (size - end) << " more* ";
+    ss << "__]__";
+  }
+
+  // Registers a failed assertion of two arrays, showing both around where they differ.
+  template <typename Ty>
+  requires concepts::printable<Ty>
+  void register_failed_arr(
+    uint32_t const type,
+    Ty const *const expected,
+    size_t const expected_size,
+    Ty const *const actual,
+    size_t const actual_size,
+    size_t const mismatch,
+    std::source_location const &loc)
+  {
+    std::stringstream serialized_vals{};
+    serialized_vals << type_name(type) << " | ";
+    serialize_arr_window(expected, expected_size, mismatch, serialized_vals);
+    serialized_vals << " | ";
+    serialize_arr_window(actual, actual_size, mismatch, serialized_vals);
+
+    if (expected_size != actual_size)
+      serialized_vals << "<br>sizes differ, ";
+    else
+      serialized_vals << "<br>";
+    serialized_vals << "first mismatch at index " << mismatch;
+
+    register_failed_assertion(std::move(serialized_vals), loc);
+  }
+
+  // Registers a passed assertion of an array, storing a preview of its first elements.
+  template <typename Ty>
+  requires concepts::printable<Ty>
+  void register_passed_arr(
+    uint32_t const type,
+    Ty const *const arr,
+    size_t const size,
+    std::source_location const &loc)
+  {
+    size_t const preview_size = std::min(size, ntest::internal::max_arr_preview_len());
+    std::string preview{};
 
-    size_t const max_len = std::min(size, ntest::internal::max_arr_preview_len());
-    for (size_t i = 0; i < max_len; ++i)
+    if constexpr (std::is_integral_v<Ty>)
     {
-      ss << "<span style='" << internal::preview_style() << "' title='index " << i << "'>";
-      if constexpr (std::is_integral_v<Ty>)
+      for (size_t i = 0; i < preview_size; ++i)
       {
         // some integrals like uint8_t are treated strangely by ostream insertion,
-        // so casting must be done
+        // so they're widened
         if constexpr (std::is_unsigned_v<Ty>)
-          ss << static_cast<uintmax_t>(arr[i]);
+          preview += std::to_string(static_cast<uintmax_t>(arr[i]));
         else
-          ss << static_cast<intmax_t>(arr[i]);
+          preview += std::to_string(static_cast<intmax_t>(arr[i]));
+        preview += '\0';
       }
-      else
-      {
-        ss << arr[i];
-      }
-      ss << "</span>, ";
     }
-
-    if (size > max_len)
+    else if (preview_size > 0)
     {
-      ss << " *... " << (size - max_len) << " more* ";
+      std::stringstream ss{};
+      for (size_t i = 0; i < preview_size; ++i)
+        ss << arr[i] << '\0';
+      preview = ss.str();
     }
-    ss << "__]__";
+
+    register_passed_assertion({
+      loc,
+      store_preview(preview.data(), preview.size()),
+      size,
+      static_cast<uint32_t>(preview.size()),
+      type,
+      preview_kind::arr,
+    });
   }
 
   std::string beautify_typeid_name(char const *name);
@@ -275,33 +415,20 @@ void assert_arr(
     throw std::runtime_error(err.str());
   }
 
-  bool const passed = ntest::internal::arr_eq(
+  size_t const mismatch = ntest::internal::arr_mismatch(
     expected, expected_size, actual, actual_size);
 
-  std::stringstream serialized_vals{};
-  serialized_vals
-    << ntest::internal::beautify_typeid_name(typeid(Ty).name())
-    << " [] | ";
+  static uint32_t const type = ntest::internal::intern_type_name(
+    ntest::internal::beautify_typeid_name(typeid(Ty).name()) + " []");
 
-  if (passed)
+  if (mismatch == SIZE_MAX) // passed
   {
-    ntest::internal::serialize_arr_preview(expected, expected_size, serialized_vals);
-    ntest::internal::register_passed_assertion(std::move(serialized_vals), loc);
+    ntest::internal::register_passed_arr(type, expected, expected_size, loc);
   }
   else // failed
   {
-    std::string const
-      expected_pathname = internal::generate_file_pathname(loc, "expected"),
-      actual_pathname = internal::generate_file_pathname(loc, "actual");
-
-    ntest::internal::write_arr_to_file(expected_pathname, expected, expected_size);
-    ntest::internal::write_arr_to_file(actual_pathname, actual, actual_size);
-
-    serialized_vals
-      << '[' << expected_pathname << "](" << expected_pathname
-      << ") | [" << actual_pathname << "](" << actual_pathname << ')';
-
-    ntest::internal::register_failed_assertion(std::move(serialized_vals), loc);
+    ntest::internal::register_failed_arr(
+      type, expected, expected_size, actual, actual_size, mismatch, loc);
   }
 }
 
@@ -312,34 +439,20 @@ void assert_stdvec(
   std::vector<Ty> const &actual,
   std::source_location const loc = std::source_location::current())
 {
-  bool const passed = ntest::internal::arr_eq(
+  size_t const mismatch = ntest::internal::arr_mismatch(
     expected.data(), expected.size(), actual.data(), actual.size());
 
-  std::stringstream serialized_vals{};
-  serialized_vals
-    << "std::vector\\<"
-    << ntest::internal::beautify_typeid_name(typeid(Ty).name())
-    << "\\> | ";
+  static uint32_t const type = ntest::internal::intern_type_name(
+    "std::vector\\<" + ntest::internal::beautify_typeid_name(typeid(Ty).name()) + "\\>");
 
-  if (passed)
+  if (mismatch == SIZE_MAX) // passed
   {
-    ntest::internal::serialize_arr_preview(expected.data(), expected.size(), serialized_vals);
-    ntest::internal::register_passed_assertion(std::move(serialized_vals), loc);
+    ntest::internal::register_passed_arr(type, expected.data(), expected.size(), loc);
   }
   else // failed
   {
-    std::string const
-      expected_pathname = internal::generate_file_pathname(loc, "expected"),
-      actual_pathname = internal::generate_file_pathname(loc, "actual");
-
-    ntest::internal::write_arr_to_file(expected_pathname, expected.data(), expected.size());
-    ntest::internal::write_arr_to_file(actual_pathname, actual.data(), actual.size());
-
-    serialized_vals
-      << '[' << expected_pathname << "](" << expected_pathname
-      << ") | [" << actual_pathname << "](" << actual_pathname << ')';
-
-    ntest::internal::register_failed_assertion(std::move(serialized_vals), loc);
+    ntest::internal::register_failed_arr(
+      type, expected.data(), expected.size(), actual.data(), actual.size(), mismatch, loc);
   }
 }
 
@@ -350,34 +463,21 @@ void assert_stdarr(
   std::array<Ty, Size> const &actual,
   std::source_location const loc = std::source_location::current())
 {
-  bool const passed = ntest::internal::arr_eq(
+  size_t const mismatch = ntest::internal::arr_mismatch(
     expected.data(), expected.size(), actual.data(), actual.size());
 
-  std::stringstream serialized_vals{};
-  serialized_vals
-    << "std::array\\<"
-    << ntest::internal::beautify_typeid_name(typeid(Ty).name())
-    << ", " << Size << "\\> | ";
+  static uint32_t const type = ntest::internal::intern_type_name(
+    "std::array\\<" + ntest::internal::beautify_typeid_name(typeid(Ty).name())
+    + ", " + std::to_string(Size) + "\\>");
 
-  if (passed)
+  if (mismatch == SIZE_MAX) // passed
   {
-    ntest::internal::serialize_arr_preview(expected.data(), expected.size(), serialized_vals);
-    ntest::internal::register_passed_assertion(std::move(serialized_vals), loc);
+    ntest::internal::register_passed_arr(type, expected.data(), expected.size(), loc);
   }
   else // failed
   {
-    std::string const
-      expected_pathname = internal::generate_file_pathname(loc, "expected"),
-      actual_pathname = internal::generate_file_pathname(loc, "actual");
-
-    ntest::internal::write_arr_to_file(expected_pathname, expected.data(), expected.size());
-    ntest::internal::write_arr_to_file(actual_pathname, actual.data(), actual.size());
-
-    serialized_vals
-      << '[' << expected_pathname << "](" << expected_pathname
-      << ") | [" << actual_pathname << "](" << actual_pathname << ')';
-
-    ntest::internal::register_failed_assertion(std::move(serialized_vals), loc);
+    ntest::internal::register_failed_arr(
+      type, expected.data(), expected.size(), actual.data(), actual.size(), mismatch, loc);
   }
 }
 
@@ -427,6 +527,37 @@ void assert_binary_file(
   std::source_location loc = std::source_location::current()
 );
 
+// Writes a digest of a file for assert_binary_file_digest. The file is hashed in
+// chunks of `chunk_size` bytes, spread over all hardware threads. Smaller chunks
+// narrow a mismatch down further, but make bigger digests.
+void write_binary_file_digest(
+  std::filesystem::path const &digest_pathname,
+  std::filesystem::path const &pathname,
+  uint64_t chunk_size = 16 * 1024 * 1024);
+
+/*
+  Checks a file against a digest written by `write_binary_file_digest`, for expected
+  outputs too big to keep around. On a mismatch, reports which chunks differ.
+  Throws std::runtime_error if the digest is malformed.
+*/
+void assert_binary_file_digest(
+  char const *expected_digest_pathname,
+  char const *actual_pathname,
+  std::source_location loc = std::source_location::current()
+);
+
+void assert_binary_file_digest(
+  std::string const &expected_digest_pathname,
+  std::string const &actual_pathname,
+  std::source_location loc = std::source_location::current()
+);
+
+void assert_binary_file_digest(
+  std::filesystem::path const &expected_digest,
+  std::filesystem::path const &actual,
+  std::source_location loc = std::source_location::current()
+);
+
 /*
   Asserts that a certain type of exception if thrown by `code_snippet`.
   If the correct exception type is thrown, returns the .what() string of the thrown exception.
@@ -457,13 +588,17 @@ requires concepts::derives_from_std_exception<ExceptTy>
     threw_incorrect_except = true;
   }
 
+  static uint32_t const type = ntest::internal::intern_type_name(
+    ntest::internal::beautify_typeid_name(typeid(ExceptTy).name()));
+
   std::stringstream serialized_vals{};
-  serialized_vals << ntest::internal::beautify_typeid_name(typeid(ExceptTy).name()) << " | ";
+  serialized_vals << ntest::internal::type_name(type) << " | ";
 
   if (threw_correct_except) // passed
   {
-    serialized_vals << "to be thrown";
-    ntest::internal::register_passed_assertion(std::move(serialized_vals), loc);
+    static char const expected_text[] = "to be thrown";
+    ntest::internal::register_passed_assertion({
+      loc, expected_text, 0, sizeof(expected_text) - 1, type, ntest::internal::preview_kind::verbatim });
   }
   else if (threw_incorrect_except) // failed
   {
@@ -495,10 +630,99 @@ struct report_result
 
 report_result generate_report(char const *name);
 
+enum class stream_format
+{
+  // one JSON object per assertion and line
+  json_lines,
+  // a <testsuite> per test case, a <testcase> per assertion
+  junit_xml,
+};
+
+/*
+  Streams every assertion from now on to `pathname`, as plain text rather than
+  markdown. Assertions outside of test cases are written in batches, those of a
+  test case when it finishes, so cases appear in the order they finish. Passed
+  assertions then aren't kept for the markdown report, which only lists the
+  failed ones, so memory doesn't grow with the number of passes.
+  generate_report finishes and closes the streams.
+  Must not be called while run_tests is running.
+  Throws std::runtime_error if the file cannot be opened.
+*/
+void stream_report(char const *pathname, stream_format format);
+
 size_t pass_count();
 
 size_t fail_count();
 
+// Registers a test case for run_tests. Cases may run at the same time on different
+// threads, so they mustn't share state or files; files a case writes belong in
+// its scratch_dir. Names must be unique.
+void test(
+  char const *name,
+  std::function<void ()> fn,
+  std::source_location loc = std::source_location::current());
+
+struct run_result
+{
+  size_t num_cases;
+  size_t num_cases_failed;
+};
+
+// Runs and then forgets the registered test cases, on `num_threads` threads or
+// one per hardware thread if 0. Each case gets an empty scratch_dir, removed
+// again if the case passes. Assertions are reported in the order their cases
+// were registered, whichever thread ran them. An exception escaping a case
+// fails it.
+run_result run_tests(size_t num_threads = 0);
+
+// The running test case's scratch directory, "ntest_scratch/<name>".
+// Throws std::runtime_error if called outside of a test case.
+std::filesystem::path const &scratch_dir();
+
+struct bench_opts
+{
+  // calls made before measuring, to warm caches up
+  size_t warmup_iters;
+  // samples are taken until both of these are reached, or max_samples is
+  size_t min_samples;
+  double min_seconds;
+  size_t max_samples;
+  // the work one call does, for throughputs, 0 if not applicable
+  uint64_t bytes_per_iter;
+  uint64_t items_per_iter;
+  // dropped from the OS file cache before each sample, which is then a single call.
+  // Only file contents are dropped, not directory entries or metadata.
+  std::vector<std::filesystem::path> cold_files;
+  // how much slower than the baseline the median may get, 0.1 being 10%
+  double tolerance;
+};
+
+bench_opts default_bench_opts();
+
+struct bench_result
+{
+  std::string name;
+  size_t num_iters;
+  // nanoseconds per call
+  double min_ns;
+  double median_ns;
+  double p99_ns;
+  // per second, based on the median, 0 if the opts gave no work per call
+  double bytes_per_sec;
+  double items_per_sec;
+};
+
+// Times `fn`. Calls too quick for the clock are batched, each sample being
+// the mean call time of its batch. The result is written by generate_report
+// to "<name>.bench.csv". If the baseline has a median for this benchmark, a
+// median more than `tolerance` slower is a failed assertion.
+// Benchmarks in concurrently running test cases skew each other.
+bench_result bench(
+  char const *name,
+  std::function<void ()> const &fn,
+  bench_opts const &options = default_bench_opts(),
+  std::source_location loc = std::source_location::current());
+
 } // namespace ntest
 
 #endif // NLUKA_NTEST_HPP
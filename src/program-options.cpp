@@ -0,0 +1,312 @@
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <system_error>
+
+#include "program-options.hpp"
+
+using opts::arg;
+using opts::option;
+
+namespace {
+
+  [[noreturn]] void throw_error(std::string_view const before, std::string_view const what, std::string_view const after) {
+    std::string msg{};
+    msg.reserve(before.size() + what.size() + after.size());
+    msg.append(before).append(what).append(after);
+    throw opts::error(msg);
+  }
+
+  [[noreturn]] void throw_option_error(std::string_view const before, option const &opt, std::string_view const after) {
+    std::string name("--");
+    name.append(opt.name);
+    throw_error(before, name, after);
+  }
+
+  bool parse_unsigned(std::string_view value, std::uint64_t &result) {
+    // as boost::lexical_cast did, a minus wraps around so "-1" is the maximum
+    bool const negative = !value.empty() && value.front() == '-';
+    if (!value.empty() && (value.front() == '-' || value.front() == '+'))
+      value.remove_prefix(1);
+    if (value.empty() || value.front() < '0' || value.front() > '9')
+      return false;
+
+    auto const [end, ec] = std::from_chars(value.data(), value.data() + value.size(), result);
+    if (ec != std::errc{} || end != value.data() + value.size())
+      return false;
+    if (negative)
+      result = 0 - result;
+    return true;
+  }
+
+  bool parse_floating(std::string_view value, double &result) {
+    if (value.size() > 1 && value.front() == '+' && value[1] != '-')
+      value.remove_prefix(1);
+    if (value.empty())
+      return false;
+
+    auto const [end, ec] = std::from_chars(value.data(), value.data() + value.size(), result);
+    return ec == std::errc{} && end == value.data() + value.size();
+  }
+
+  std::size_t find_short(std::span<option const> const options, char const short_name) {
+    for (std::size_t i = 0; i < options.size(); ++i) {
+      if (options[i].short_name == short_name)
+        return i;
+    }
+    return SIZE_MAX;
+  }
+
+  // Index of the option `name` is, or the only one it's a prefix of.
+  std::size_t find_long(std::span<option const> const options, std::string_view const name, std::string_view const token) {
+    std::size_t found = SIZE_MAX;
+    std::size_t num_found = 0;
+    for (std::size_t i = 0; i < options.size(); ++i) {
+      if (options[i].name == name)
+        return i;
+      if (options[i].name.starts_with(name)) {
+        found = i;
+        ++num_found;
+      }
+    }
+
+    if (name.empty() || name.front() == '-' || num_found == 0) {
+      throw_error("unrecognised option '", token, "'");
+    }
+    if (num_found > 1) {
+      // listed alphabetically, as boost did
+      std::array<std::string_view, opts::max_options> matches{};
+      std::size_t num_matches = 0;
+      for (auto const &opt : options) {
+        if (opt.name.starts_with(name))
+          matches[num_matches++] = opt.name;
+      }
+      std::sort(matches.begin(), matches.begin() + num_matches);
+
+      std::string msg("option '--");
+      msg.append(name).append("' is ambiguous and matches ");
+      for (std::size_t i = 0; i < num_matches; ++i) {
+        msg.append(i == 0 ? "" : i + 1 == num_matches ? ", and " : ", ");
+        msg.append("'--").append(matches[i]).append("'");
+      }
+      throw opts::error(msg);
+    }
+    return found;
+  }
+
+  // Whether `token`, following an option which needs a value, is that value.
+  bool is_value(std::span<option const> const options, option const &opt, std::string_view const token) {
+    if (!opt.implicit_value.empty()) {
+      return token.empty() || token.front() != '-';
+    }
+    // anything but a short option, so "-1" and even "--top" are values
+    return !(token.size() == 2 && token.front() == '-' && find_short(options, token[1]) != SIZE_MAX);
+  }
+
+  // Calls `on_option(index, value)` for each option on the command line, in order,
+  // `value` being empty for flags. Throws opts::error if it can't be tokenized.
+  template <typename Fn>
+  void scan(std::span<option const> const options, int const argc, char const *const *const argv, Fn &&on_option) {
+    for (int i = 1; i < argc; ++i) {
+      std::string_view const token = argv[i];
+
+      if (token == "--") {
+        // the rest aren't options
+        return;
+      }
+
+      auto const take_value = [&](option const &opt) -> std::string_view {
+        if (i + 1 < argc && is_value(options, opt, argv[i + 1])) {
+          return argv[++i];
+        }
+        if (opt.implicit_value.empty()) {
+          throw_option_error("the required argument for option '", opt, "' is missing");
+        }
+        return opt.implicit_value;
+      };
+
+      if (token.starts_with("--")) {
+        std::string_view name = token.substr(2);
+        std::size_t const equals = name.find('=');
+        bool const adjacent = equals != std::string_view::npos;
+        std::string_view const value = adjacent ? name.substr(equals + 1) : std::string_view{};
+        if (adjacent)
+          name = name.substr(0, equals);
+
+        std::size_t const idx = find_long(options, name, token);
+        option const &opt = options[idx];
+
+        if (adjacent && value.empty()) {
+          throw_option_error("the argument for option '", opt, "' should follow immediately after the equal sign");
+        }
+        if (opt.kind == arg::none) {
+          if (adjacent)
+            throw_option_error("option '", opt, "' does not take any arguments");
+          on_option(idx, std::string_view{});
+        } else {
+          on_option(idx, adjacent ? value : take_value(opt));
+        }
+      } else if (token.size() > 1 && token.front() == '-') {
+        // grouped short options, the first taking a value takes the rest of the token
+        for (std::size_t pos = 1; pos < token.size(); ++pos) {
+          std::size_t const idx = find_short(options, token[pos]);
+          if (idx == SIZE_MAX) {
+            throw_error("unrecognised option '", token, "'");
+          }
+          option const &opt = options[idx];
+
+          if (opt.kind == arg::none) {
+            on_option(idx, std::string_view{});
+          } else {
+            std::string_view const sticky = token.substr(pos + 1);
+            on_option(idx, sticky.empty() ? take_value(opt) : sticky);
+            break;
+          }
+        }
+      }
+    }
+  }
+
+} // namespace
+
+std::uint64_t opts::to_unsigned(std::string_view const value) {
+  std::uint64_t result = 0;
+  parse_unsigned(value, result);
+  return result;
+}
+
+double opts::to_floating(std::string_view const value) {
+  double result = 0;
+  parse_floating(value, result);
+  return result;
+}
+
+opts::parsed opts::parse(table const &tbl, int const argc, char const *const *const argv) {
+  parsed result{};
+  result.m_options = tbl.options;
+  result.m_argc = argc;
+  result.m_argv = argv;
+
+  // every syntax error is reported before any bad value, as boost did
+  scan(tbl.options, argc, argv, [](std::size_t, std::string_view) {});
+
+  scan(tbl.options, argc, argv, [&](std::size_t const idx, std::string_view const value) {
+    option const &opt = tbl.options[idx];
+    if (result.m_counts[idx] > 0 && opt.kind != arg::string_list) {
+      throw_option_error("option '", opt, "' cannot be specified more than once");
+    }
+
+    std::uint64_t unsigned_value = 0;
+    double floating_value = 0;
+    bool const valid =
+      (opt.kind != arg::unsigned_int || parse_unsigned(value, unsigned_value)) &&
+      (opt.kind != arg::floating || parse_floating(value, floating_value));
+    if (!valid) {
+      std::string msg("the argument ('");
+      msg.append(value).append("') for option '--").append(opt.name).append("' is invalid");
+      throw opts::error(msg);
+    }
+
+    if (result.m_counts[idx]++ == 0)
+      result.m_values[idx] = value;
+  });
+
+  return result;
+}
+
+std::size_t opts::parsed::index_of(std::string_view const name) const {
+  for (std::size_t i = 0; i < m_options.size(); ++i) {
+    if (m_options[i].name == name)
+      return i;
+  }
+  throw std::logic_error("no option named '" + std::string(name) + "'");
+}
+
+std::size_t opts::parsed::count(std::string_view const name) const {
+  return m_counts[index_of(name)];
+}
+
+std::string_view opts::parsed::value_of(std::string_view const name, arg const kind) const {
+  std::size_t const idx = index_of(name);
+  if (m_options[idx].kind != kind) {
+    throw std::logic_error("option '" + std::string(name) + "' is of another kind");
+  }
+  if (m_counts[idx] == 0) {
+    throw std::logic_error("option '" + std::string(name) + "' wasn't given");
+  }
+  return m_values[idx];
+}
+
+std::vector<std::string> opts::parsed::values_of(std::string_view const name) const {
+  std::size_t const idx = index_of(name);
+  if (m_options[idx].kind != arg::string_list) {
+    throw std::logic_error("option '" + std::string(name) + "' is of another kind");
+  }
+
+  std::vector<std::string> values{};
+  values.reserve(m_counts[idx]);
+  // parse accepted the command line, so this can't throw
+  scan(m_options, m_argc, m_argv, [&](std::size_t const found, std::string_view const value) {
+    if (found == idx)
+      values.emplace_back(value);
+  });
+  return values;
+}
+
+std::string opts::help_msg(table const &tbl) {
+  // boost::program_options::options_description::print(out, 6) on 80 columns
+  std::size_t constexpr indent = 6;
+  std::size_t constexpr line_length = 80 - 1 - indent;
+
+  std::string out(tbl.caption);
+  out += ":\n";
+
+  for (auto const &opt : tbl.options) {
+    std::size_t const line_begin = out.size();
+    out += "  ";
+    if (opt.short_name != '\0') {
+      out.append({ '-', opt.short_name }).append(" [ --").append(opt.name).append(" ]");
+    } else {
+      out.append("--").append(opt.name);
+    }
+    out += ' ';
+    if (!opt.implicit_value.empty()) {
+      out.append("[=arg(=").append(opt.implicit_value).append(")]");
+    } else if (opt.kind != arg::none) {
+      out += "arg";
+    }
+
+    if (!opt.description.empty()) {
+      if (out.size() - line_begin >= indent) {
+        out += '\n';
+        out.append(indent, ' ');
+      } else {
+        out.append(indent - (out.size() - line_begin), ' ');
+      }
+
+      // lines break after the last space in their second half, if there is one,
+      // otherwise mid word
+      std::string_view desc = opt.description;
+      for (bool first_line = true; !desc.empty(); first_line = false) {
+        if (!first_line) {
+          out += '\n';
+          out.append(indent, ' ');
+          if (desc.size() > 1 && desc[0] == ' ' && desc[1] != ' ')
+            desc.remove_prefix(1);
+        }
+
+        std::size_t len = std::min(desc.size(), line_length);
+        if (len < desc.size() && desc[len - 1] != ' ' && desc[len] != ' ') {
+          std::size_t const last_space = desc.substr(0, len).rfind(' ');
+          if (last_space != std::string_view::npos && len - (last_space + 1) < line_length / 2)
+            len = last_space + 1;
+        }
+        out.append(desc.substr(0, len));
+        desc.remove_prefix(len);
+      }
+    }
+    out += '\n';
+  }
+
+  return out;
+}
@@ -0,0 +1,129 @@
+#ifndef PROGRAM_OPTIONS_HPP
+#define PROGRAM_OPTIONS_HPP
+
+#include <array>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+// Command line options of the actions. Each action describes its options in a
+// constexpr table, parsing only records views of argv against it so nothing is
+// allocated unless a value is converted to a string, and the help text is
+// generated from the same table. Accepts what boost::program_options did, and
+// reports errors with the same messages:
+//   --name value, --name=value, unique prefixes of --name, -x value, -xvalue,
+//   grouped flags like -rl, and "--" to end the options.
+// Arguments which aren't options are ignored, like the action's name.
+namespace opts {
+
+// What an option takes after it.
+enum class arg : std::uint8_t {
+  // nothing, a flag
+  none,
+  string,
+  // a string, may be given several times
+  string_list,
+  unsigned_int,
+  floating,
+};
+
+struct option {
+  std::string_view name;
+  char short_name;
+  arg kind;
+  std::string_view description;
+  // value when given without one, e.g. "--histogram" alone, if not empty
+  std::string_view implicit_value = {};
+};
+
+inline constexpr std::size_t max_options = 32;
+
+struct table {
+  // Checks the options at compile time, a name or short name used twice doesn't compile.
+  template <std::size_t Num>
+  consteval table(std::string_view const caption_, option const (&options_)[Num])
+    : caption(caption_), options(options_)
+  {
+    static_assert(Num <= max_options);
+    for (std::size_t i = 0; i < Num; ++i) {
+      for (std::size_t j = i + 1; j < Num; ++j) {
+        if (options_[i].name == options_[j].name || options_[i].short_name == options_[j].short_name)
+          throw "option given twice";
+      }
+      if (!options_[i].implicit_value.empty() && options_[i].kind != arg::string)
+        throw "only string options have implicit values";
+    }
+  }
+
+  std::string_view caption;
+  std::span<option const> options;
+};
+
+// Bad command line, what() is what to show the user.
+class error : public std::runtime_error {
+public:
+  using std::runtime_error::runtime_error;
+};
+
+// Options found on a command line, views of argv which must outlive it.
+class parsed {
+public:
+  // Number of times `name` was given, 0 if it wasn't.
+  [[nodiscard]] std::size_t count(std::string_view name) const;
+
+  // Value of `name`, which must have been given. Throws std::logic_error if
+  // `Ty` doesn't fit the option's kind.
+  template <typename Ty>
+  [[nodiscard]] Ty as(std::string_view name) const;
+
+private:
+  friend parsed parse(table const &tbl, int argc, char const *const *argv);
+
+  [[nodiscard]] std::size_t index_of(std::string_view name) const;
+  [[nodiscard]] std::string_view value_of(std::string_view name, arg kind) const;
+  [[nodiscard]] std::vector<std::string> values_of(std::string_view name) const;
+
+  std::span<option const> m_options{};
+  int m_argc = 0;
+  char const *const *m_argv = nullptr;
+  // per option of m_options, in the same order; the first value given
+  std::array<std::string_view, max_options> m_values{};
+  std::array<std::uint32_t, max_options> m_counts{};
+};
+
+// Parses argv[1..argc) against `tbl`. Throws opts::error if it doesn't fit.
+[[nodiscard]] parsed parse(table const &tbl, int argc, char const *const *argv);
+
+// The help text, in the format boost::program_options printed it:
+//   CAPTION:
+//     -x [ --name ] arg
+//         Description, wrapped to 80 columns
+[[nodiscard]] std::string help_msg(table const &tbl);
+
+// Conversions of values validated by parse, so these don't fail.
+[[nodiscard]] std::uint64_t to_unsigned(std::string_view value);
+[[nodiscard]] double to_floating(std::string_view value);
+
+template <typename Ty>
+Ty parsed::as(std::string_view const name) const {
+  if constexpr (std::is_same_v<Ty, std::string>) {
+    return std::string(value_of(name, arg::string));
+  } else if constexpr (std::is_same_v<Ty, std::vector<std::string>>) {
+    return values_of(name);
+  } else if constexpr (std::floating_point<Ty>) {
+    return static_cast<Ty>(to_floating(value_of(name, arg::floating)));
+  } else {
+    static_assert(std::unsigned_integral<Ty>, "options are strings, unsigned integers or floating point");
+    return static_cast<Ty>(to_unsigned(value_of(name, arg::unsigned_int)));
+  }
+}
+
+} // namespace opts
+
+#endif // PROGRAM_OPTIONS_HPP
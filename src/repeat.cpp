@@ -2,46 +2,39 @@
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <stdexcept>
+#include <stop_token>
 #include <string>
 #include <vector>
 
-#include <boost/program_options.hpp>
-
 #include "util.hpp"
 #include "action.hpp"
+#include "fileutil.hpp"
+#include "thread_pool.hpp"
 
 namespace fs = std::filesystem;
-namespace bpo = boost::program_options;
-
-bpo::options_description action::repeat_options_desc() {
-  bpo::options_description desc("REPEAT OPTIONS");
-  desc.add_options()
-    ("inpath,i", bpo::value<std::string>(), "Path of file to repeat")
-    ("outpath,o", bpo::value<std::string>(), "Path of resultant file")
-    ("repeats,n", bpo::value<size_t>(), "Number of times to duplicate content, 1 = copy")
-    ;
-  return desc;
+
+static constexpr opts::option repeat_options[] {
+  { "inpath", 'i', opts::arg::string, "Path of file to repeat" },
+  { "outpath", 'o', opts::arg::string, "Path of resultant file" },
+  { "repeats", 'n', opts::arg::unsigned_int, "Number of times to duplicate content, 1 = copy" },
+};
+
+opts::table action::repeat_options_desc() {
+  return { "REPEAT OPTIONS", repeat_options };
 }
 
 std::string action::repeat_help_msg() {
-  std::stringstream out{};
-  repeat_options_desc().print(out, 6);
-  return out.str();
+  return opts::help_msg(repeat_options_desc());
 }
 
-struct repeat_config {
-  fs::path in_path;
-  fs::path out_path;
-  size_t num_repeats;
-};
-
 static
-repeat_config parse_config(bpo::variables_map const& var_map, std::vector<std::string>& errors) {
+fileutil::repeat_config parse_config(opts::parsed const &var_map, std::vector<std::string>& errors) {
   using util::get_required_option;
   using util::get_nonrequired_option;
   using util::get_flag_option;
 
-  repeat_config cfg{};
+  fileutil::repeat_config cfg{};
   {
     auto in_path = get_required_option<std::string>("inpath", "i", var_map, errors);
 
@@ -83,68 +76,106 @@ repeat_config parse_config(bpo::variables_map const& var_map, std::vector<std::s
   return cfg;
 }
 
-std::string action::repeat_perform(int const argc, char const* const* const argv) {
-  std::stringstream out{};
-
-  bpo::variables_map var_map;
-  try {
-    bpo::store(bpo::parse_command_line(argc, argv, action::repeat_options_desc()), var_map);
-  }
-  catch (std::exception const& err) {
-    out << err.what() << '\n';
-    return out.str();
-  }
-  bpo::notify(var_map);
-
-  std::vector<std::string> errors{};
-  repeat_config const cfg = parse_config(var_map, errors);
-  if (!errors.empty()) {
-    for (auto const& err : errors)
-      out << err << '\n';
-    return out.str();
+fileutil::repeat_result fileutil::repeat(repeat_config const &cfg, std::stop_token const stop) {
+  if (cfg.num_repeats == 0) {
+    throw std::invalid_argument("number of repeats must be > 0");
   }
 
   std::ifstream in_file(cfg.in_path, std::ios::binary);
   if (!in_file.is_open()) {
-    out << "fatal: failed to open file " << cfg.in_path << '\n';
-    return out.str();
+    throw std::runtime_error("failed to open file \"" + cfg.in_path.string() + "\"");
   }
 
   std::ofstream out_file(cfg.out_path, std::ios::binary);
   if (!out_file.is_open()) {
-    out << "fatal: failed to open file " << cfg.out_path << '\n';
-    return out.str();
+    throw std::runtime_error("failed to open file \"" + cfg.out_path.string() + "\"");
   }
 
   auto const in_file_size = static_cast<size_t>(fs::file_size(cfg.in_path));
-  size_t const buf_size = std::min(static_cast<size_t>(2 * 1024 * 1024), in_file_size);
-  std::vector<std::byte> buffer(buf_size);
+  size_t const block_size = std::min(static_cast<size_t>(2 * 1024 * 1024), in_file_size);
 
-  for (size_t i = 1; i <= cfg.num_repeats; ++i) {
-    size_t num_bytes_read_thus_far = 0;
-    in_file.seekg(std::ios::beg, 0);
-
-    while (num_bytes_read_thus_far < in_file_size)  {
-      size_t const num_bytes_remaining = in_file_size - num_bytes_read_thus_far;
+  repeat_result result{};
+  if (in_file_size == 0) {
+    return result;
+  }
 
-      size_t const num_bytes_to_process_this_iteration =
-        num_bytes_remaining >= buf_size
-        ? buf_size
-        : num_bytes_remaining;
+  // Two buffers, so the next block is read on the pool while this thread writes
+  // the one before it. A file which fits in one block is only read once.
+  std::vector<std::byte> buffers[2] { std::vector<std::byte>(block_size), std::vector<std::byte>() };
+  size_t const blocks_per_repeat = (in_file_size + block_size - 1) / block_size;
+  if (blocks_per_repeat > 1) {
+    buffers[1].resize(block_size);
+  }
 
-      in_file.read(
-        reinterpret_cast<char *>(buffer.data()),
-        num_bytes_to_process_this_iteration);
+  auto const block_len = [&](size_t const block) {
+    return std::min(block_size, in_file_size - (block % blocks_per_repeat) * block_size);
+  };
 
-      out_file.write(
-        reinterpret_cast<char const*>(buffer.data()),
-        num_bytes_to_process_this_iteration);
+  auto const read_block = [&](size_t const block) {
+    if (block % blocks_per_repeat == 0) {
+      in_file.seekg(0);
+    }
+    if (!in_file.read(reinterpret_cast<char *>(buffers[block % 2].data()), static_cast<std::streamsize>(block_len(block)))) {
+      throw std::runtime_error("failed to read file \"" + cfg.in_path.string() + "\"");
+    }
+  };
+
+  util::task_group reading{};
+  read_block(0);
+
+  size_t const num_blocks = blocks_per_repeat * cfg.num_repeats;
+  for (size_t block = 0; block < num_blocks; ++block) {
+    if (stop.stop_requested()) {
+      // half a result is of no use to anyone
+      out_file.close();
+      std::error_code ec{};
+      fs::remove(cfg.out_path, ec);
+      result.cancelled = true;
+      return result;
+    }
 
-      num_bytes_read_thus_far += num_bytes_to_process_this_iteration;
+    if (blocks_per_repeat > 1 && block + 1 < num_blocks) {
+      reading.run([&read_block, block]() { read_block(block + 1); });
     }
+
+    size_t const len = block_len(block);
+    out_file.write(reinterpret_cast<char const *>(buffers[blocks_per_repeat > 1 ? block % 2 : 0].data()),
+      static_cast<std::streamsize>(len));
+    result.num_bytes_written += len;
+
+    reading.wait();
+  }
+
+  return result;
+}
+
+bool action::repeat_perform(int const argc, char const* const* const argv, sink::base &out) {
+  opts::parsed var_map;
+  try {
+    var_map = opts::parse(action::repeat_options_desc(), argc, argv);
+  }
+  catch (std::exception const& err) {
+    out << err.what() << '\n';
+    return false;
   }
 
-  out << "Successfully repeated " << cfg.in_path << ' '
-    << cfg.num_repeats << " times as " << cfg.out_path << '\n';
-  return out.str();
+  std::vector<std::string> errors{};
+  fileutil::repeat_config const cfg = parse_config(var_map, errors);
+  if (!errors.empty()) {
+    for (auto const& err : errors)
+      out << err << '\n';
+    return false;
+  }
+
+  try {
+    fileutil::repeat(cfg);
+  } catch (std::exception const &except) {
+    out << "fatal: " << except.what() << '\n';
+    return false;
+  }
+
+  out << "Successfully repeated \"" << cfg.in_path.string() << "\" "
+    << cfg.num_repeats << " times as \"" << cfg.out_path.string() << "\"\n";
+
+  return true;
 }
@@ -0,0 +1,38 @@
+#include <ostream>
+
+#include "sink.hpp"
+#include "util.hpp"
+
+sink::base &sink::base::operator<<(double const value) {
+  char digits[32];
+  auto const result = std::to_chars(digits, digits + sizeof(digits), value, std::chars_format::general, 6);
+  return *this << std::string_view(digits, static_cast<size_t>(result.ptr - digits));
+}
+
+sink::stream::~stream() {
+  flush_buffer();
+}
+
+void sink::stream::consume(std::string_view const chunk) {
+  m_os.write(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+}
+
+void sink::stream::sync() {
+  m_os.flush();
+}
+
+sink::file::file(char const *const pathname)
+  : m_file(util::open_file(pathname, std::ios::out))
+{}
+
+sink::file::~file() {
+  flush_buffer();
+}
+
+void sink::file::consume(std::string_view const chunk) {
+  m_file.write(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+}
+
+void sink::file::sync() {
+  m_file.flush();
+}
@@ -0,0 +1,178 @@
+#ifndef SINK_HPP
+#define SINK_HPP
+
+#include <array>
+#include <charconv>
+#include <concepts>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iosfwd>
+#include <string>
+#include <string_view>
+
+// Destinations for an action's output. Actions write rows as they produce them,
+// formatting straight into the sink's fixed buffer, and the buffer is handed on
+// whenever it fills up or the action calls flush(). So output appears while
+// an action runs and its size doesn't bound memory use.
+namespace sink {
+
+class base {
+public:
+  base() = default;
+  virtual ~base() = default;
+
+  base(base const &) = delete;
+  base &operator=(base const &) = delete;
+
+  base &operator<<(std::string_view const text) {
+    if (text.size() > m_buf.size() - m_len) {
+      flush_buffer();
+      if (text.size() > m_buf.size()) {
+        // wouldn't fit anyway, skip the copy
+        consume(text);
+        return *this;
+      }
+    }
+    text.copy(m_buf.data() + m_len, text.size());
+    m_len += text.size();
+    return *this;
+  }
+
+  base &operator<<(char const *const text) {
+    return *this << std::string_view(text);
+  }
+
+  base &operator<<(std::string const &text) {
+    return *this << std::string_view(text);
+  }
+
+  base &operator<<(char const c) {
+    if (m_len == m_buf.size()) {
+      flush_buffer();
+    }
+    m_buf[m_len++] = c;
+    return *this;
+  }
+
+  template <std::integral Ty>
+  requires (!std::same_as<Ty, char> && !std::same_as<Ty, bool>)
+  base &operator<<(Ty const value) {
+    char digits[24];
+    auto const result = std::to_chars(digits, digits + sizeof(digits), value);
+    return *this << std::string_view(digits, static_cast<size_t>(result.ptr - digits));
+  }
+
+  // Same as an std::ostream with default flags, i.e. %g with 6 significant digits.
+  base &operator<<(double value);
+
+  // Passes everything written so far on to the destination.
+  void flush() {
+    flush_buffer();
+    sync();
+  }
+
+protected:
+  // Receives buffered output, in order.
+  virtual void consume(std::string_view chunk) = 0;
+
+  // Called by flush() after the buffer was consumed.
+  virtual void sync() {}
+
+  // Derived destructors must call this, consume() is gone by the time ~base runs.
+  void flush_buffer() {
+    if (m_len > 0) {
+      consume(std::string_view(m_buf.data(), m_len));
+      m_len = 0;
+    }
+  }
+
+private:
+  std::array<char, 16 * 1024> m_buf;
+  size_t m_len = 0;
+};
+
+// Collects output in memory, for tests and callers which want it as one string.
+class memory : public base {
+public:
+  ~memory() override { flush_buffer(); }
+
+  std::string const &str() {
+    flush_buffer();
+    return m_str;
+  }
+
+protected:
+  void consume(std::string_view const chunk) override { m_str.append(chunk); }
+
+private:
+  std::string m_str{};
+};
+
+// Writes to a stream, e.g. std::cout.
+class stream : public base {
+public:
+  explicit stream(std::ostream &os) : m_os(os) {}
+  ~stream() override;
+
+protected:
+  void consume(std::string_view chunk) override;
+  void sync() override;
+
+private:
+  std::ostream &m_os;
+};
+
+// Writes to a file it owns.
+class file : public base {
+public:
+  // Throws std::runtime_error if the file cannot be opened.
+  explicit file(char const *pathname);
+  ~file() override;
+
+protected:
+  void consume(std::string_view chunk) override;
+  void sync() override;
+
+private:
+  std::fstream m_file;
+};
+
+// Hands each chunk to a function, for using actions in-process.
+class callback : public base {
+public:
+  explicit callback(std::function<void (std::string_view)> fn) : m_fn(std::move(fn)) {}
+  ~callback() override { flush_buffer(); }
+
+protected:
+  void consume(std::string_view const chunk) override { m_fn(chunk); }
+
+private:
+  std::function<void (std::string_view)> m_fn;
+};
+
+// Writes everything to two other sinks.
+class tee : public base {
+public:
+  tee(base &first, base &second) : m_first(first), m_second(second) {}
+  ~tee() override { flush_buffer(); }
+
+protected:
+  void consume(std::string_view const chunk) override {
+    m_first << chunk;
+    m_second << chunk;
+  }
+
+  void sync() override {
+    m_first.flush();
+    m_second.flush();
+  }
+
+private:
+  base &m_first;
+  base &m_second;
+};
+
+} // namespace sink
+
+#endif // SINK_HPP
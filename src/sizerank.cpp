@@ -1,51 +1,124 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <ctime>
+#include <deque>
+#include <optional>
 #include <filesystem>
 #include <functional>
+#include <memory>
 #include <regex>
 #include <vector>
 #include <iostream>
-#include <sstream>
-
-#include <boost/program_options.hpp>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <stop_token>
+#include <unordered_map>
 
 #include "action.hpp"
+#include "fileutil.hpp"
+#include "sink.hpp"
+#include "snapshot.hpp"
+#include "thread_pool.hpp"
 #include "util.hpp"
+#include "walk.hpp"
 
-namespace bpo = boost::program_options;
 namespace fs = std::filesystem;
 
-bpo::options_description action::sizerank_options_desc() {
-  bpo::options_description desc("SIZERANK OPTIONS");
-  desc.add_options()
-    ("dir,d", bpo::value<std::string>(), "Search directory, default=cwd")
-    ("recurse,r", "Enables recursive search through child directories, default=false")
-    ("top,n", bpo::value<size_t>(), "Number of top entries to rank, default=10")
-    ("sizelim,s", bpo::value<std::string>(), "File size limits to consider, inclusive, format: min,max")
-    ("pattern,p", bpo::value<std::string>(), "Regular expression to match file names against, default=.*")
-    ("followsymlinks,l", "Enables following symbolic links, default=false")
-    ("outpath,o", bpo::value<std::string>(), "Path of output file, default=none")
-  ;
-  return desc;
+static constexpr opts::option sizerank_options[] {
+  { "dir", 'd', opts::arg::string_list, "Search directory, repeat to rank files across several, default=cwd" },
+  { "recurse", 'r', opts::arg::none, "Enables recursive search through child directories, default=false" },
+  { "top", 'n', opts::arg::unsigned_int, "Number of top entries to rank, default=10" },
+  { "sizelim", 's', opts::arg::string, "File size limits to consider, inclusive, format: min,max" },
+  { "pattern", 'p', opts::arg::string, "Regular expression to match file names against, default=.*" },
+  { "followsymlinks", 'l', opts::arg::none, "Enables following symbolic links, default=false" },
+  { "outpath", 'o', opts::arg::string, "Path of output file, default=none" },
+  { "snapshot", 'S', opts::arg::string, "Path to save a snapshot of every file found, for snapdiff, default=none" },
+  { "devthreads", 'w', opts::arg::unsigned_int, "Threads listing directories per storage device, directories on different devices are always searched concurrently, default=1" },
+  { "older-than", 'O', opts::arg::string, "Only considers files whose --time is older than this, format: <N>s|m|h|d|w|y e.g. 90d, default=none" },
+  { "newer-than", 'N', opts::arg::string, "Only considers files whose --time is newer than this, format: same as --older-than, default=none" },
+  { "time", 't', opts::arg::string, "Timestamp for --older-than, --newer-than and --score, format: atime|mtime|btime, default=mtime" },
+  { "score", 'c', opts::arg::none, "Ranks files by size x age (of --time) instead of size, default=false" },
+  { "progress", 'P', opts::arg::floating, "Prints the provisional top N and scan counters every this many seconds, default=none" },
+  { "progressfiles", 'K', opts::arg::unsigned_int, "Prints the provisional top N and scan counters every this many files found, default=none" },
+  { "inodeorder", 'i', opts::arg::none, "Stats entries and descends into directories in inode order, faster on spinning disks, default=false" },
+  { "budget", 'b', opts::arg::floating, "Time budget in seconds, when exceeded the best results found so far are reported as approximate, default=none" },
+  { "sample", 'f', opts::arg::floating, "Fraction (0,1] of subdirectories to descend into, totals are extrapolated and reported as approximate, default=1" },
+  { "seed", 'e', opts::arg::unsigned_int, "Random seed for --sample, default=random" },
+  { "histogram", 'g', opts::arg::string, "Appends a log2 size histogram with p50/p90/p99, format: ascii|csv, default=ascii", "ascii" },
+};
+
+opts::table action::sizerank_options_desc() {
+  return { "SIZERANK OPTIONS", sizerank_options };
 }
 
 std::string action::sizerank_help_msg() {
-  std::stringstream out{};
-  sizerank_options_desc().print(out, 6);
-  return out.str();
+  return opts::help_msg(sizerank_options_desc());
 }
 
+// What the action takes on top of what fileutil::sizerank does.
 struct sizerank_config {
-  std::string pattern;
-  std::string search_path;
+  fileutil::sizerank_config rank;
   std::string out_path;
-  size_t top_n;
-  size_t min_size;
-  size_t max_size;
-  bool recurse;
-  bool follow_sym_links;
+  // empty if not printing a histogram
+  std::string histogram_fmt;
+  std::string time_name;
 };
 
+// Compiles --pattern, or returns it as compiled by an earlier call, so a batch
+// running sizerank over and over with the same pattern compiles it only once.
+// std::regex_match only reads a regex, so one can be shared between threads.
+// Throws std::regex_error if `pattern` is not a valid regular expression.
+static
+std::shared_ptr<std::regex const> compiled_pattern(std::string const &pattern) {
+  static std::mutex s_mutex{};
+  static std::unordered_map<std::string, std::shared_ptr<std::regex const>> s_compiled{};
+
+  {
+    std::lock_guard<std::mutex> const lock(s_mutex);
+    if (auto const it = s_compiled.find(pattern); it != s_compiled.end()) {
+      return it->second;
+    }
+  }
+
+  // compiled unlocked, so threads compiling different patterns don't wait on each other
+  auto regex = std::make_shared<std::regex const>(pattern);
+
+  std::lock_guard<std::mutex> const lock(s_mutex);
+  if (s_compiled.size() >= 256) {
+    // a script generating patterns shouldn't grow this without bound
+    s_compiled.clear();
+  }
+  return s_compiled.try_emplace(pattern, std::move(regex)).first->second;
+}
+
+// Parses "<N><unit>" with unit one of s, m (minutes), h, d, w or y (365 days).
+// Returns -1 if `str` doesn't match that format.
+static
+int64_t parse_duration_secs(std::string const &str) {
+  static std::regex const s_format("^[0-9]{1,9}[smhdwy]$");
+  if (!std::regex_match(str, s_format)) {
+    return -1;
+  }
+
+  int64_t const count = std::stoll(str);
+  switch (str.back()) {
+    case 's': return count;
+    case 'm': return count * 60;
+    case 'h': return count * 60 * 60;
+    case 'd': return count * 60 * 60 * 24;
+    case 'w': return count * 60 * 60 * 24 * 7;
+    default:  return count * 60 * 60 * 24 * 365;
+  }
+}
+
 static
-sizerank_config parse_config(bpo::variables_map const &var_map, std::vector<std::string> &errors) {
+sizerank_config parse_config(opts::parsed const &var_map, std::vector<std::string> &errors) {
   using util::get_required_option;
   using util::get_nonrequired_option;
   using util::get_flag_option;
@@ -57,29 +130,32 @@ sizerank_config parse_config(bpo::variables_map const &var_map, std::vector<std:
 
     if (pattern.has_value()) {
       try {
-        // if pattern is not a valid regexp, std::regex ctor will throw
-        [[maybe_unused]] std::regex const r(pattern.value());
+        // if pattern is not a valid regexp, std::regex ctor will throw,
+        // otherwise the search reuses what was compiled here
+        (void)compiled_pattern(pattern.value());
 
         // construction succeeded, thus pattern is a valid regexp
-        cfg.pattern = std::move(pattern.value());
+        cfg.rank.pattern = std::move(pattern.value());
       } catch (...) {
         errors.emplace_back("(--pattern, -p) is not a invalid regular expression");
       }
     } else {
-      cfg.pattern = ".*";
+      cfg.rank.pattern = ".*";
     }
   }
   {
-    auto search_path = get_nonrequired_option<std::string>("dir", "d", var_map, errors);
+    auto search_paths = get_nonrequired_option<std::vector<std::string>>("dir", "d", var_map, errors);
 
-    if (search_path.has_value()) {
-      if (!fs::is_directory(search_path.value())) {
+    if (search_paths.has_value()) {
+      bool const all_dirs = std::all_of(search_paths.value().begin(), search_paths.value().end(),
+        [](std::string const &path) { return fs::is_directory(path); });
+      if (!all_dirs) {
         errors.emplace_back("(--dir, -d) is not a directory");
       } else {
-        cfg.search_path = std::move(search_path.value());
+        cfg.rank.roots.assign(search_paths.value().begin(), search_paths.value().end());
       }
     } else {
-      cfg.search_path = fs::current_path().string();
+      cfg.rank.roots = { fs::current_path() };
     }
   }
   {
@@ -96,17 +172,43 @@ sizerank_config parse_config(bpo::variables_map const &var_map, std::vector<std:
       cfg.out_path = "";
     }
   }
+  {
+    auto snapshot_path = get_nonrequired_option<std::string>("snapshot", "S", var_map, errors);
+
+    if (snapshot_path.has_value()) {
+      // Not opened to check, that would truncate an earlier snapshot at the path
+      // even if the run then fails. It's only replaced once the walk completes.
+      fs::path const parent = fs::path(snapshot_path.value()).parent_path();
+      if ((!parent.empty() && !fs::is_directory(parent)) || fs::is_directory(snapshot_path.value())) {
+        errors.emplace_back("(--snapshot, -S) cannot be opened");
+      } else {
+        cfg.rank.snapshot_path = std::move(snapshot_path.value());
+      }
+    } else {
+      cfg.rank.snapshot_path = "";
+    }
+  }
   {
     auto top_n = get_nonrequired_option<size_t>("top", "n", var_map, errors);
-    cfg.top_n = top_n.value_or(10);
+    cfg.rank.top_n = top_n.value_or(10);
+  }
+  {
+    auto threads_per_device = get_nonrequired_option<size_t>("devthreads", "w", var_map, errors);
+
+    if (threads_per_device.has_value() && threads_per_device.value() == 0) {
+      errors.emplace_back("(--devthreads, -w) value must be > 0");
+    } else {
+      cfg.rank.threads_per_device = threads_per_device.value_or(1);
+    }
   }
   {
     auto size_lim = get_nonrequired_option<std::string>("sizelim", "s", var_map, errors);
 
     if (size_lim.has_value()) {
       char const *const valid_regex = "^[0-9]+,[0-9]+$";
-      if (!std::regex_match(size_lim.value(), std::regex(valid_regex))) {
-        errors.emplace_back(util::make_str("(--sizelim, -s) must match /%s/", valid_regex));
+      static std::regex const s_valid(valid_regex);
+      if (!std::regex_match(size_lim.value(), s_valid)) {
+        errors.emplace_back(util::make_str("(--sizelim, -s) must match /{}/", valid_regex));
       } else {
         // since we verified the format of `size_lim`,
         // there shouldn't be any exceptions caused by this block...
@@ -126,22 +228,120 @@ sizerank_config parse_config(bpo::variables_map const &var_map, std::vector<std:
         } else if (max < min) {
           errors.emplace_back("(--sizelim, -s) max(rhs) must be >= min(lhs)");
         } else {
-          cfg.min_size = min;
-          cfg.max_size = max;
+          cfg.rank.min_size = min;
+          cfg.rank.max_size = max;
         }
       }
     } else {
-      cfg.min_size = 0;
-      cfg.max_size = UINT64_MAX;
+      cfg.rank.min_size = 0;
+      cfg.rank.max_size = UINT64_MAX;
+    }
+  }
+  {
+    auto budget_secs = get_nonrequired_option<double>("budget", "b", var_map, errors);
+
+    if (budget_secs.has_value() && !(budget_secs.value() > 0)) {
+      errors.emplace_back("(--budget, -b) value must be > 0");
+    } else {
+      cfg.rank.budget_secs = budget_secs.value_or(0);
+    }
+  }
+  {
+    auto progress_secs = get_nonrequired_option<double>("progress", "P", var_map, errors);
+
+    if (progress_secs.has_value() && !(progress_secs.value() > 0)) {
+      errors.emplace_back("(--progress, -P) value must be > 0");
+    } else {
+      cfg.rank.progress_secs = progress_secs.value_or(0);
+    }
+  }
+  {
+    auto progress_files = get_nonrequired_option<size_t>("progressfiles", "K", var_map, errors);
+
+    if (progress_files.has_value() && progress_files.value() == 0) {
+      errors.emplace_back("(--progressfiles, -K) value must be > 0");
+    } else {
+      cfg.rank.progress_files = progress_files.value_or(0);
+    }
+  }
+  {
+    auto sample_fraction = get_nonrequired_option<double>("sample", "f", var_map, errors);
+
+    if (sample_fraction.has_value() && !(sample_fraction.value() > 0 && sample_fraction.value() <= 1)) {
+      errors.emplace_back("(--sample, -f) value must be in range (0, 1]");
+    } else {
+      cfg.rank.sample_fraction = sample_fraction.value_or(1);
+    }
+  }
+  {
+    auto sample_seed = get_nonrequired_option<uint64_t>("seed", "e", var_map, errors);
+    cfg.rank.sample_seed = sample_seed.has_value() ? sample_seed.value() : std::random_device{}();
+  }
+  if (!cfg.rank.snapshot_path.empty() && (cfg.rank.sample_fraction < 1 || cfg.rank.budget_secs > 0)) {
+    // snapdiff would read the files they leave out as deleted
+    errors.emplace_back("(--snapshot, -S) cannot be combined with --sample or --budget");
+  }
+  {
+    auto histogram_fmt = get_nonrequired_option<std::string>("histogram", "g", var_map, errors);
+
+    if (histogram_fmt.has_value()) {
+      if (histogram_fmt.value() != "ascii" && histogram_fmt.value() != "csv") {
+        errors.emplace_back("(--histogram, -g) format must be ascii or csv");
+      } else {
+        cfg.histogram_fmt = std::move(histogram_fmt.value());
+        cfg.rank.histogram = true;
+      }
+    } else {
+      cfg.histogram_fmt = "";
+    }
+  }
+  {
+    auto time_name = get_nonrequired_option<std::string>("time", "t", var_map, errors);
+    cfg.time_name = time_name.value_or("mtime");
+
+    if (cfg.time_name == "atime") {
+      cfg.rank.time = fileutil::timestamp::access;
+    } else if (cfg.time_name == "mtime") {
+      cfg.rank.time = fileutil::timestamp::modify;
+    } else if (cfg.time_name == "btime") {
+      cfg.rank.time = fileutil::timestamp::birth;
+    } else {
+      errors.emplace_back("(--time, -t) must be atime, mtime or btime");
     }
   }
+  {
+    auto older_than = get_nonrequired_option<std::string>("older-than", "O", var_map, errors);
+    auto newer_than = get_nonrequired_option<std::string>("newer-than", "N", var_map, errors);
+
+    cfg.rank.older_than_secs = older_than.has_value() ? parse_duration_secs(older_than.value()) : 0;
+    cfg.rank.newer_than_secs = newer_than.has_value() ? parse_duration_secs(newer_than.value()) : 0;
+
+    if (cfg.rank.older_than_secs < 0) {
+      errors.emplace_back("(--older-than, -O) must be <N>s|m|h|d|w|y");
+    }
+    if (cfg.rank.newer_than_secs < 0) {
+      errors.emplace_back("(--newer-than, -N) must be <N>s|m|h|d|w|y");
+    }
+    if (cfg.rank.older_than_secs > 0 && cfg.rank.newer_than_secs > 0 && cfg.rank.newer_than_secs <= cfg.rank.older_than_secs) {
+      // the window between them would be empty
+      errors.emplace_back("(--newer-than, -N) must be longer than --older-than");
+    }
+  }
+  {
+    bool const score = get_flag_option("score", var_map);
+    cfg.rank.score = score;
+  }
   {
     bool const recurse = get_flag_option("recurse", var_map);
-    cfg.recurse = recurse;
+    cfg.rank.recurse = recurse;
   }
   {
     bool const follow_sym_links = get_flag_option("followsymlinks", var_map);
-    cfg.follow_sym_links = follow_sym_links;
+    cfg.rank.follow_sym_links = follow_sym_links;
+  }
+  {
+    bool const inode_order = get_flag_option("inodeorder", var_map);
+    cfg.rank.inode_order = inode_order;
   }
 
   return cfg;
@@ -154,46 +354,302 @@ bool largest(uintmax_t const curr_file_sz, uintmax_t const lowest_ranked_file_sz
   return curr_file_sz > lowest_ranked_file_sz;
 }
 
-std::string action::sizerank_perform(int const argc, char const *const *const argv) {
-  std::stringstream out_ss{};
+using fileutil::size_histogram;
 
-  bpo::variables_map var_map;
-  try {
-    bpo::store(bpo::parse_command_line(argc, argv, action::sizerank_options_desc()), var_map);
-  } catch (std::exception const &err) {
-    out_ss << err.what() << '\n';
-    return out_ss.str();
+void size_histogram::add(uintmax_t const size) {
+  auto &b = buckets[bucket_idx(size)];
+  if (b.count == 0 || size < b.min)
+    b.min = size;
+  if (b.count == 0 || size > b.max)
+    b.max = size;
+  ++b.count;
+  b.bytes += size;
+  ++total_count;
+  total_bytes += size;
+}
+
+void size_histogram::merge(size_histogram const &other) {
+  for (size_t i = 0; i < num_buckets; ++i) {
+    auto &b = buckets[i];
+    auto const &o = other.buckets[i];
+    if (o.count == 0)
+      continue;
+    if (b.count == 0 || o.min < b.min)
+      b.min = o.min;
+    if (b.count == 0 || o.max > b.max)
+      b.max = o.max;
+    b.count += o.count;
+    b.bytes += o.bytes;
   }
-  bpo::notify(var_map);
+  total_count += other.total_count;
+  total_bytes += other.total_bytes;
+}
 
-  std::vector<std::string> errors{};
-  sizerank_config cfg = parse_config(var_map, errors);
-  if (!errors.empty()) {
-    for (auto const &err : errors)
-      out_ss << err << '\n';
-    return out_ss.str();
+uintmax_t size_histogram::percentile(double const p) const {
+  if (total_count == 0)
+    return 0;
+
+  auto const rank = std::max(uintmax_t(1),
+    static_cast<uintmax_t>(std::ceil(p / 100.0 * static_cast<double>(total_count))));
+
+  uintmax_t cumulative = 0;
+  for (auto const &b : buckets) {
+    if (cumulative + b.count < rank) {
+      cumulative += b.count;
+      continue;
+    }
+    if (b.count == 1)
+      return b.min;
+    uintmax_t const rank_in_bucket = rank - cumulative - 1;
+    double const frac = static_cast<double>(rank_in_bucket) / static_cast<double>(b.count - 1);
+    return b.min + static_cast<uintmax_t>(frac * static_cast<double>(b.max - b.min));
+  }
+
+  return buckets[num_buckets - 1].max;
+}
+
+static
+void print_histogram_ascii(size_histogram const &histogram, sink::base &os) {
+  auto const &buckets = histogram.buckets;
+  size_t constexpr num_buckets = size_histogram::num_buckets;
+
+  size_t first = num_buckets, last = 0;
+  uintmax_t max_count = 0;
+  for (size_t i = 0; i < num_buckets; ++i) {
+    if (buckets[i].count == 0)
+      continue;
+    first = std::min(first, i);
+    last = i;
+    max_count = std::max(max_count, buckets[i].count);
   }
 
-  struct file_entry {
-    fs::path m_path;
-    uintmax_t m_size;
+  os << "size histogram, " << histogram.total_count << " files, "
+    << util::format_file_size(histogram.total_bytes) << " total\n";
+
+  if (histogram.total_count == 0)
+    return;
+
+  size_t constexpr max_bar_len = 40;
+
+  // reused for every row
+  std::string range{}, line{};
+
+  for (size_t i = first; i <= last; ++i) {
+    auto const &b = buckets[i];
+
+    range.clear();
+    util::format_to(range, "[{}, {}]",
+      util::file_size{ size_histogram::bucket_lower_bound(i) },
+      util::file_size{ size_histogram::bucket_upper_bound(i) });
+
+    line.clear();
+    util::format_to(line, "{:<24} {:>10} {:>12}  ", range, b.count, util::file_size{ b.bytes });
+
+    auto const bar_len = static_cast<size_t>(
+      (static_cast<double>(b.count) / static_cast<double>(max_count)) * max_bar_len);
+
+    os << line << std::string(std::max(bar_len, size_t(b.count > 0)), '#') << '\n';
+  }
+
+  os
+    << "p50 ~" << util::format_file_size(histogram.percentile(50))
+    << ", p90 ~" << util::format_file_size(histogram.percentile(90))
+    << ", p99 ~" << util::format_file_size(histogram.percentile(99)) << '\n';
+}
+
+static
+void print_histogram_csv(size_histogram const &histogram, sink::base &os) {
+  os << "bucket_min,bucket_max,count,bytes\n";
+  for (size_t i = 0; i < size_histogram::num_buckets; ++i) {
+    auto const &b = histogram.buckets[i];
+    if (b.count == 0)
+      continue;
+    os << size_histogram::bucket_lower_bound(i) << ',' << size_histogram::bucket_upper_bound(i) << ','
+      << b.count << ',' << b.bytes << '\n';
+  }
+  os
+    << "percentile,size\n"
+    << "p50," << histogram.percentile(50) << '\n'
+    << "p90," << histogram.percentile(90) << '\n'
+    << "p99," << histogram.percentile(99) << '\n';
+}
+
+// Horvitz-Thompson estimate of file count and bytes from a walk which descends into each
+// subdirectory with probability p. A directory's subtree total is estimated as
+//   T = Y + sum of T_c / p over visited children c
+// and the variance of that estimate as
+//   V = sum of (1 - p) / p^2 * T_c^2 + V_c / p over visited children c
+// where Y is the total of the directory's own files. Both are unbiased. A subtree is
+// folded into its parent as soon as all of its visited children are done, and the
+// subtrees of several roots are summed.
+class sample_estimate {
+public:
+  using quantity = fileutil::estimate;
+
+  explicit sample_estimate(double const sample_fraction) : m_p(sample_fraction) {}
+
+  // `num_files` and `num_bytes` total the directory's own files. Safe to call concurrently,
+  // the walk's workers tally a directory's files themselves so this locks once per directory.
+  void add_dir(walk::dir_info const &dir, double const num_files, double const num_bytes) {
+    std::lock_guard<std::mutex> const lock(m_mutex);
+
+    auto &n = m_nodes[dir.dir_id];
+    n.totals[files_idx].y += num_files;
+    n.totals[bytes_idx].y += num_bytes;
+    m_seen[files_idx] += num_files;
+    m_seen[bytes_idx] += num_bytes;
+    n.parent_id = dir.parent_id;
+    n.num_pending_children += dir.num_children;
+    n.listed = true;
+    if (n.num_pending_children == 0) {
+      fold(dir.dir_id);
+    }
+  }
+
+  // Folds whatever is left, in case the walk was cut short. Subtrees which were
+  // never visited then count as empty, so the estimate is biased low.
+  void finish() {
+    std::lock_guard<std::mutex> const lock(m_mutex);
+
+    std::vector<size_t> ids{};
+    ids.reserve(m_nodes.size());
+    for (auto const &[id, n] : m_nodes) {
+      ids.push_back(id);
+    }
+    // children always have higher ids than their parents
+    std::sort(ids.begin(), ids.end(), std::greater<size_t>());
+    for (size_t const id : ids) {
+      if (m_nodes.contains(id)) {
+        fold(id);
+      }
+    }
+  }
+
+  quantity files() const { return { m_root[files_idx].est, m_root[files_idx].var, m_seen[files_idx] }; }
+  quantity bytes() const { return { m_root[bytes_idx].est, m_root[bytes_idx].var, m_seen[bytes_idx] }; }
+
+private:
+  static size_t constexpr files_idx = 0, bytes_idx = 1;
+
+  struct subtree_total {
+    double y = 0; // directory's own files
+    double t = 0; // sum of T_c / p
+    double v = 0; // sum of variance terms
   };
 
-  size_t num_files_found = 0;
-  std::vector<file_entry> top_files{};
-  try {
-    top_files.reserve(cfg.top_n + 1); // 1 extra for when we overflow
-  } catch (std::exception const &except) {
-    out_ss << except.what() << '\n';
-    return out_ss.str();
+  struct node {
+    std::array<subtree_total, 2> totals{};
+    size_t parent_id = SIZE_MAX;
+    size_t num_pending_children = 0;
+    bool listed = false;
+  };
+
+  struct result {
+    double est = 0;
+    double var = 0;
+  };
+
+  void fold(size_t id) {
+    for (;;) {
+      auto const it = m_nodes.find(id);
+      node const n = it->second;
+      m_nodes.erase(it);
+
+      if (n.parent_id == SIZE_MAX) {
+        for (size_t i = 0; i < n.totals.size(); ++i) {
+          m_root[i].est += n.totals[i].y + n.totals[i].t;
+          m_root[i].var += n.totals[i].v;
+        }
+        return;
+      }
+
+      auto &parent = m_nodes[n.parent_id];
+      for (size_t i = 0; i < n.totals.size(); ++i) {
+        double const total = n.totals[i].y + n.totals[i].t;
+        parent.totals[i].t += total / m_p;
+        parent.totals[i].v += (1 - m_p) / (m_p * m_p) * total * total + n.totals[i].v / m_p;
+      }
+
+      if (parent.num_pending_children > 0) {
+        --parent.num_pending_children;
+      }
+      if (!parent.listed || parent.num_pending_children > 0) {
+        return;
+      }
+      id = n.parent_id;
+    }
   }
 
-  auto const binary_insert = [&top_files](
-    fs::path const &path,
-    uintmax_t const size
+  double const m_p;
+  std::mutex m_mutex{};
+  std::unordered_map<size_t, node> m_nodes{};
+  std::array<result, 2> m_root{};
+  std::array<double, 2> m_seen{};
+};
+
+fileutil::sizerank_result fileutil::sizerank(sizerank_config const &cfg, std::stop_token const stop) {
+  if (cfg.roots.empty()) {
+    throw std::invalid_argument("no directory to search");
+  }
+  if (cfg.threads_per_device == 0) {
+    throw std::invalid_argument("threads per device must be > 0");
+  }
+  if (!(cfg.sample_fraction > 0 && cfg.sample_fraction <= 1)) {
+    throw std::invalid_argument("sample fraction must be in range (0, 1]");
+  }
+  if (cfg.max_size < cfg.min_size) {
+    throw std::invalid_argument("max size must be >= min size");
+  }
+  if (!cfg.snapshot_path.empty() && (cfg.sample_fraction < 1 || cfg.budget_secs > 0)) {
+    throw std::invalid_argument("a snapshot cannot be sampled or time budgeted");
+  }
+
+  // What a walk worker accumulates per file, owned by that worker so files are
+  // processed without contention. Merged once every walk is done.
+  struct worker_results {
+    // Only the owning worker changes top_files. It locks the mutex to do so, which
+    // is rare once the ranking has filled up, so that progress reports can copy a
+    // consistent ranking without stopping the worker.
+    std::mutex top_files_mutex{};
+    std::vector<ranked_file> top_files{};
+    size_histogram histogram{};
+    // Written by the owning worker only, read by progress reports while the walk runs.
+    std::atomic<size_t> num_files_found = 0;
+    std::atomic<uintmax_t> num_bytes_found = 0;
+    std::atomic<size_t> num_dirs_listed = 0;
+    // own files of the directory being listed, handed to the estimate when it's done
+    double dir_num_files = 0;
+    double dir_num_bytes = 0;
+  };
+
+  // A plain load and store, as the owner is the only writer it needn't be an atomic add.
+  auto const bump = []<typename Ty>(std::atomic<Ty> &counter, Ty const amount) {
+    counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+  };
+
+  // Roots on the same device share one walk and its threads_per_device workers, so adding
+  // roots doesn't pile more concurrent requests onto one disk. Roots on different
+  // devices get a walk each, and the walks run concurrently.
+  struct device_walk {
+    explicit device_walk(double const sample_fraction) : estimate(sample_fraction) {}
+
+    // index into cfg.roots of each entry in opts.roots
+    std::vector<size_t> root_indices{};
+    walk::options opts{};
+    // deque because worker_results can't be moved (it holds a mutex)
+    std::deque<worker_results> workers{};
+    sample_estimate estimate;
+    walk::summary summary{};
+  };
+
+  auto const binary_insert = [](
+    std::vector<ranked_file> &top_files,
+    ranked_file &&entry
   ) {
+    double const rank = entry.rank;
+
     if (top_files.empty()) {
-      top_files.emplace_back(path, size);
+      top_files.push_back(std::move(entry));
       return;
     }
 
@@ -202,141 +658,530 @@ std::string action::sizerank_perform(int const argc, char const *const *const ar
 
     while (last - first > 1) {
       int64_t const middle = (first + last) / 2;
-      if (size < top_files[middle].m_size)
+      if (rank < top_files[middle].rank)
         first = middle;
       else
         last = middle;
     }
 
-    std::vector<file_entry>::const_iterator const insert_pos = [&]() {
-      if (size > top_files[first].m_size)
+    std::vector<ranked_file>::const_iterator const insert_pos = [&]() {
+      if (rank > top_files[first].rank)
         return top_files.cbegin() + first;
-      else if (size < top_files[last].m_size)
+      else if (rank < top_files[last].rank)
         return top_files.cbegin() + last + 1;
       else
         return top_files.cbegin() + last;
     }();
 
-    top_files.emplace(insert_pos, path, size);
+    top_files.insert(insert_pos, std::move(entry));
   };
 
-  std::regex const pattern_regex(cfg.pattern);
-
-  auto const process_dir_entry = [&](fs::directory_entry const &entry) {
-    if (entry.is_directory()) {
-      return;
+  bool const pattern_matches_all = cfg.pattern.empty() || cfg.pattern == ".*";
+  std::shared_ptr<std::regex const> pattern_regex{};
+  if (!pattern_matches_all) {
+    try {
+      pattern_regex = compiled_pattern(cfg.pattern);
+    } catch (std::regex_error const &) {
+      throw std::invalid_argument("\"" + cfg.pattern + "\" is not a valid regular expression");
     }
+  }
 
-    std::error_code ec{};
-    uintmax_t const size = fs::file_size(entry, ec);
-    if (ec) {
-      return;
+  bool const sampling = cfg.sample_fraction < 1;
+  bool const estimating = sampling || cfg.budget_secs > 0;
+
+  // histogram and estimate cover every matching file, not just the top N,
+  // so for them the pattern has to be checked before the rank cutoff
+  bool const match_all_files = cfg.histogram || estimating;
+
+  // ages are relative to when the search started, so every file is judged by the same clock
+  int64_t const now = static_cast<int64_t>(std::time(nullptr));
+  bool const uses_time = cfg.older_than_secs > 0 || cfg.newer_than_secs > 0 || cfg.score;
+  int64_t walk::file_times::*const timestamp_of =
+    cfg.time == timestamp::access ? &walk::file_times::access :
+    cfg.time == timestamp::birth ? &walk::file_times::birth :
+    &walk::file_times::modify;
+
+  auto const fname_matches_pattern = [&](fs::path const &path) {
+    // std::regex_match only reads the regex, so it's safe to share between workers
+    return pattern_matches_all || std::regex_match(
+      path.filename().string(),
+      *pattern_regex);
+  };
+
+  bool const multiple_roots = cfg.roots.size() > 1;
+
+  std::optional<snapshot::writer> snapshot_writer{};
+  if (!cfg.snapshot_path.empty()) {
+    snapshot_writer.emplace(cfg.snapshot_path);
+  }
+
+  // A single root's files are keyed relative to it, so snapshots of a tree which
+  // was since moved or mounted elsewhere still line up. With several roots the
+  // root is part of the key. Paths are the root joined with what's below it, so
+  // the prefix to strip is the root as joined, with one separator whether or not
+  // it was given with a trailing one.
+  size_t const root_prefix_len = (cfg.roots.front() / "").generic_string().size();
+  auto const snapshot_key = [&](walk::file_info const &file) {
+    std::string key = file.path.generic_string();
+    if (!multiple_roots) {
+      key.erase(0, root_prefix_len);
     }
+    return key;
+  };
+
+  auto const process_file = [&](device_walk &dw, walk::file_info const &file) {
+    fs::path const &path = file.path;
+    uintmax_t const size = file.size;
+    worker_results &results = dw.workers[file.worker_idx];
+    std::vector<ranked_file> &top_files = results.top_files;
 
-    ++num_files_found;
+    bump(results.num_files_found, size_t(1));
+    bump(results.num_bytes_found, size);
+
+    // the snapshot records everything, filters only apply to the ranking
+    if (snapshot_writer.has_value()) {
+      snapshot_writer->add(snapshot_key(file), size);
+    }
 
     // quickest check, do it first
     if (size < cfg.min_size || size > cfg.max_size) {
       return;
     }
 
+    // timestamps came with the size, so this is nearly as quick
+    int64_t age_secs = 0;
+    if (uses_time) {
+      int64_t const time = file.times.*timestamp_of;
+      if (time == walk::unknown_time) {
+        return;
+      }
+      age_secs = std::max(now - time, int64_t(0));
+      if (cfg.older_than_secs > 0 && age_secs < cfg.older_than_secs) {
+        return;
+      }
+      if (cfg.newer_than_secs > 0 && age_secs > cfg.newer_than_secs) {
+        return;
+      }
+    }
+
+    if (match_all_files) {
+      if (!fname_matches_pattern(path)) {
+        return;
+      }
+      if (cfg.histogram) {
+        results.histogram.add(size);
+      }
+      if (estimating) {
+        results.dir_num_files += 1;
+        results.dir_num_bytes += static_cast<double>(size);
+      }
+    }
+
+    // the snapshot, histogram and estimates are all that's wanted, and an empty
+    // ranking would count as full below
+    if (cfg.top_n == 0) {
+      return;
+    }
+
+    double const rank = cfg.score
+      ? static_cast<double>(size) * static_cast<double>(age_secs)
+      : static_cast<double>(size);
+
     // second quickest check, do it second
     {
       bool const top_files_is_full = top_files.size() == cfg.top_n;
       if (top_files_is_full) {
-        uintmax_t const lowest_ranked_sz = top_files[top_files.size() - 1].m_size;
-        if (size < lowest_ranked_sz) {
+        double const lowest_rank = top_files[top_files.size() - 1].rank;
+        if (rank < lowest_rank) {
           return;
         }
       }
     }
 
     // slowest check, do it last
-    if (!cfg.pattern.empty()) {
-      bool const fname_matches_pattern = std::regex_match(
-        entry.path().filename().string(),
-        pattern_regex);
-
-      if (!fname_matches_pattern) {
-        return;
-      }
+    if (!match_all_files && !fname_matches_pattern(path)) {
+      return;
     }
 
-    binary_insert(entry, size);
+    std::lock_guard<std::mutex> const lock(results.top_files_mutex);
+    binary_insert(top_files, { path, size, rank, age_secs, dw.root_indices[file.root_idx] });
     if (top_files.size() > cfg.top_n) {
       top_files.pop_back();
     }
   };
 
-  fs::directory_options dir_options = fs::directory_options::skip_permission_denied;
-  if (cfg.follow_sym_links) {
-    dir_options |= fs::directory_options::follow_directory_symlink;
+  auto const deadline = cfg.budget_secs > 0
+    ? std::chrono::steady_clock::now() +
+      std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(cfg.budget_secs))
+    : std::chrono::steady_clock::time_point::max();
+
+  // deque because device_walk can't be moved (the estimate holds a mutex)
+  std::deque<device_walk> walks{};
+  {
+    std::vector<uint64_t> device_ids{};
+
+    for (size_t root_idx = 0; root_idx < cfg.roots.size(); ++root_idx) {
+      uint64_t const dev = walk::device_id(cfg.roots[root_idx]);
+      size_t const walk_idx = static_cast<size_t>(
+        std::find(device_ids.begin(), device_ids.end(), dev) - device_ids.begin());
+
+      if (walk_idx == walks.size()) {
+        device_ids.push_back(dev);
+        walks.emplace_back(cfg.sample_fraction);
+      }
+      walks[walk_idx].root_indices.push_back(root_idx);
+      walks[walk_idx].opts.roots.emplace_back(cfg.roots[root_idx]);
+    }
+
+    for (size_t i = 0; i < walks.size(); ++i) {
+      device_walk &dw = walks[i];
+      dw.opts.recurse = cfg.recurse;
+      dw.opts.follow_sym_links = cfg.follow_sym_links;
+      dw.opts.inode_order = cfg.inode_order;
+      dw.opts.sample_fraction = cfg.sample_fraction;
+      // each worker seeds with sample_seed + its index, keep them distinct across walks
+      dw.opts.sample_seed = cfg.sample_seed + i * cfg.threads_per_device;
+      dw.opts.deadline = deadline;
+      dw.opts.stop = stop;
+      dw.opts.num_threads = cfg.threads_per_device;
+
+      for (size_t w = 0; w < cfg.threads_per_device; ++w) {
+        dw.workers.emplace_back().top_files.reserve(cfg.top_n + 1); // 1 extra for when we overflow
+      }
+    }
   }
 
-  // find top files
-  if (cfg.recurse) {
-    // process each directory entry, and any child directories
-    for (
-      auto const &entry :
-      fs::recursive_directory_iterator(cfg.search_path, dir_options)
-    ) process_dir_entry(entry);
+  // stable, so ties keep the order a single worker would have ranked them in
+  auto const rank_merged = [&cfg](std::vector<ranked_file> &ranking) {
+    std::stable_sort(ranking.begin(), ranking.end(), [](ranked_file const &lhs, ranked_file const &rhs) {
+      return lhs.rank > rhs.rank;
+    });
+    if (ranking.size() > cfg.top_n) {
+      ranking.erase(ranking.begin() + static_cast<std::ptrdiff_t>(cfg.top_n), ranking.end());
+    }
+  };
+
+  auto const run_walk = [&](device_walk &dw) {
+    dw.summary = walk::files(dw.opts,
+      [&](walk::file_info const &file) {
+        process_file(dw, file);
+      },
+      [&](walk::dir_info const &dir) {
+        worker_results &results = dw.workers[dir.worker_idx];
+        bump(results.num_dirs_listed, size_t(1));
+        if (estimating) {
+          dw.estimate.add_dir(dir, results.dir_num_files, results.dir_num_bytes);
+          results.dir_num_files = 0;
+          results.dir_num_bytes = 0;
+        }
+      });
+    dw.estimate.finish();
+  };
+
+  bool const reporting_progress = cfg.on_progress && (cfg.progress_secs > 0 || cfg.progress_files > 0);
+
+  // Hands the provisional ranking and counters to on_progress, from this thread while the walks run.
+  auto const report_progress = [&](std::chrono::steady_clock::duration const elapsed) {
+    sizerank_progress progress{ std::chrono::duration<double>(elapsed).count(), 0, 0, 0, {} };
+
+    for (auto &dw : walks) {
+      for (auto &results : dw.workers) {
+        progress.num_dirs_listed += results.num_dirs_listed.load(std::memory_order_relaxed);
+        progress.num_files_found += results.num_files_found.load(std::memory_order_relaxed);
+        progress.num_bytes_found += results.num_bytes_found.load(std::memory_order_relaxed);
+
+        std::lock_guard<std::mutex> const lock(results.top_files_mutex);
+        progress.ranking.insert(progress.ranking.end(), results.top_files.begin(), results.top_files.end());
+      }
+    }
+    rank_merged(progress.ranking);
+
+    cfg.on_progress(progress);
+  };
+
+  // find top files, every device's walk at once
+  util::task_group walking{};
+  if (!reporting_progress) {
+    for (size_t i = 1; i < walks.size(); ++i) {
+      walking.run([&, &dw = walks[i]]() { run_walk(dw); });
+    }
+    run_walk(walks.front());
+    walking.wait();
   } else {
-    // process only the current directory, ignore child directories
-    for (
-      auto const &entry :
-      fs::directory_iterator(cfg.search_path, dir_options)
-    ) process_dir_entry(entry);
+    for (auto &dw : walks) {
+      walking.run([&, &dw = dw]() { run_walk(dw); });
+    }
+
+    using clock = std::chrono::steady_clock;
+    auto const start = clock::now();
+    auto const report_interval = std::chrono::duration_cast<clock::duration>(
+      std::chrono::duration<double>(cfg.progress_secs > 0 ? cfg.progress_secs : 3600.0));
+    // there's no event for a file count being crossed, so progress_files polls the counters
+    auto const poll_interval = cfg.progress_files > 0
+      ? std::chrono::duration_cast<clock::duration>(std::chrono::milliseconds(50))
+      : report_interval;
+
+    auto next_report_time = start + report_interval;
+    size_t next_report_files = cfg.progress_files > 0 ? cfg.progress_files : SIZE_MAX;
+
+    while (!walking.wait_until(std::min(next_report_time, clock::now() + poll_interval))) {
+      size_t num_files = 0;
+      for (auto &dw : walks) {
+        for (auto &results : dw.workers) {
+          num_files += results.num_files_found.load(std::memory_order_relaxed);
+        }
+      }
+
+      auto const tick = clock::now();
+      bool const time_due = cfg.progress_secs > 0 && tick >= next_report_time;
+      bool const files_due = num_files >= next_report_files;
+      if (time_due || files_due) {
+        report_progress(tick - start);
+        next_report_time = tick + report_interval;
+        if (cfg.progress_files > 0) {
+          next_report_files = num_files + cfg.progress_files;
+        }
+      } else if (cfg.progress_secs == 0) {
+        next_report_time = tick + report_interval;
+      }
+    }
   }
 
-  if (top_files.empty()) {
-    return "No size and/or pattern matches";
+  sizerank_result result{};
+  result.cancelled = stop.stop_requested();
+
+  // merge what every worker found
+  result.complete = !result.cancelled;
+
+  // walks cover disjoint roots, so their estimates are independent and simply add up
+  auto const add_estimate = [](estimate &sum, estimate const &q) {
+    sum.est += q.est;
+    sum.var += q.var;
+    sum.seen += q.seen;
+  };
+
+  for (auto &dw : walks) {
+    for (auto &results : dw.workers) {
+      result.num_files_found += results.num_files_found.load();
+      std::move(results.top_files.begin(), results.top_files.end(), std::back_inserter(result.top_files));
+      result.histogram.merge(results.histogram);
+    }
+
+    result.num_dirs_visited += dw.summary.num_dirs_visited;
+    result.num_dirs_skipped += dw.summary.num_dirs_skipped;
+    result.complete = result.complete && dw.summary.complete;
+
+    add_estimate(result.est_files, dw.estimate.files());
+    add_estimate(result.est_bytes, dw.estimate.bytes());
+  }
+
+  // A snapshot of part of the tree would read as deletions to snapdiff, so one
+  // that wasn't completed is never written, leaving any earlier snapshot at the
+  // path as it was. The writer's destructor removes the runs it spilled.
+  if (snapshot_writer.has_value() && result.complete) {
+    result.num_snapshot_rows = snapshot_writer->finish();
+  }
+
+  rank_merged(result.top_files);
+
+  return result;
+}
+
+// Prints `ranking` relative to the roots, tagged with the root when there are several.
+static
+void print_ranking(sink::base &dest, sizerank_config const &cfg, std::vector<fileutil::ranked_file> const &ranking) {
+  bool const multiple_roots = cfg.rank.roots.size() > 1;
+
+  // Paths are the root joined with what's below it, so the prefix to strip is the
+  // root as joined, with one separator whether or not it was given with a trailing one.
+  std::vector<size_t> root_prefix_lens{};
+  for (auto const &root : cfg.rank.roots) {
+    root_prefix_lens.push_back((root / "").string().size());
   }
 
-  for (size_t i = 0; i < top_files.size(); ++i) {
-    auto const &file = top_files[i];
+  for (size_t i = 0; i < ranking.size(); ++i) {
+    auto const &file = ranking[i];
 
-    char formatted_sz[20];
-    util::format_file_size(file.m_size, formatted_sz, util::lengthof(formatted_sz));
+    char formatted_sz[util::max_file_size_len];
 
-    std::string const path = file.m_path.string();
+    std::string const path = file.path.string();
+    std::string const root = cfg.rank.roots[file.root_idx].string();
 
     char const *const path_rel_to_search_dir =
-      path.c_str() + cfg.search_path.size() + 1;
+      path.c_str() + root_prefix_lens[file.root_idx];
 
-    out_ss
+    dest
       << (i + 1) << ". "
-      << '(' << formatted_sz << ") "
-      << path_rel_to_search_dir << '\n';
+      << '(' << util::format_file_size(file.size, formatted_sz);
+
+    if (cfg.rank.score) {
+      dest << ", " << (file.age_secs / (60 * 60 * 24)) << " days";
+    }
+
+    dest << ") ";
+
+    if (multiple_roots) {
+      dest << '[' << root << "] ";
+    }
+
+    dest << path_rel_to_search_dir << '\n';
+  }
+}
+
+bool action::sizerank_perform(int const argc, char const *const *const argv, sink::base &out) {
+  opts::parsed var_map;
+  try {
+    var_map = opts::parse(action::sizerank_options_desc(), argc, argv);
+  } catch (std::exception const &err) {
+    out << err.what() << '\n';
+    return false;
+  }
+
+  std::vector<std::string> errors{};
+  sizerank_config cfg = parse_config(var_map, errors);
+  if (!errors.empty()) {
+    for (auto const &err : errors)
+      out << err << '\n';
+    return false;
   }
 
-  std::string out = out_ss.str();
+  // prints the provisional ranking and counters while the walks run
+  cfg.rank.on_progress = [&](fileutil::sizerank_progress const &progress) {
+    double const secs = progress.elapsed_secs;
+    auto const entries_per_sec = static_cast<uintmax_t>(
+      static_cast<double>(progress.num_dirs_listed + progress.num_files_found) / std::max(secs, 1e-3));
+
+    out
+      << "PROVISIONAL RESULTS after " << secs << " s: "
+      << progress.num_dirs_listed << " directories, " << progress.num_files_found << " files, "
+      << util::format_file_size(progress.num_bytes_found) << ", " << entries_per_sec << " entries/s\n";
+    print_ranking(out, cfg, progress.ranking);
+    out << '\n';
+    out.flush();
+  };
+
+  fileutil::sizerank_result result{};
+  try {
+    result = fileutil::sizerank(cfg.rank);
+  } catch (std::exception const &except) {
+    out << except.what() << '\n';
+    return false;
+  }
+
+  bool const multiple_roots = cfg.rank.roots.size() > 1;
+  bool const sampling = cfg.rank.sample_fraction < 1;
+
+  std::optional<sink::file> out_file{};
+  std::optional<sink::tee> out_tee{};
 
   if (!cfg.out_path.empty()) {
-    std::fstream file;
     try {
-      file = util::open_file(cfg.out_path.c_str(), std::ios::out);
+      out_file.emplace(cfg.out_path.c_str());
     } catch (std::exception const &except) {
-      out_ss << except.what() << '\n';
-      return out_ss.str();
+      out << except.what() << '\n';
+      return false;
+    }
+
+    sink::file &file = out_file.value();
+
+    file << "top " << cfg.rank.top_n;
+    if (cfg.rank.score) {
+      file << " files by size x " << cfg.time_name << " age\n";
+    } else {
+      file << " largest files\n";
     }
 
     file
-      << "top " << cfg.top_n << " largest files\n"
-      << "in size range [" << cfg.min_size << ", " << cfg.max_size << "] bytes\n"
-      << "in directory " << cfg.search_path;
+      << "in size range [" << cfg.rank.min_size << ", " << cfg.rank.max_size << "] bytes\n"
+      << (multiple_roots ? "in directories " : "in directory ");
 
-    if (cfg.recurse) {
+    for (size_t i = 0; i < cfg.rank.roots.size(); ++i) {
+      file << (i > 0 ? ", " : "") << cfg.rank.roots[i].string();
+    }
+
+    if (cfg.rank.recurse) {
       file << " and child directories";
     }
 
     if (true) {
-      file << '\n' << "matching regex /^" << cfg.pattern << "$/\n";
+      file << '\n' << "matching regex /^" << cfg.rank.pattern << "$/\n";
     }
 
-    file
-      << "----------\n"
-      << out;
+    if (cfg.rank.older_than_secs > 0) {
+      file << "with " << cfg.time_name << " older than " << cfg.rank.older_than_secs << " s\n";
+    }
+    if (cfg.rank.newer_than_secs > 0) {
+      file << "with " << cfg.time_name << " newer than " << cfg.rank.newer_than_secs << " s\n";
+    }
+
+    file << "----------\n";
+
+    out_tee.emplace(out, file);
+  }
+
+  // from here on, output goes to the outpath file too
+  sink::base &report = out_tee.has_value() ? static_cast<sink::base &>(out_tee.value()) : out;
+
+  if (sampling || !result.complete) {
+    report << "APPROXIMATE RESULTS (";
+    if (sampling) {
+      report << "sampled " << (cfg.rank.sample_fraction * 100) << "% of subdirectories";
+    }
+    if (!result.complete) {
+      report
+        << (sampling ? ", " : "")
+        << "time budget of " << cfg.rank.budget_secs << " s exhausted, unvisited directories are not counted";
+    }
+    report << ")\n";
+
+    report
+      << "visited " << result.num_dirs_visited << " directories, skipped "
+      << result.num_dirs_skipped << '\n';
+
+    // 95% confidence interval, the lower bound can't be less than what was actually seen
+    auto const print_interval = [&report](fileutil::estimate const &q, bool const as_size) {
+      double const margin = 1.96 * std::sqrt(q.var);
+      auto const lo = static_cast<uintmax_t>(std::max(q.est - margin, q.seen));
+      auto const mid = static_cast<uintmax_t>(std::llround(q.est));
+      auto const hi = static_cast<uintmax_t>(q.est + margin);
+      if (as_size) {
+        report
+          << util::format_file_size(mid) << " (95% CI "
+          << util::format_file_size(lo) << " - " << util::format_file_size(hi) << ')';
+      } else {
+        report << mid << " files (95% CI " << lo << " - " << hi << ')';
+      }
+    };
+
+    report << "estimated total: ";
+    print_interval(result.est_files, false);
+    report << ", ";
+    print_interval(result.est_bytes, true);
+    report << "\n\n";
+  }
+
+  // the estimates, histogram and snapshot are reported even so
+  if (result.top_files.empty()) {
+    report << "No size and/or pattern matches\n";
+  } else {
+    print_ranking(report, cfg, result.top_files);
+  }
+
+  if (!cfg.histogram_fmt.empty()) {
+    report << '\n' << result.num_files_found << " files found\n";
+    if (sampling) {
+      report << "histogram counts sampled files only, unweighted\n";
+    }
+    if (cfg.histogram_fmt == "csv")
+      print_histogram_csv(result.histogram, report);
+    else
+      print_histogram_ascii(result.histogram, report);
+  }
+
+  if (!cfg.rank.snapshot_path.empty()) {
+    report << "\nsnapshot of " << result.num_snapshot_rows << " files saved to " << cfg.rank.snapshot_path.string() << '\n';
   }
 
-  return std::move(out);
+  return true;
 }
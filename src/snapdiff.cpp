@@ -0,0 +1,242 @@
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <limits>
+#include <stop_token>
+#include <string>
+#include <vector>
+
+#include "action.hpp"
+#include "fileutil.hpp"
+#include "snapshot.hpp"
+#include "util.hpp"
+
+namespace fs = std::filesystem;
+
+static constexpr opts::option snapdiff_options[] {
+  { "old", 'a', opts::arg::string, "Path of the earlier snapshot, from sizerank --snapshot" },
+  { "new", 'b', opts::arg::string, "Path of the later snapshot" },
+  { "top", 'n', opts::arg::unsigned_int, "Number of top changes to rank, default=10" },
+  { "rank", 'k', opts::arg::string, "Ranks by growth in bytes, growth in percent, or bytes changed either way, format: growth|rel|absdelta, default=growth" },
+};
+
+opts::table action::snapdiff_options_desc() {
+  return { "SNAPDIFF OPTIONS", snapdiff_options };
+}
+
+std::string action::snapdiff_help_msg() {
+  return opts::help_msg(snapdiff_options_desc());
+}
+
+static
+fileutil::snapdiff_config parse_config(opts::parsed const &var_map, std::vector<std::string> &errors) {
+  using util::get_required_option;
+  using util::get_nonrequired_option;
+
+  fileutil::snapdiff_config cfg{};
+
+  {
+    auto old_path = get_required_option<std::string>("old", "a", var_map, errors);
+
+    if (old_path.has_value()) {
+      if (!fs::is_regular_file(old_path.value())) {
+        errors.emplace_back("(--old, -a) file not found");
+      } else {
+        cfg.old_path = std::move(old_path.value());
+      }
+    }
+  }
+  {
+    auto new_path = get_required_option<std::string>("new", "b", var_map, errors);
+
+    if (new_path.has_value()) {
+      if (!fs::is_regular_file(new_path.value())) {
+        errors.emplace_back("(--new, -b) file not found");
+      } else {
+        cfg.new_path = std::move(new_path.value());
+      }
+    }
+  }
+  {
+    auto top_n = get_nonrequired_option<size_t>("top", "n", var_map, errors);
+    cfg.top_n = top_n.value_or(10);
+  }
+  {
+    auto const rank = get_nonrequired_option<std::string>("rank", "k", var_map, errors).value_or("growth");
+
+    if (rank == "growth") {
+      cfg.rank = fileutil::change_rank::growth;
+    } else if (rank == "rel") {
+      cfg.rank = fileutil::change_rank::relative_growth;
+    } else if (rank == "absdelta") {
+      cfg.rank = fileutil::change_rank::abs_delta;
+    } else {
+      errors.emplace_back("(--rank, -k) format must be growth, rel or absdelta");
+    }
+  }
+
+  return cfg;
+}
+
+namespace {
+
+  using fileutil::change_rank;
+  using fileutil::size_change;
+
+  double abs_delta(size_change const &change) {
+    return std::abs(static_cast<double>(change.new_size) - static_cast<double>(change.old_size));
+  }
+
+  // Higher rank first, ties broken by the bigger change in bytes then by path.
+  bool ranks_higher(size_change const &lhs, size_change const &rhs) {
+    if (lhs.rank != rhs.rank)
+      return lhs.rank > rhs.rank;
+    if (abs_delta(lhs) != abs_delta(rhs))
+      return abs_delta(lhs) > abs_delta(rhs);
+    return lhs.path < rhs.path;
+  }
+
+  void print_signed_size(sink::base &out, uintmax_t const from, uintmax_t const to) {
+    char size_buf[util::max_file_size_len];
+    out << (to >= from ? '+' : '-') << util::format_file_size(to >= from ? to - from : from - to, size_buf);
+  }
+
+} // namespace
+
+fileutil::snapdiff_result fileutil::snapdiff(snapdiff_config const &cfg, std::stop_token const stop) {
+  snapdiff_result result{};
+
+  // the top N changes so far as a min-heap, so the lowest ranked is evicted first
+  std::vector<size_change> &top_changes = result.top_changes;
+  top_changes.reserve(cfg.top_n + 1);
+
+  auto const consider = [&](std::string const &path, uintmax_t const old_size, uintmax_t const new_size,
+                            bool const added, bool const deleted) {
+    double const growth = static_cast<double>(new_size) - static_cast<double>(old_size);
+    double rank = growth;
+    if (cfg.rank == change_rank::relative_growth) {
+      rank = old_size == 0 ? std::numeric_limits<double>::infinity() : growth / static_cast<double>(old_size);
+    } else if (cfg.rank == change_rank::abs_delta) {
+      rank = std::abs(growth);
+    }
+
+    if (cfg.top_n == 0) {
+      return;
+    }
+    if (top_changes.size() == cfg.top_n && rank < top_changes.front().rank) {
+      // quick reject, without copying the path
+      return;
+    }
+
+    top_changes.push_back({ path, old_size, new_size, added, deleted, rank });
+    std::push_heap(top_changes.begin(), top_changes.end(), ranks_higher);
+    if (top_changes.size() > cfg.top_n) {
+      std::pop_heap(top_changes.begin(), top_changes.end(), ranks_higher);
+      top_changes.pop_back();
+    }
+  };
+
+  // merge-join, both snapshots are sorted by path so this holds one row of each in memory
+  snapshot::reader old_snapshot(cfg.old_path);
+  snapshot::reader new_snapshot(cfg.new_path);
+  snapshot::row old_row{}, new_row{};
+  bool has_old = old_snapshot.next(old_row);
+  bool has_new = new_snapshot.next(new_row);
+
+  for (size_t num_rows = 0; has_old || has_new; ++num_rows) {
+    if (num_rows % 4096 == 0 && stop.stop_requested()) {
+      result.cancelled = true;
+      break;
+    }
+
+    int const cmp = !has_old ? 1 : !has_new ? -1 : old_row.path.compare(new_row.path);
+
+    if (cmp < 0) {
+      ++result.num_deleted;
+      result.bytes_before += old_row.size;
+      consider(old_row.path, old_row.size, 0, false, true);
+      has_old = old_snapshot.next(old_row);
+    } else if (cmp > 0) {
+      ++result.num_added;
+      result.bytes_after += new_row.size;
+      consider(new_row.path, 0, new_row.size, true, false);
+      has_new = new_snapshot.next(new_row);
+    } else {
+      result.bytes_before += old_row.size;
+      result.bytes_after += new_row.size;
+      if (new_row.size != old_row.size) {
+        if (new_row.size > old_row.size)
+          ++result.num_grown;
+        else
+          ++result.num_shrunk;
+        consider(new_row.path, old_row.size, new_row.size, false, false);
+      }
+      has_old = old_snapshot.next(old_row);
+      has_new = new_snapshot.next(new_row);
+    }
+  }
+
+  std::sort_heap(top_changes.begin(), top_changes.end(), ranks_higher);
+  return result;
+}
+
+bool action::snapdiff_perform(int const argc, char const *const *const argv, sink::base &out) {
+  opts::parsed var_map;
+  try {
+    var_map = opts::parse(action::snapdiff_options_desc(), argc, argv);
+  } catch (std::exception const &err) {
+    out << err.what() << '\n';
+    return false;
+  }
+
+  std::vector<std::string> errors{};
+  fileutil::snapdiff_config const cfg = parse_config(var_map, errors);
+  if (!errors.empty()) {
+    for (auto const &err : errors)
+      out << err << '\n';
+    return false;
+  }
+
+  fileutil::snapdiff_result result{};
+  try {
+    result = fileutil::snapdiff(cfg);
+  } catch (std::exception const &except) {
+    out << except.what() << '\n';
+    return false;
+  }
+
+  if (result.num_grown + result.num_shrunk + result.num_added + result.num_deleted == 0) {
+    out << "No size changes";
+    return true;
+  }
+
+  for (size_t i = 0; i < result.top_changes.size(); ++i) {
+    auto const &change = result.top_changes[i];
+
+    out << (i + 1) << ". " << '(';
+    print_signed_size(out, change.old_size, change.new_size);
+
+    if (change.added) {
+      out << ", new";
+    } else if (change.deleted) {
+      out << ", deleted";
+    } else if (change.old_size == 0) {
+      out << ", was empty";
+    } else {
+      double const percent = std::abs(static_cast<double>(change.new_size) - static_cast<double>(change.old_size))
+        / static_cast<double>(change.old_size) * 100;
+      out << ", " << (change.new_size > change.old_size ? '+' : '-') << std::llround(percent) << '%';
+    }
+
+    out << ") " << change.path << '\n';
+  }
+
+  out
+    << '\n'
+    << result.num_grown << " grown, " << result.num_shrunk << " shrunk, "
+    << result.num_added << " new, " << result.num_deleted << " deleted, ";
+  print_signed_size(out, result.bytes_before, result.bytes_after);
+  out << " in total\n";
+
+  return true;
+}
@@ -0,0 +1,261 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+#include <utility>
+
+#include "snapshot.hpp"
+
+namespace fs = std::filesystem;
+using snapshot::row;
+
+namespace {
+
+  char const magic[] = "fileutil-snapshot 1\n";
+
+  // Writes rows, which must come in ascending order of path, in the snapshot format.
+  class encoder {
+  public:
+    explicit encoder(fs::path const &path)
+      : m_path(path)
+      , m_file(path, std::ios::binary | std::ios::out | std::ios::trunc)
+    {
+      if (!m_file.is_open()) {
+        throw std::runtime_error("unable to open file '" + path.string() + "'");
+      }
+      m_file.write(magic, sizeof(magic) - 1);
+    }
+
+    void put(row const &r) {
+      size_t const max_shared = std::min(m_prev_path.size(), r.path.size());
+      size_t const shared = static_cast<size_t>(std::mismatch(
+        m_prev_path.begin(), m_prev_path.begin() + static_cast<std::ptrdiff_t>(max_shared),
+        r.path.begin()).first - m_prev_path.begin());
+
+      write_varint(shared);
+      write_varint(r.path.size() - shared);
+      m_file.write(r.path.data() + shared, static_cast<std::streamsize>(r.path.size() - shared));
+      write_varint(r.size);
+
+      m_prev_path.resize(shared);
+      m_prev_path.append(r.path, shared);
+    }
+
+    void close() {
+      m_file.close();
+      if (m_file.fail()) {
+        throw std::runtime_error("unable to write file '" + m_path.string() + "'");
+      }
+    }
+
+  private:
+    void write_varint(uint64_t value) {
+      char bytes[10];
+      size_t len = 0;
+      while (value >= 0x80) {
+        bytes[len++] = static_cast<char>((value & 0x7f) | 0x80);
+        value >>= 7;
+      }
+      bytes[len++] = static_cast<char>(value);
+      m_file.write(bytes, static_cast<std::streamsize>(len));
+    }
+
+    fs::path const m_path;
+    std::ofstream m_file;
+    std::string m_prev_path{};
+  };
+
+  bool path_less(row const &lhs, row const &rhs) {
+    return lhs.path < rhs.path;
+  }
+
+  // Sorts `rows` and writes them to `path` as a run.
+  void write_run(std::vector<row> &rows, fs::path const &path) {
+    std::sort(rows.begin(), rows.end(), path_less);
+
+    encoder run(path);
+    for (auto const &r : rows) {
+      run.put(r);
+    }
+    run.close();
+  }
+
+} // namespace
+
+snapshot::writer::writer(fs::path path, size_t const max_buffered_bytes)
+  : m_path(std::move(path))
+  , m_max_buffered_bytes(max_buffered_bytes)
+{}
+
+snapshot::writer::~writer() {
+  // only left behind if finish() wasn't reached or threw
+  for (auto const &run_path : m_run_paths) {
+    std::error_code ec{};
+    fs::remove(run_path, ec);
+  }
+}
+
+void snapshot::writer::add(std::string path, uintmax_t const size) {
+  std::vector<row> full_rows{};
+  fs::path run_path{};
+  {
+    std::lock_guard<std::mutex> const lock(m_mutex);
+
+    if (m_error) {
+      return;
+    }
+
+    m_buffered_bytes += sizeof(row) + path.size();
+    m_rows.push_back({ std::move(path), size });
+
+    if (m_buffered_bytes <= m_max_buffered_bytes) {
+      return;
+    }
+
+    full_rows = std::exchange(m_rows, {});
+    m_buffered_bytes = 0;
+    run_path = next_run_path();
+  }
+
+  // Sorting and writing a full buffer takes a while, other callers fill the next
+  // one meanwhile. Called from walk threads, which mustn't throw, so keep the
+  // error for finish().
+  try {
+    write_run(full_rows, run_path);
+  } catch (...) {
+    std::lock_guard<std::mutex> const lock(m_mutex);
+    if (!m_error) {
+      m_error = std::current_exception();
+    }
+    m_rows = {};
+  }
+}
+
+fs::path snapshot::writer::next_run_path() {
+  fs::path run_path = m_path;
+  run_path += ".run" + std::to_string(m_run_paths.size());
+  m_run_paths.push_back(run_path);
+  return run_path;
+}
+
+size_t snapshot::writer::finish() {
+  std::lock_guard<std::mutex> const lock(m_mutex);
+
+  if (m_error) {
+    std::rethrow_exception(m_error);
+  }
+
+  if (m_run_paths.empty()) {
+    // everything fit in memory, a single run is the snapshot
+    write_run(m_rows, m_path);
+
+    size_t const num_rows = m_rows.size();
+    m_rows = {};
+    return num_rows;
+  }
+
+  write_run(m_rows, next_run_path());
+  m_rows = {};
+
+  // k-way merge of the runs, holding one row per run in memory
+  std::vector<reader> runs{};
+  std::vector<row> heads(m_run_paths.size());
+  std::vector<size_t> heap{};
+  runs.reserve(m_run_paths.size());
+  heap.reserve(m_run_paths.size());
+
+  for (size_t i = 0; i < m_run_paths.size(); ++i) {
+    runs.emplace_back(m_run_paths[i]);
+    if (runs[i].next(heads[i])) {
+      heap.push_back(i);
+    }
+  }
+
+  // min-heap on the head rows' paths
+  auto const later = [&heads](size_t const lhs, size_t const rhs) {
+    return heads[rhs].path < heads[lhs].path;
+  };
+  std::make_heap(heap.begin(), heap.end(), later);
+
+  size_t num_rows = 0;
+  encoder out(m_path);
+
+  while (!heap.empty()) {
+    std::pop_heap(heap.begin(), heap.end(), later);
+    size_t const run_idx = heap.back();
+
+    out.put(heads[run_idx]);
+    ++num_rows;
+
+    if (runs[run_idx].next(heads[run_idx])) {
+      std::push_heap(heap.begin(), heap.end(), later);
+    } else {
+      heap.pop_back();
+    }
+  }
+  out.close();
+
+  runs.clear();
+  for (auto const &run_path : m_run_paths) {
+    std::error_code ec{};
+    fs::remove(run_path, ec);
+  }
+  m_run_paths.clear();
+
+  return num_rows;
+}
+
+snapshot::reader::reader(fs::path const &path)
+  : m_path(path)
+  , m_file(path, std::ios::binary | std::ios::in)
+{
+  if (!m_file.is_open()) {
+    throw std::runtime_error("unable to open file '" + path.string() + "'");
+  }
+
+  char header[sizeof(magic) - 1];
+  if (!m_file.read(header, sizeof(header)) || std::memcmp(header, magic, sizeof(header)) != 0) {
+    throw std::runtime_error("file '" + path.string() + "' is not a snapshot");
+  }
+}
+
+bool snapshot::reader::next(row &out) {
+  auto *const buf = m_file.rdbuf();
+  if (buf->sgetc() == std::char_traits<char>::eof()) {
+    return false;
+  }
+
+  uint64_t const shared = read_varint();
+  uint64_t const suffix_len = read_varint();
+  if (shared > m_prev_path.size()) {
+    throw std::runtime_error("file '" + m_path.string() + "' is corrupt");
+  }
+
+  m_prev_path.resize(static_cast<size_t>(shared + suffix_len));
+  auto const suffix_read = buf->sgetn(m_prev_path.data() + shared, static_cast<std::streamsize>(suffix_len));
+  if (static_cast<uint64_t>(suffix_read) != suffix_len) {
+    throw std::runtime_error("file '" + m_path.string() + "' is truncated");
+  }
+
+  out.size = static_cast<uintmax_t>(read_varint());
+  out.path = m_prev_path;
+  return true;
+}
+
+uint64_t snapshot::reader::read_varint() {
+  auto *const buf = m_file.rdbuf();
+  uint64_t value = 0;
+
+  for (unsigned shift = 0; shift < 64; shift += 7) {
+    int const byte = buf->sbumpc();
+    if (byte == std::char_traits<char>::eof()) {
+      throw std::runtime_error("file '" + m_path.string() + "' is truncated");
+    }
+    value |= uint64_t(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return value;
+    }
+  }
+
+  throw std::runtime_error("file '" + m_path.string() + "' is corrupt");
+}
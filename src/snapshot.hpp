@@ -0,0 +1,85 @@
+#ifndef SNAPSHOT_HPP
+#define SNAPSHOT_HPP
+
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Compact listing of (path, size) rows sorted by path, written by `sizerank --snapshot`
+// and merge-joined by `snapdiff`.
+//
+// After the magic line "fileutil-snapshot 1\n" comes one record per row, in ascending
+// byte order of path:
+//   varint  length of the prefix shared with the previous row's path
+//   varint  length of the rest of the path
+//   bytes   the rest of the path
+//   varint  size
+// Varints are LEB128. Sorted paths share long prefixes (their directories), so front
+// coding stores most of each path only once.
+namespace snapshot {
+
+struct row {
+  std::string path;
+  uintmax_t size;
+};
+
+// Buffers rows in memory, spilling them as sorted runs to temporary files next to the
+// snapshot whenever the buffer exceeds `max_buffered_bytes`, and merges the runs in
+// finish(). So memory stays bounded however many rows there are, at one buffer
+// filling plus one per add() call spilling.
+class writer {
+public:
+  explicit writer(std::filesystem::path path, size_t max_buffered_bytes = 64 * 1024 * 1024);
+  ~writer();
+
+  writer(writer const &) = delete;
+  writer &operator=(writer const &) = delete;
+
+  // Safe to call concurrently, doesn't throw. The call which fills the buffer
+  // takes it and spills it without the lock, so the others carry on meanwhile.
+  void add(std::string path, uintmax_t size);
+
+  // Writes the snapshot and returns the number of rows in it. Call it once
+  // every add() has returned. Throws std::runtime_error if a file cannot be written.
+  size_t finish();
+
+private:
+  // Reserves the path of the next run, caller holds `m_mutex`.
+  std::filesystem::path next_run_path();
+
+  std::filesystem::path const m_path;
+  size_t const m_max_buffered_bytes;
+
+  std::mutex m_mutex{};
+  std::vector<row> m_rows{};
+  size_t m_buffered_bytes = 0;
+  std::vector<std::filesystem::path> m_run_paths{};
+  // from a spill in add(), rethrown by finish()
+  std::exception_ptr m_error{};
+};
+
+// Reads a snapshot (or a writer's run file) front to back.
+class reader {
+public:
+  // Throws std::runtime_error if `path` cannot be opened or isn't a snapshot.
+  explicit reader(std::filesystem::path const &path);
+
+  // Returns false once all rows were read. Throws std::runtime_error if the file is truncated.
+  bool next(row &out);
+
+private:
+  uint64_t read_varint();
+
+  std::filesystem::path const m_path;
+  std::ifstream m_file;
+  // previous row's path, which the next one is front coded against
+  std::string m_prev_path{};
+};
+
+} // namespace snapshot
+
+#endif // SNAPSHOT_HPP
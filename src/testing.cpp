@@ -1,51 +1,682 @@
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
 #include <iostream>
 #include <fstream>
-
-#include <boost/program_options.hpp>
+#include <random>
+#include <stop_token>
+#include <thread>
 
 #include "action.hpp"
+#include "fileutil.hpp"
+#include "mapped_file.hpp"
 #include "ntest.hpp"
+#include "sink.hpp"
+#include "snapshot.hpp"
+#include "text_file.hpp"
+#include "thread_pool.hpp"
 #include "util.hpp"
 
-namespace bpo = boost::program_options;
 using namespace std;
 
-int main(void) {
+// Runs an action, collecting everything it outputs.
+static
+std::string perform(
+  bool (*const perform_fn)(int, char const *const *, sink::base &),
+  int const argc,
+  char const *const *const argv
+) {
+  sink::memory out{};
+  perform_fn(argc, argv, out);
+  return out.str();
+}
+
+// Registers the benchmarks, as a single case so they don't skew each other.
+static
+void register_benchmarks() {
+  ntest::test("benchmarks", [] {
+    auto const &dir = ntest::scratch_dir();
+
+    {
+      std::string const inpath = (dir / "repeat.binin").string();
+      std::string const outpath = (dir / "repeat.binout").string();
+      {
+        std::string contents(1024 * 1024, '\0');
+        std::mt19937 rng(1);
+        for (char &ch : contents)
+          ch = static_cast<char>(rng());
+        std::ofstream(inpath, std::ios::binary) << contents;
+      }
+      char const *argv[] {
+        "program_name_placeholder",
+        "repeat",
+        "-i", inpath.c_str(),
+        "-n", "16",
+        "-o", outpath.c_str(),
+      };
+      auto const repeat = [&argv]() {
+        perform(action::repeat_perform, (int)util::lengthof(argv), argv);
+      };
+
+      ntest::bench_opts opts = ntest::default_bench_opts();
+      opts.bytes_per_iter = 16 * 1024 * 1024;
+      ntest::bench("repeat 1 MiB x16", repeat, opts);
+
+      opts.cold_files = { inpath };
+      ntest::bench("repeat 1 MiB x16 cold", repeat, opts);
+    }
+
+    {
+      size_t constexpr num_dirs = 20, files_per_dir = 500;
+      for (size_t d = 0; d < num_dirs; ++d) {
+        auto const subdir = dir / "tree" / std::to_string(d);
+        std::filesystem::create_directories(subdir);
+        for (size_t f = 0; f < files_per_dir; ++f)
+          std::ofstream(subdir / std::to_string(f)) << std::string(f % 97, 'x');
+      }
+      std::string const root = (dir / "tree").string();
+
+      ntest::bench_opts opts = ntest::default_bench_opts();
+      opts.items_per_iter = num_dirs * files_per_dir;
+      {
+        char const *argv[] { "program_name_placeholder", "sizerank", "--dir", root.c_str(), "--recurse" };
+        ntest::bench("sizerank 10k files", [&argv]() {
+          perform(action::sizerank_perform, (int)util::lengthof(argv), argv);
+        }, opts);
+      }
+      {
+        char const *argv[] { "program_name_placeholder", "sizerank", "--dir", root.c_str(), "--recurse", "--inodeorder" };
+        ntest::bench("sizerank 10k files inodeorder", [&argv]() {
+          perform(action::sizerank_perform, (int)util::lengthof(argv), argv);
+        }, opts);
+      }
+    }
+
+    {
+      // what scripts invoking sizerank per small directory pay besides process creation
+      std::filesystem::create_directories(dir / "empty");
+      std::string const empty = (dir / "empty").string();
+      char const *argv[] {
+        "program_name_placeholder", "sizerank", "-d", empty.c_str(), "-rn", "20", "--sizelim", "1,4096", "--time=atime",
+      };
+      ntest::bench("sizerank startup", [&argv]() {
+        perform(action::sizerank_perform, (int)util::lengthof(argv), argv);
+      });
+
+      size_t num_found = 0;
+      ntest::bench("sizerank option parsing", [&]() {
+        num_found += opts::parse(action::sizerank_options_desc(), (int)util::lengthof(argv), argv).count("recurse");
+      });
+      ntest::assert_bool(true, num_found > 0);
+    }
+
+    {
+      // what scheduling costs per task, with every worker stealing from the others
+      size_t constexpr num_tasks = 10'000;
+      ntest::bench_opts opts = ntest::default_bench_opts();
+      opts.items_per_iter = num_tasks;
+      std::atomic<size_t> num_run = 0;
+      ntest::bench("thread_pool 10k tasks", [&]() {
+        util::task_group group{};
+        for (size_t i = 0; i < num_tasks; ++i)
+          group.run([&num_run]() { num_run.fetch_add(1, std::memory_order_relaxed); });
+        group.wait();
+      }, opts);
+      ntest::assert_bool(true, num_run.load() % num_tasks == 0);
+    }
+
+    {
+      std::vector<uintmax_t> sizes(1000);
+      std::mt19937_64 rng(1);
+      for (auto &size : sizes)
+        size = rng() >> (rng() % 64);
+
+      ntest::bench_opts opts = ntest::default_bench_opts();
+      opts.items_per_iter = sizes.size();
+      size_t total_len = 0;
+      ntest::bench("format_file_size", [&]() {
+        char buf[util::max_file_size_len];
+        for (auto const size : sizes)
+          total_len += util::format_file_size(size, buf).size();
+      }, opts);
+      ntest::assert_bool(true, total_len > 0);
+    }
+
+    {
+      // a CRLF every 41 chars, like short lines of text
+      std::string text(4 * 1024 * 1024, 'x');
+      for (size_t i = 39; i + 1 < text.size(); i += 41) {
+        text[i] = '\r';
+        text[i + 1] = '\n';
+      }
+      std::string buf(text.size(), '\0');
+
+      ntest::bench_opts opts = ntest::default_bench_opts();
+      opts.bytes_per_iter = text.size();
+      ntest::bench("strip_carriage_returns 4 MiB", [&]() {
+        util::strip_carriage_returns(buf.data(), text.data(), text.size(), util::cr_removal::crlf);
+      }, opts);
+    }
+
+    {
+      // big enough that reading and stripping the blocks is all that counts, not setup
+      auto const path = dir / "crlf.txt";
+      uint64_t constexpr file_size = uint64_t(2) * 1024 * 1024 * 1024;
+      {
+        std::string block(4 * 1024 * 1024, 'x');
+        for (size_t i = 39; i + 1 < block.size(); i += 41) {
+          block[i] = '\r';
+          block[i + 1] = '\n';
+        }
+        std::ofstream file(path, std::ios::binary);
+        for (uint64_t written = 0; written < file_size; written += block.size())
+          file.write(block.data(), static_cast<std::streamsize>(block.size()));
+      }
+
+      ntest::bench_opts opts = ntest::default_bench_opts();
+      opts.min_samples = 3;
+      opts.min_seconds = 0;
+      opts.bytes_per_iter = file_size;
+      uint64_t total_len = 0;
+      auto const load = [&]() {
+        total_len += util::load_text_file(path, util::cr_removal::crlf).size();
+      };
+      ntest::bench("load_text_file 2 GiB CRLF", load, opts);
+
+      opts.cold_files = { path };
+      ntest::bench("load_text_file 2 GiB CRLF cold", load, opts);
+      ntest::assert_bool(true, total_len > 0);
+
+      // a failed case keeps its scratch dir, don't leave 2 GiB behind in it
+      std::filesystem::remove(path);
+    }
+  });
+}
+
+int main(int const argc, char const *const *const argv) {
   ntest::init();
+
+  // --bench also runs the benchmarks, comparing them to fileutil.bench.baseline if it
+  // exists; copy a fileutil.bench.csv over it to make that the new baseline.
+  // --jsonl=<path> and --junit=<path> stream the results there too, for CI.
+  bool benchmark = false;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view const arg = argv[i];
+    if (arg == "--bench") {
+      benchmark = true;
+    } else if (arg.starts_with("--jsonl=")) {
+      ntest::stream_report(argv[i] + std::strlen("--jsonl="), ntest::stream_format::json_lines);
+    } else if (arg.starts_with("--junit=")) {
+      ntest::stream_report(argv[i] + std::strlen("--junit="), ntest::stream_format::junit_xml);
+    } else {
+      std::cerr << "unknown option " << arg << '\n';
+      return 1;
+    }
+  }
+
   ntest::config::set_max_arr_preview_len(2);
   ntest::config::set_max_str_preview_len(10);
 
-  // repeat
-  {
-    {
+  ntest::test("repeat missing options", [] {
+    char const *argv[] {
+      "program_name_placeholder",
+      "repeat",
+    };
+    std::string const out = perform(action::repeat_perform, (int)util::lengthof(argv), argv);
+    ntest::assert_cstr(
+      (
+        "(--inpath, -i) required option missing\n"
+        "(--outpath, -o) required option missing\n"
+        "(--repeats, -n) required option missing\n"
+      ),
+      out.c_str()
+    );
+  });
+
+  ntest::test("repeat invalid options", [] {
+    char const *argv[] {
+      "program_name_placeholder",
+      "repeat",
+      "-i", "does_not_exist",
+      "-n", "0",
+      "-o", "bad_dir/out.bin",
+    };
+    std::string const out = perform(action::repeat_perform, (int)util::lengthof(argv), argv);
+    ntest::assert_cstr(
+      (
+        "(--inpath, -i) file not found\n"
+        "(--outpath, -o) file cannot be opened\n"
+        "(--repeats, -n) value must be > 0\n"
+      ),
+      out.c_str()
+    );
+  });
+
+  ntest::test("repeat copy", [] {
+    std::string const outpath = (ntest::scratch_dir() / "copy.binout").string();
+    char const *argv[] {
+      "program_name_placeholder",
+      "repeat",
+      "-i", "repeat/copy.binin",
+      "-n", "1",
+      "-o", outpath.c_str(),
+    };
+    std::string const out = perform(action::repeat_perform, (int)util::lengthof(argv), argv);
+    ntest::assert_stdstr("Successfully repeated \"repeat/copy.binin\" 1 times as \"" + outpath + "\"\n", out);
+    ntest::assert_binary_file("repeat/copy.expectedbinout", outpath);
+  });
+
+  ntest::test("repeat double", [] {
+    std::string const outpath = (ntest::scratch_dir() / "double.binout").string();
+    char const *argv[] {
+      "program_name_placeholder",
+      "repeat",
+      "-i", "repeat/double.binin",
+      "-n", "2",
+      "-o", outpath.c_str(),
+    };
+    std::string const out = perform(action::repeat_perform, (int)util::lengthof(argv), argv);
+    ntest::assert_stdstr("Successfully repeated \"repeat/double.binin\" 2 times as \"" + outpath + "\"\n", out);
+    ntest::assert_binary_file("repeat/double.expectedbinout", outpath);
+  });
+
+  ntest::test("repeat triple", [] {
+    std::string const outpath = (ntest::scratch_dir() / "triple.binout").string();
+    char const *argv[] {
+      "program_name_placeholder",
+      "repeat",
+      "-i", "repeat/triple.binin",
+      "-n", "3",
+      "-o", outpath.c_str(),
+    };
+    std::string const out = perform(action::repeat_perform, (int)util::lengthof(argv), argv);
+    ntest::assert_stdstr("Successfully repeated \"repeat/triple.binin\" 3 times as \"" + outpath + "\"\n", out);
+    ntest::assert_binary_file("repeat/triple.expectedbinout", outpath);
+  });
+
+  ntest::test("repeat quad", [] {
+    std::string const outpath = (ntest::scratch_dir() / "quad.binout").string();
+    char const *argv[] {
+      "program_name_placeholder",
+      "repeat",
+      "-i", "repeat/quad.binin",
+      "-n", "4",
+      "-o", outpath.c_str(),
+    };
+    std::string const out = perform(action::repeat_perform, (int)util::lengthof(argv), argv);
+    ntest::assert_stdstr("Successfully repeated \"repeat/quad.binin\" 4 times as \"" + outpath + "\"\n", out);
+    ntest::assert_binary_file("repeat/quad.expectedbinout", outpath);
+    // 16 byte chunks, so the digest has several
+    ntest::assert_binary_file_digest("repeat/quad.expectedbinout.digest", outpath);
+  });
+
+  ntest::test("sizerank invalid options", [] {
+    char const *argv[] {
+      "program_name_placeholder",
+      "sizerank",
+      "--dir", "does_not_exist",
+      "--sizelim", "3,2",
+      "--pattern", "*",
+      "--outpath", "bad_dir/out.txt",
+    };
+    std::string const out = perform(action::sizerank_perform, (int)util::lengthof(argv), argv);
+    ntest::assert_cstr(
+      (
+        "(--pattern, -p) is not a invalid regular expression\n"
+        "(--dir, -d) is not a directory\n"
+        "(--outpath, -o) cannot be opened\n"
+        "(--sizelim, -s) max(rhs) must be >= min(lhs)\n"
+      ),
+      out.c_str()
+    );
+  });
+
+  ntest::test("sizerank", [] {
+    char const *argv[] {
+      "program_name_placeholder",
+      "sizerank",
+      "--dir", "sizerank",
+    };
+    std::string const out = perform(action::sizerank_perform, (int)util::lengthof(argv), argv);
+    ntest::assert_cstr(
+      (
+        "1. (13 B) 13byte\n"
+        "2. (12 B) _12byte\n"
+        "3. (11 B) __11byte\n"
+        "4. (10 B) _10byte\n"
+        "5. (9 B) __9byte\n"
+        "6. (8 B) _8byte\n"
+        "7. (7 B) _7byte\n"
+        "8. (6 B) _6byte\n"
+        "9. (5 B) __5byte\n"
+        "10. (4 B) __4byte\n"
+      ),
+      out.c_str()
+    );
+  });
+
+  ntest::test("sizerank recurse top sizelim pattern", [] {
+    char const *argv[] {
+      "program_name_placeholder",
+      "sizerank",
+      "--dir", "sizerank",
+      "--recurse",
+      "--top", "4",
+      "--sizelim", "3,7",
+      "--pattern", "_[0-9]+byte",
+    };
+    std::string const out = perform(action::sizerank_perform, (int)util::lengthof(argv), argv);
+    ntest::assert_cstr(
+      (
+        "1. (7 B) _7byte\n"
+        "2. (6 B) _6byte\n"
+        "3. (4 B) subdir\\_4byte\n"
+        "4. (3 B) _3byte\n"
+      ),
+      out.c_str()
+    );
+  });
+
+  ntest::test("sizerank inodeorder", [] {
+    char const *argv[] {
+      "program_name_placeholder",
+      "sizerank",
+      "--dir", "sizerank",
+      "--top", "3",
+      "--inodeorder",
+    };
+    std::string const out = perform(action::sizerank_perform, (int)util::lengthof(argv), argv);
+    ntest::assert_cstr(
+      (
+        "1. (13 B) 13byte\n"
+        "2. (12 B) _12byte\n"
+        "3. (11 B) __11byte\n"
+      ),
+      out.c_str()
+    );
+  });
+
+  ntest::test("sizerank histogram", [] {
+    char const *argv[] {
+      "program_name_placeholder",
+      "sizerank",
+      "--dir", "sizerank",
+      "--top", "2",
+      "--histogram",
+    };
+    std::string const out = perform(action::sizerank_perform, (int)util::lengthof(argv), argv);
+    ntest::assert_cstr(
+      (
+        "1. (13 B) 13byte\n"
+        "2. (12 B) _12byte\n"
+        "\n"
+        "13 files found\n"
+        "size histogram, 13 files, 91 B total\n"
+        "[1 B, 1 B]                        1          1 B  ######\n"
+        "[2 B, 3 B]                        2          5 B  #############\n"
+        "[4 B, 7 B]                        4         22 B  ##########################\n"
+        "[8 B, 15 B]                       6         63 B  ########################################\n"
+        "p50 ~7 B, p90 ~12 B, p99 ~13 B\n"
+      ),
+      out.c_str()
+    );
+  });
+
+  ntest::test("sizerank histogram csv", [] {
+    char const *argv[] {
+      "program_name_placeholder",
+      "sizerank",
+      "--dir", "sizerank",
+      "--top", "1",
+      "--recurse",
+      "--histogram=csv",
+    };
+    std::string const out = perform(action::sizerank_perform, (int)util::lengthof(argv), argv);
+    ntest::assert_cstr(
+      (
+        "1. (13 B) 13byte\n"
+        "\n"
+        "15 files found\n"
+        "bucket_min,bucket_max,count,bytes\n"
+        "1,1,1,1\n"
+        "2,3,3,8\n"
+        "4,7,5,26\n"
+        "8,15,6,63\n"
+        "percentile,size\n"
+        "p50,6\n"
+        "p90,12\n"
+        "p99,13\n"
+      ),
+      out.c_str()
+    );
+  });
+
+  ntest::test("sizerank invalid budget and sample", [] {
+    char const *argv[] {
+      "program_name_placeholder",
+      "sizerank",
+      "--dir", "sizerank",
+      "--budget", "0",
+      "--sample", "1.5",
+    };
+    std::string const out = perform(action::sizerank_perform, (int)util::lengthof(argv), argv);
+    ntest::assert_cstr(
+      (
+        "(--budget, -b) value must be > 0\n"
+        "(--sample, -f) value must be in range (0, 1]\n"
+      ),
+      out.c_str()
+    );
+  });
+
+  ntest::test("sizerank partial snapshot", [] {
+    // snapdiff would read the files sampling or the budget leave out as deleted
+    std::string const snap = (ntest::scratch_dir() / "partial.snap").string();
+    for (char const *const partial : { "--sample", "--budget" }) {
       char const *argv[] {
         "program_name_placeholder",
-        "repeat",
+        "sizerank",
+        "--dir", "sizerank",
+        "--snapshot", snap.c_str(),
+        partial, "0.5",
       };
-      std::string const out = action::repeat_perform((int)util::lengthof(argv), argv);
-      ntest::assert_cstr(
-        (
-          "(--inpath, -i) required option missing\n"
-          "(--outpath, -o) required option missing\n"
-          "(--repeats, -n) required option missing\n"
-        ),
-        out.c_str()
-      );
+      std::string const out = perform(action::sizerank_perform, (int)util::lengthof(argv), argv);
+      ntest::assert_cstr("(--snapshot, -S) cannot be combined with --sample or --budget\n", out.c_str());
     }
+    ntest::assert_bool(false, std::filesystem::exists(snap));
+  });
+
+  ntest::test("sizerank no matches snapshot", [] {
+    // the snapshot records every file whatever the filters, so it's still reported
+    std::string const snap = (ntest::scratch_dir() / "unmatched.snap").string();
+    char const *argv[] {
+      "program_name_placeholder",
+      "sizerank",
+      "--dir", "sizerank",
+      "--pattern", "no_such_file",
+      "--snapshot", snap.c_str(),
+    };
+    std::string const out = perform(action::sizerank_perform, (int)util::lengthof(argv), argv);
+    ntest::assert_stdstr("No size and/or pattern matches\n\nsnapshot of 13 files saved to " + snap + '\n', out);
+  });
+
+  ntest::test("sizerank snapshot kept on error", [] {
+    // a run which fails leaves the previous snapshot as it was
+    std::string const snap = (ntest::scratch_dir() / "old.snap").string();
+    std::ofstream(snap, std::ios::binary) << "previous snapshot";
+    char const *argv[] {
+      "program_name_placeholder",
+      "sizerank",
+      "--dir", "does_not_exist",
+      "--snapshot", snap.c_str(),
+    };
+    std::string const out = perform(action::sizerank_perform, (int)util::lengthof(argv), argv);
+    ntest::assert_cstr("(--dir, -d) is not a directory\n", out.c_str());
+    ntest::assert_uint64(17, std::filesystem::file_size(snap));
+
+    char const *bad_dir_argv[] {
+      "program_name_placeholder",
+      "sizerank",
+      "--dir", "sizerank",
+      "--snapshot", "does_not_exist/new.snap",
+    };
+    std::string const bad_dir_out = perform(action::sizerank_perform, (int)util::lengthof(bad_dir_argv), bad_dir_argv);
+    ntest::assert_cstr("(--snapshot, -S) cannot be opened\n", bad_dir_out.c_str());
+  });
+
+  ntest::test("sizerank sample", [] {
+    // without --recurse there are no subdirectories to sample, so the estimate is exact
+    char const *argv[] {
+      "program_name_placeholder",
+      "sizerank",
+      "--dir", "sizerank",
+      "--top", "2",
+      "--sample", "0.5",
+      "--seed", "7",
+    };
+    std::string const out = perform(action::sizerank_perform, (int)util::lengthof(argv), argv);
+    ntest::assert_cstr(
+      (
+        "APPROXIMATE RESULTS (sampled 50% of subdirectories)\n"
+        "visited 1 directories, skipped 0\n"
+        "estimated total: 13 files (95% CI 13 - 13), 91 B (95% CI 91 B - 91 B)\n"
+        "\n"
+        "1. (13 B) 13byte\n"
+        "2. (12 B) _12byte\n"
+      ),
+      out.c_str()
+    );
+  });
+
+  ntest::test("sizerank multiple dirs", [] {
+    char const *argv[] {
+      "program_name_placeholder",
+      "sizerank",
+      "--dir", "sizerank/subdir",
+      "--dir", "sizerank",
+      "--pattern", "_4byte|13byte|__11byte",
+      "--devthreads", "2",
+    };
+    std::string const out = perform(action::sizerank_perform, (int)util::lengthof(argv), argv);
+    ntest::assert_cstr(
+      (
+        "1. (13 B) [sizerank] 13byte\n"
+        "2. (11 B) [sizerank] __11byte\n"
+        "3. (4 B) [sizerank/subdir] _4byte\n"
+      ),
+      out.c_str()
+    );
+  });
+
+  ntest::test("sizerank invalid dirs and devthreads", [] {
+    char const *argv[] {
+      "program_name_placeholder",
+      "sizerank",
+      "--dir", "sizerank",
+      "--dir", "does_not_exist",
+      "--devthreads", "0",
+    };
+    std::string const out = perform(action::sizerank_perform, (int)util::lengthof(argv), argv);
+    ntest::assert_cstr(
+      (
+        "(--dir, -d) is not a directory\n"
+        "(--devthreads, -w) value must be > 0\n"
+      ),
+      out.c_str()
+    );
+  });
+
+  ntest::test("sizerank invalid time filters", [] {
+    char const *argv[] {
+      "program_name_placeholder",
+      "sizerank",
+      "--dir", "sizerank",
+      "--time", "ctime",
+      "--older-than", "5x",
+      "--newer-than", "1d",
+    };
+    std::string const out = perform(action::sizerank_perform, (int)util::lengthof(argv), argv);
+    ntest::assert_cstr(
+      (
+        "(--time, -t) must be atime, mtime or btime\n"
+        "(--older-than, -O) must be <N>s|m|h|d|w|y\n"
+      ),
+      out.c_str()
+    );
+  });
+
+  ntest::test("sizerank time filters out of order", [] {
+    char const *argv[] {
+      "program_name_placeholder",
+      "sizerank",
+      "--dir", "sizerank",
+      "--older-than", "2w",
+      "--newer-than", "14d",
+    };
+    std::string const out = perform(action::sizerank_perform, (int)util::lengthof(argv), argv);
+    ntest::assert_cstr("(--newer-than, -N) must be longer than --older-than\n", out.c_str());
+  });
+
+  ntest::test("sizerank invalid progress", [] {
+    char const *argv[] {
+      "program_name_placeholder",
+      "sizerank",
+      "--dir", "sizerank",
+      "--progress", "0",
+      "--progressfiles", "0",
+    };
+    std::string const out = perform(action::sizerank_perform, (int)util::lengthof(argv), argv);
+    ntest::assert_cstr(
+      (
+        "(--progress, -P) value must be > 0\n"
+        "(--progressfiles, -K) value must be > 0\n"
+      ),
+      out.c_str()
+    );
+  });
+
+  ntest::test("sizerank progress", [] {
+    // finishes long before the first report is due, so the output is the final ranking only
+    char const *argv[] {
+      "program_name_placeholder",
+      "sizerank",
+      "--dir", "sizerank",
+      "--top", "2",
+      "--progress", "3600",
+    };
+    std::string const out = perform(action::sizerank_perform, (int)util::lengthof(argv), argv);
+    ntest::assert_cstr(
+      (
+        "1. (13 B) 13byte\n"
+        "2. (12 B) _12byte\n"
+      ),
+      out.c_str()
+    );
+  });
+
+  ntest::test("sizerank time filters and score", [] {
+    // git doesn't keep modification times, so give the files their ages here
+    auto const set_age_days = [](char const *const path, int const days) {
+      std::filesystem::last_write_time(path,
+        std::filesystem::file_time_type::clock::now() - std::chrono::hours(24 * days));
+    };
+    set_age_days("sizerank_age/old_big", 40);
+    set_age_days("sizerank_age/old_small", 400);
+    set_age_days("sizerank_age/new_big", 2);
+
     {
       char const *argv[] {
         "program_name_placeholder",
-        "repeat",
-        "-i", "does_not_exist",
-        "-n", "0",
-        "-o", "bad_dir/out.bin",
+        "sizerank",
+        "--dir", "sizerank_age",
+        "--older-than", "30d",
       };
-      std::string const out = action::repeat_perform((int)util::lengthof(argv), argv);
+      std::string const out = perform(action::sizerank_perform, (int)util::lengthof(argv), argv);
       ntest::assert_cstr(
         (
-          "(--inpath, -i) file not found\n"
-          "(--outpath, -o) file cannot be opened\n"
-          "(--repeats, -n) value must be > 0\n"
+          "1. (10 B) old_big\n"
+          "2. (4 B) old_small\n"
         ),
         out.c_str()
       );
@@ -53,71 +684,159 @@ int main(void) {
     {
       char const *argv[] {
         "program_name_placeholder",
-        "repeat",
-        "-i", "repeat/copy.binin",
-        "-n", "1",
-        "-o", "repeat/copy.binout",
+        "sizerank",
+        "--dir", "sizerank_age",
+        "--newer-than", "1w",
       };
-      std::string const out = action::repeat_perform((int)util::lengthof(argv), argv);
-      ntest::assert_cstr("Successfully repeated \"repeat/copy.binin\" 1 times as \"repeat/copy.binout\"\n", out.c_str());
-      ntest::assert_binary_file("repeat/copy.expectedbinout", "repeat/copy.binout");
+      std::string const out = perform(action::sizerank_perform, (int)util::lengthof(argv), argv);
+      ntest::assert_cstr("1. (20 B) new_big\n", out.c_str());
     }
     {
+      // 4 B x 400 days outranks 20 B x 2 days and 10 B x 40 days
       char const *argv[] {
         "program_name_placeholder",
-        "repeat",
-        "-i", "repeat/double.binin",
-        "-n", "2",
-        "-o", "repeat/double.binout",
+        "sizerank",
+        "--dir", "sizerank_age",
+        "--score",
       };
-      std::string const out = action::repeat_perform((int)util::lengthof(argv), argv);
-      ntest::assert_cstr("Successfully repeated \"repeat/double.binin\" 2 times as \"repeat/double.binout\"\n", out.c_str());
-      ntest::assert_binary_file("repeat/double.expectedbinout", "repeat/double.binout");
+      std::string const out = perform(action::sizerank_perform, (int)util::lengthof(argv), argv);
+      ntest::assert_cstr(
+        (
+          "1. (4 B, 400 days) old_small\n"
+          "2. (10 B, 40 days) old_big\n"
+          "3. (20 B, 2 days) new_big\n"
+        ),
+        out.c_str()
+      );
     }
+  });
+
+  ntest::test("dupes invalid options", [] {
+    char const *argv[] {
+      "program_name_placeholder",
+      "dupes",
+      "--dir", "does_not_exist",
+      "--threads", "0",
+    };
+    std::string const out = perform(action::dupes_perform, (int)util::lengthof(argv), argv);
+    ntest::assert_cstr(
+      (
+        "(--dir, -d) is not a directory\n"
+        "(--threads, -t) value must be > 0\n"
+      ),
+      out.c_str()
+    );
+  });
+
+  ntest::test("dupes", [] {
+    // big1.bin and big3.bin share size and first/last 4 KB, only the full hash tells them apart
+    char const *argv[] {
+      "program_name_placeholder",
+      "dupes",
+      "--dir", "dupes",
+      "--threads", "2",
+    };
+    std::string const out = perform(action::dupes_perform, (int)util::lengthof(argv), argv);
+    ntest::assert_cstr(
+      (
+        "1. (12 B wasted) 2 x 12 B\n"
+        "  a.txt\n"
+        "  b.txt\n"
+        "1 duplicate groups, 12 B wasted in total\n"
+      ),
+      out.c_str()
+    );
+  });
+
+  ntest::test("dupes hard links", [] {
+    // a hard link is another path to the same file, not a copy of it
+    auto const &dir = ntest::scratch_dir();
+    std::ofstream(dir / "b_original.txt") << "hard linked\n";
+    std::filesystem::create_hard_link(dir / "b_original.txt", dir / "a_link.txt");
+    std::ofstream(dir / "c_copy.txt") << "hard linked\n";
+    std::ofstream(dir / "lonely.txt") << "linked, never copied\n";
+    std::filesystem::create_hard_link(dir / "lonely.txt", dir / "lonely_link.txt");
+
+    std::string const dir_str = dir.string();
+    char const *argv[] {
+      "program_name_placeholder",
+      "dupes",
+      "--dir", dir_str.c_str(),
+    };
+    std::string const out = perform(action::dupes_perform, (int)util::lengthof(argv), argv);
+    ntest::assert_cstr(
+      (
+        "1. (12 B wasted) 2 x 12 B\n"
+        "  a_link.txt\n"
+        "  c_copy.txt\n"
+        "1 duplicate groups, 12 B wasted in total\n"
+      ),
+      out.c_str()
+    );
+  });
+
+  ntest::test("snapdiff invalid options", [] {
+    char const *argv[] {
+      "program_name_placeholder",
+      "snapdiff",
+      "--old", "does_not_exist",
+      "--rank", "pct",
+    };
+    std::string const out = perform(action::snapdiff_perform, (int)util::lengthof(argv), argv);
+    ntest::assert_cstr(
+      (
+        "(--old, -a) file not found\n"
+        "(--new, -b) required option missing\n"
+        "(--rank, -k) format must be growth, rel or absdelta\n"
+      ),
+      out.c_str()
+    );
+  });
+
+  ntest::test("snapdiff", [] {
+    std::string const
+      old_snap = (ntest::scratch_dir() / "old.snap").string(),
+      new_snap = (ntest::scratch_dir() / "new.snap").string();
     {
       char const *argv[] {
         "program_name_placeholder",
-        "repeat",
-        "-i", "repeat/triple.binin",
-        "-n", "3",
-        "-o", "repeat/triple.binout",
+        "sizerank",
+        "--dir", "snapdiff/old",
+        "--recurse",
+        "--top", "1",
+        "--snapshot", old_snap.c_str(),
       };
-      std::string const out = action::repeat_perform((int)util::lengthof(argv), argv);
-      ntest::assert_cstr("Successfully repeated \"repeat/triple.binin\" 3 times as \"repeat/triple.binout\"\n", out.c_str());
-      ntest::assert_binary_file("repeat/triple.expectedbinout", "repeat/triple.binout");
+      std::string const out = perform(action::sizerank_perform, (int)util::lengthof(argv), argv);
+      ntest::assert_stdstr("1. (9 B) shrank\n\nsnapshot of 5 files saved to " + old_snap + '\n', out);
     }
     {
       char const *argv[] {
         "program_name_placeholder",
-        "repeat",
-        "-i", "repeat/quad.binin",
-        "-n", "4",
-        "-o", "repeat/quad.binout",
+        "sizerank",
+        "--dir", "snapdiff/new",
+        "--recurse",
+        "--top", "1",
+        "--snapshot", new_snap.c_str(),
       };
-      std::string const out = action::repeat_perform((int)util::lengthof(argv), argv);
-      ntest::assert_cstr("Successfully repeated \"repeat/quad.binin\" 4 times as \"repeat/quad.binout\"\n", out.c_str());
-      ntest::assert_binary_file("repeat/quad.expectedbinout", "repeat/quad.binout");
+      std::string const out = perform(action::sizerank_perform, (int)util::lengthof(argv), argv);
+      ntest::assert_stdstr("1. (10 B) grew\n\nsnapshot of 5 files saved to " + new_snap + '\n', out);
     }
-  }
-
-  // sizerank
-  {
     {
       char const *argv[] {
         "program_name_placeholder",
-        "sizerank",
-        "--dir", "does_not_exist",
-        "--sizelim", "3,2",
-        "--pattern", "*",
-        "--outpath", "bad_dir/out.txt",
+        "snapdiff",
+        "--old", old_snap.c_str(),
+        "--new", new_snap.c_str(),
       };
-      std::string const out = action::sizerank_perform((int)util::lengthof(argv), argv);
+      std::string const out = perform(action::snapdiff_perform, (int)util::lengthof(argv), argv);
       ntest::assert_cstr(
         (
-          "(--pattern, -p) is not a invalid regular expression\n"
-          "(--dir, -d) is not a directory\n"
-          "(--outpath, -o) cannot be opened\n"
-          "(--sizelim, -s) max(rhs) must be >= min(lhs)\n"
+          "1. (+8 B, +400%) grew\n"
+          "2. (+4 B, new) added\n"
+          "3. (-5 B, deleted) gone\n"
+          "4. (-6 B, -67%) shrank\n"
+          "\n"
+          "1 grown, 1 shrunk, 1 new, 1 deleted, +1 B in total\n"
         ),
         out.c_str()
       );
@@ -125,22 +844,20 @@ int main(void) {
     {
       char const *argv[] {
         "program_name_placeholder",
-        "sizerank",
-        "--dir", "sizerank",
+        "snapdiff",
+        "--old", old_snap.c_str(),
+        "--new", new_snap.c_str(),
+        "--rank", "absdelta",
       };
-      std::string const out = action::sizerank_perform((int)util::lengthof(argv), argv);
+      std::string const out = perform(action::snapdiff_perform, (int)util::lengthof(argv), argv);
       ntest::assert_cstr(
         (
-          "1. (13 B) 13byte\n"
-          "2. (12 B) _12byte\n"
-          "3. (11 B) __11byte\n"
-          "4. (10 B) _10byte\n"
-          "5. (9 B) __9byte\n"
-          "6. (8 B) _8byte\n"
-          "7. (7 B) _7byte\n"
-          "8. (6 B) _6byte\n"
-          "9. (5 B) __5byte\n"
-          "10. (4 B) __4byte\n"
+          "1. (+8 B, +400%) grew\n"
+          "2. (-6 B, -67%) shrank\n"
+          "3. (-5 B, deleted) gone\n"
+          "4. (+4 B, new) added\n"
+          "\n"
+          "1 grown, 1 shrunk, 1 new, 1 deleted, +1 B in total\n"
         ),
         out.c_str()
       );
@@ -148,27 +865,587 @@ int main(void) {
     {
       char const *argv[] {
         "program_name_placeholder",
-        "sizerank",
-        "--dir", "sizerank",
-        "--recurse",
-        "--top", "4",
-        "--sizelim", "3,7",
-        "--pattern", "_[0-9]+byte",
+        "snapdiff",
+        "--old", old_snap.c_str(),
+        "--new", new_snap.c_str(),
+        "--rank", "rel",
+        "--top", "2",
       };
-      std::string const out = action::sizerank_perform((int)util::lengthof(argv), argv);
+      std::string const out = perform(action::snapdiff_perform, (int)util::lengthof(argv), argv);
       ntest::assert_cstr(
         (
-          "1. (7 B) _7byte\n"
-          "2. (6 B) _6byte\n"
-          "3. (4 B) subdir\\_4byte\n"
-          "4. (3 B) _3byte\n"
+          "1. (+4 B, new) added\n"
+          "2. (+8 B, +400%) grew\n"
+          "\n"
+          "1 grown, 1 shrunk, 1 new, 1 deleted, +1 B in total\n"
         ),
         out.c_str()
       );
     }
-  } // sizerank
+  });
+
+  ntest::test("snapdiff trailing separator", [] {
+    // the same tree given with and without a trailing separator ranks and keys its files the same
+    std::string const
+      plain_snap = (ntest::scratch_dir() / "plain.snap").string(),
+      slash_snap = (ntest::scratch_dir() / "slash.snap").string(),
+      deep = std::filesystem::path("sub/deep").make_preferred().string();
+    for (auto const &[dir, snap] : { std::pair{ "snapdiff/old", &plain_snap }, std::pair{ "snapdiff/old/", &slash_snap } }) {
+      char const *argv[] {
+        "program_name_placeholder",
+        "sizerank",
+        "--dir", dir,
+        "--recurse",
+        "--top", "2",
+        "--snapshot", snap->c_str(),
+      };
+      std::string const out = perform(action::sizerank_perform, (int)util::lengthof(argv), argv);
+      ntest::assert_stdstr(
+        "1. (9 B) shrank\n2. (7 B) " + deep + "\n\nsnapshot of 5 files saved to " + *snap + '\n', out);
+    }
+
+    snapshot::reader reader(slash_snap);
+    snapshot::row row{};
+    std::string rows{};
+    while (reader.next(row)) {
+      rows += row.path + ';';
+    }
+    ntest::assert_stdstr("gone;grew;same;shrank;sub/deep;", rows);
+
+    char const *argv[] {
+      "program_name_placeholder",
+      "snapdiff",
+      "--old", plain_snap.c_str(),
+      "--new", slash_snap.c_str(),
+    };
+    std::string const out = perform(action::snapdiff_perform, (int)util::lengthof(argv), argv);
+    ntest::assert_cstr("No size changes", out.c_str());
+  });
+
+  ntest::test("snapshot spilled runs", [] {
+    // a buffer this small spills every row to its own run, so this exercises the merge
+    auto const path = ntest::scratch_dir() / "spilled.snap";
+    {
+      snapshot::writer writer(path, 1);
+      writer.add("b/y", 2);
+      writer.add("a", 1);
+      writer.add("b/x", 3);
+      ntest::assert_uint64(3, writer.finish());
+    }
+    snapshot::reader reader(path);
+    snapshot::row row{};
+    std::string rows{};
+    while (reader.next(row)) {
+      rows += row.path + '=' + std::to_string(row.size) + ';';
+    }
+    ntest::assert_stdstr("a=1;b/x=3;b/y=2;", rows);
+    ntest::assert_bool(false, std::filesystem::exists(ntest::scratch_dir() / "spilled.snap.run0"));
+  });
+
+  ntest::test("snapshot concurrent spills", [] {
+    // adders spill their full buffers outside the lock, while the others keep adding
+    auto const path = ntest::scratch_dir() / "concurrent.snap";
+    size_t constexpr num_threads = 4, rows_per_thread = 2000;
+    {
+      snapshot::writer writer(path, 4096);
+      std::vector<std::thread> threads{};
+      for (size_t t = 0; t < num_threads; ++t) {
+        threads.emplace_back([&writer, t]() {
+          for (size_t i = 0; i < rows_per_thread; ++i)
+            writer.add(std::to_string(t) + '/' + std::to_string(i), i);
+        });
+      }
+      for (auto &thread : threads)
+        thread.join();
+      ntest::assert_uint64(num_threads * rows_per_thread, writer.finish());
+    }
+    snapshot::reader reader(path);
+    snapshot::row row{};
+    std::string prev_path{};
+    size_t num_rows = 0, num_out_of_order = 0;
+    while (reader.next(row)) {
+      num_out_of_order += num_rows > 0 && !(prev_path < row.path);
+      prev_path = row.path;
+      ++num_rows;
+    }
+    ntest::assert_uint64(num_threads * rows_per_thread, num_rows);
+    ntest::assert_uint64(0, num_out_of_order);
+  });
+
+  ntest::test("cmp identical", [] {
+    char const *argv[] {
+      "program_name_placeholder",
+      "cmp",
+      "--first", "dupes/big1.bin",
+      "--second", "dupes/big1.bin",
+    };
+    std::string const out = perform(action::cmp_perform, (int)util::lengthof(argv), argv);
+    ntest::assert_cstr("identical, 19.53 KB compared\n", out.c_str());
+  });
+
+  ntest::test("cmp first difference", [] {
+    // 1 KiB chunks spread the 20000 bytes over all threads
+    char const *argv[] {
+      "program_name_placeholder",
+      "cmp",
+      "--first", "dupes/big1.bin",
+      "--second", "dupes/big3.bin",
+      "--threads", "4",
+      "--chunk", "1",
+    };
+    std::string const out = perform(action::cmp_perform, (int)util::lengthof(argv), argv);
+    ntest::assert_cstr("first difference at offset 10000: 0xe1 vs 0x1e\n", out.c_str());
+  });
+
+  ntest::test("cmp sizes differ", [] {
+    char const *argv[] {
+      "program_name_placeholder",
+      "cmp",
+      "--first", "dupes/big1.bin",
+      "--second", "dupes/unique.txt",
+    };
+    std::string const out = perform(action::cmp_perform, (int)util::lengthof(argv), argv);
+    ntest::assert_cstr("sizes differ, dupes/big1.bin is 20000 B, dupes/unique.txt is 15 B\n", out.c_str());
+  });
+
+  ntest::test("cmp invalid options", [] {
+    char const *argv[] {
+      "program_name_placeholder",
+      "cmp",
+      "--first", "does_not_exist",
+      "--threads", "0",
+      "--chunk", "18014398509481983",
+    };
+    std::string const out = perform(action::cmp_perform, (int)util::lengthof(argv), argv);
+    ntest::assert_cstr(
+      (
+        "(--first, -a) file not found\n"
+        "(--second, -b) required option missing\n"
+        "(--threads, -t) value must be > 0\n"
+        "(--chunk, -c) value must be <= 1048576\n"
+      ),
+      out.c_str()
+    );
+  });
+
+  ntest::test("cmp huge chunk", [] {
+    // rounding the number of chunks up mustn't overflow to none, leaving nothing compared
+    fileutil::cmp_config const cfg{ "dupes/big1.bin", "dupes/big3.bin", 2, SIZE_MAX };
+    fileutil::cmp_result const result = fileutil::cmp(cfg);
+    ntest::assert_uint64(10000, result.first_difference);
+  });
+
+  ntest::test("batch invalid options", [] {
+    char const *argv[] {
+      "program_name_placeholder",
+      "batch",
+      "--jobs", "0",
+    };
+    std::string const out = perform(action::batch_perform, (int)util::lengthof(argv), argv);
+    ntest::assert_cstr(
+      (
+        "(script) path missing, - for stdin\n"
+        "(--jobs, -j) value must be > 0\n"
+      ),
+      out.c_str()
+    );
+  });
+
+  ntest::test("batch", [] {
+    std::string const script = (ntest::scratch_dir() / "script.txt").string();
+    std::ofstream(script, std::ios::binary)
+      << "# ranks then compares\r\n"
+      << "sizerank --dir sizerank --top 2\r\n"
+      << "  cmp -a dupes/big1.bin -b dupes/big3.bin\n"
+      << "frobnicate\n"
+      << "sizerank --bogus\n"
+      << "wait\n"
+      << "\n"
+      << "fileutil cmp --first \"dupes/a.txt\" --second dupes/b.txt";
+
+    std::string const expected =
+      "[2] sizerank --dir sizerank --top 2\n"
+      "1. (13 B) 13byte\n"
+      "2. (12 B) _12byte\n"
+      "\n"
+      "[3] cmp -a dupes/big1.bin -b dupes/big3.bin\n"
+      "first difference at offset 10000: 0xe1 vs 0x1e\n"
+      "\n"
+      "[4] frobnicate\n"
+      "unknown action \"frobnicate\"\n"
+      "\n"
+      "[5] sizerank --bogus\n"
+      "unrecognised option '--bogus'\n"
+      "\n"
+      "[8] fileutil cmp --first \"dupes/a.txt\" --second dupes/b.txt\n"
+      "identical, 12 B compared\n"
+      "\n"
+      "5 commands, 2 failed\n";
 
-  {
+    // run concurrently, results still come in script order
+    for (char const *const jobs : { "1", "3" }) {
+      char const *argv[] {
+        "program_name_placeholder",
+        "batch",
+        script.c_str(),
+        "--jobs", jobs,
+      };
+      std::string const out = perform(action::batch_perform, (int)util::lengthof(argv), argv);
+      ntest::assert_stdstr(expected, out);
+    }
+  });
+
+  ntest::test("fileutil library", [] {
+    {
+      fileutil::sizerank_config cfg{};
+      cfg.roots = { "sizerank" };
+      cfg.recurse = true;
+      cfg.top_n = 3;
+      cfg.pattern = "_[0-9]+byte";
+      cfg.histogram = true;
+
+      fileutil::sizerank_result const result = fileutil::sizerank(cfg);
+      ntest::assert_uint64(3, result.top_files.size());
+      ntest::assert_stdstr("_12byte", result.top_files[0].path.filename().string());
+      ntest::assert_uint64(12, result.top_files[0].size);
+      ntest::assert_stdstr("_10byte", result.top_files[1].path.filename().string());
+      ntest::assert_uint64(0, result.top_files[2].root_idx);
+      ntest::assert_bool(true, result.complete);
+      ntest::assert_bool(false, result.cancelled);
+      // every file matching the pattern, not just the top 3
+      ntest::assert_uint64(8, result.histogram.total_count);
+      ntest::assert_uint64(52, result.histogram.total_bytes);
+    }
+    {
+      fileutil::dupes_config cfg{};
+      cfg.search_path = "dupes";
+      cfg.num_threads = 2;
+
+      fileutil::dupes_result const result = fileutil::dupes(cfg);
+      ntest::assert_uint64(1, result.groups.size());
+      ntest::assert_stdvec(std::vector<std::string>{ "a.txt", "b.txt" }, result.groups[0].paths);
+      ntest::assert_uint64(12, result.total_wasted_bytes);
+    }
+    {
+      fileutil::cmp_config cfg{};
+      cfg.first_path = "dupes/big1.bin";
+      cfg.second_path = "dupes/big3.bin";
+
+      fileutil::cmp_result const result = fileutil::cmp(cfg);
+      ntest::assert_uint64(10000, result.first_difference);
+      ntest::assert_uint64(0xe1, result.first_byte);
+      ntest::assert_uint64(0x1e, result.second_byte);
+    }
+
+    fileutil::sizerank_config bad{};
+    bad.roots = { "sizerank" };
+    bad.pattern = "(";
+    ntest::assert_throws<std::invalid_argument>([&] { (void)fileutil::sizerank(bad); });
+
+    // nothing to rank, but the files are still counted
+    fileutil::sizerank_config unranked{};
+    unranked.roots = { "sizerank" };
+    unranked.top_n = 0;
+    unranked.histogram = true;
+    {
+      fileutil::sizerank_result const result = fileutil::sizerank(unranked);
+      ntest::assert_bool(true, result.top_files.empty());
+      ntest::assert_uint64(13, result.num_files_found);
+      ntest::assert_uint64(13, result.histogram.total_count);
+    }
+
+    // a snapshot of part of the tree would read as deletions to snapdiff
+    fileutil::sizerank_config partial{};
+    partial.roots = { "sizerank" };
+    partial.snapshot_path = ntest::scratch_dir() / "partial.snap";
+    partial.sample_fraction = 0.5;
+    ntest::assert_throws<std::invalid_argument>([&] { (void)fileutil::sizerank(partial); });
+    partial.sample_fraction = 1;
+    partial.budget_secs = 10;
+    ntest::assert_throws<std::invalid_argument>([&] { (void)fileutil::sizerank(partial); });
+    ntest::assert_bool(false, std::filesystem::exists(partial.snapshot_path));
+
+    fileutil::repeat_config missing{ "does_not_exist", ntest::scratch_dir() / "missing.out", 2 };
+    ntest::assert_throws<std::runtime_error>([&] { (void)fileutil::repeat(missing); });
+  });
+
+  ntest::test("fileutil cancellation", [] {
+    std::stop_source source{};
+    source.request_stop();
+
+    fileutil::sizerank_config rank_cfg{};
+    rank_cfg.roots = { "sizerank" };
+    rank_cfg.recurse = true;
+    rank_cfg.snapshot_path = ntest::scratch_dir() / "cancelled.snap";
+    fileutil::sizerank_result const ranked = fileutil::sizerank(rank_cfg, source.get_token());
+    ntest::assert_bool(true, ranked.cancelled);
+    ntest::assert_bool(false, ranked.complete);
+    ntest::assert_uint64(0, ranked.num_snapshot_rows);
+
+    fileutil::repeat_config repeat_cfg{ "repeat/double.binin", ntest::scratch_dir() / "cancelled.out", 4 };
+    fileutil::repeat_result const repeated = fileutil::repeat(repeat_cfg, source.get_token());
+    ntest::assert_bool(true, repeated.cancelled);
+    ntest::assert_bool(false, std::filesystem::exists(repeat_cfg.out_path));
+
+    fileutil::cmp_config cmp_cfg{ "dupes/big1.bin", "dupes/big3.bin", 2, 1024 };
+    fileutil::cmp_result const compared = fileutil::cmp(cmp_cfg, source.get_token());
+    ntest::assert_bool(true, compared.cancelled);
+    ntest::assert_uint64(SIZE_MAX, compared.first_difference);
+
+    fileutil::dupes_config dupes_cfg{ "dupes", false, false, 2 };
+    ntest::assert_bool(true, fileutil::dupes(dupes_cfg, source.get_token()).groups.empty());
+  });
+
+  ntest::test("thread pool", [] {
+    {
+      // groups nested in tasks, whose waiting workers must run queued tasks or deadlock
+      util::thread_pool pool({ 2, false, -1 });
+      std::atomic<size_t> num_run = 0;
+      util::task_group outer(pool);
+      for (size_t i = 0; i < 1000; ++i) {
+        outer.run([&]() {
+          util::task_group inner(pool);
+          for (size_t j = 0; j < 10; ++j)
+            inner.run([&]() { ++num_run; });
+          inner.wait();
+          ++num_run;
+        });
+      }
+      outer.wait();
+      ntest::assert_uint64(11000, num_run.load());
+    }
+    {
+      util::thread_pool pool({ 1, true, -1 });
+      std::atomic<size_t> num_run = 0;
+
+      util::task_group throwing(pool);
+      throwing.run([]() { throw std::runtime_error("task failed"); });
+      ntest::assert_throws<std::runtime_error>([&] { throwing.wait(); });
+
+      util::task_group cancelled(pool);
+      cancelled.cancel();
+      for (size_t i = 0; i < 100; ++i)
+        cancelled.run([&]() { ++num_run; });
+      cancelled.wait();
+      ntest::assert_uint64(0, num_run.load());
+
+      std::atomic<bool> release = false;
+      util::task_group blocked(pool);
+      blocked.run([&]() {
+        while (!release.load())
+          std::this_thread::yield();
+      });
+      ntest::assert_bool(false, blocked.wait_until(std::chrono::steady_clock::now() + std::chrono::milliseconds(10)));
+      release.store(true);
+      ntest::assert_bool(true, blocked.wait_until(std::chrono::steady_clock::now() + std::chrono::seconds(60)));
+    }
+    ntest::assert_throws<std::invalid_argument>([] { util::thread_pool pool({ 1, false, 1 << 20 }); });
+  });
+
+  ntest::test("program options", [] {
+    opts::table const table = action::sizerank_options_desc();
+    {
+      char const *argv[] {
+        "program_name_placeholder",
+        "sizerank",
+        "-rn5",
+        "--dir=a", "-d", "b",
+        "--progress", "0.5",
+        "-g",
+        "--", "--top", "6",
+      };
+      opts::parsed const parsed = opts::parse(table, (int)util::lengthof(argv), argv);
+      ntest::assert_uint64(1, parsed.count("recurse"));
+      ntest::assert_uint64(5, parsed.as<size_t>("top"));
+      ntest::assert_uint64(2, parsed.count("dir"));
+      ntest::assert_stdvec({ "a", "b" }, parsed.as<std::vector<std::string>>("dir"));
+      ntest::assert_bool(true, parsed.as<double>("progress") == 0.5);
+      ntest::assert_stdstr("ascii", parsed.as<std::string>("histogram"));
+      ntest::assert_uint64(0, parsed.count("pattern"));
+    }
+
+    // the messages boost::program_options gave
+    auto const error_of = [&table](std::vector<char const *> args) {
+      args.insert(args.begin(), "program_name_placeholder");
+      return ntest::assert_throws<opts::error>([&]() {
+        (void)opts::parse(table, (int)args.size(), args.data());
+      });
+    };
+    ntest::assert_stdstr("unrecognised option '--foo=3'", error_of({ "--foo=3" }));
+    ntest::assert_stdstr("unrecognised option '-rx'", error_of({ "-rx" }));
+    ntest::assert_stdstr("the required argument for option '--pattern' is missing", error_of({ "--pattern", "-r" }));
+    ntest::assert_stdstr("the argument ('abc') for option '--top' is invalid", error_of({ "-n", "abc" }));
+    ntest::assert_stdstr("option '--top' cannot be specified more than once", error_of({ "--top", "1", "-n", "2" }));
+    ntest::assert_stdstr("option '--recurse' does not take any arguments", error_of({ "--recurse=1" }));
+    ntest::assert_stdstr(
+      "the argument for option '--top' should follow immediately after the equal sign", error_of({ "--top=" }));
+    ntest::assert_stdstr(
+      "option '--o' is ambiguous and matches '--older-than', and '--outpath'", error_of({ "--o", "5d" }));
+
+    std::string const help = opts::help_msg(table);
+    ntest::assert_stdstr(
+      (
+        "SIZERANK OPTIONS:\n"
+        "  -d [ --dir ] arg\n"
+        "      Search directory, repeat to rank files across several, default=cwd\n"
+        "  -r [ --recurse ] \n"
+        "      Enables recursive search through child directories, default=false\n"
+      ),
+      help.substr(0, help.find("  -n [ --top ]"))
+    );
+    ntest::assert_bool(true, help.find(
+      "  -w [ --devthreads ] arg\n"
+      "      Threads listing directories per storage device, directories on different \n"
+      "      devices are always searched concurrently, default=1\n") != std::string::npos);
+    ntest::assert_bool(true, help.find("  -g [ --histogram ] [=arg(=ascii)]\n") != std::string::npos);
+  });
+
+  ntest::test("vectors_same", [] {
+    // compares bytes, not elements
+    std::vector<uint32_t> const a{ 1, 2, 3 }, b{ 1, 2, 4 };
+    ntest::assert_bool(false, util::vectors_same(a, b));
+    ntest::assert_bool(true, util::vectors_same(a, a));
+  });
+
+  ntest::test("sink", [] {
+    {
+      sink::memory out{};
+      out << "a" << ' ' << size_t(42) << ' ' << int64_t(-7) << ' ' << 33.333333333 << ' ' << 50.0;
+      ntest::assert_stdstr("a 42 -7 33.3333 50", out.str());
+    }
+    {
+      // bigger than the buffer, so it's consumed in several chunks, in order
+      std::string expected{};
+      std::string received{};
+      size_t num_chunks = 0;
+      {
+        sink::callback out([&](std::string_view const chunk) {
+          received.append(chunk);
+          ++num_chunks;
+        });
+        for (size_t i = 0; i < 10'000; ++i) {
+          out << i << '\n';
+          expected += std::to_string(i) + '\n';
+        }
+      }
+      ntest::assert_stdstr(expected, received);
+      ntest::assert_bool(true, num_chunks > 1);
+    }
+    {
+      sink::memory first{}, second{};
+      {
+        sink::tee both(first, second);
+        both << "row\n";
+      }
+      ntest::assert_stdstr("row\n", first.str());
+      ntest::assert_stdstr("row\n", second.str());
+    }
+  });
+
+  ntest::test("mapped_file", [] {
+    using util::mapped_file;
+
+    {
+      mapped_file file("dupes/a.txt");
+      ntest::assert_bool(true, file.is_mapped());
+      ntest::assert_uint64(std::filesystem::file_size("dupes/a.txt"), file.size());
+      ntest::assert_bool(true, file.chars().starts_with("hello world"));
+
+      mapped_file const moved(std::move(file));
+      ntest::assert_bool(true, moved.chars().starts_with("hello world"));
+      ntest::assert_uint64(0, file.size());
+    }
+    {
+      mapped_file const file("dupes/empty1");
+      ntest::assert_uint64(0, file.size());
+      ntest::assert_bool(true, file.bytes().empty());
+    }
+    {
+      bool threw = false;
+      try {
+        mapped_file const file("does_not_exist");
+      } catch (std::runtime_error const &) {
+        threw = true;
+      }
+      ntest::assert_bool(true, threw);
+    }
+  });
+
+  ntest::test("strip_carriage_returns and load_text_file", [] {
+    using util::cr_removal;
+
+    auto const strip = [](std::string str, cr_removal const mode) {
+      str.resize(static_cast<size_t>(util::strip_carriage_returns(str.data(), str.data(), str.size(), mode) - str.data()));
+      return str;
+    };
+
+    ntest::assert_stdstr("a\nb\n", strip("a\r\nb\r\n", cr_removal::all));
+    ntest::assert_stdstr("a\rb\nc\r", strip("a\rb\r\nc\r", cr_removal::crlf));
+    ntest::assert_stdstr("a\rb\r\n", strip("a\rb\r\n", cr_removal::none));
+
+    // long enough for the vector loops, with CRs at chunk edges and a CRLF split between chunks
+    std::string line(95, 'x');
+    line[0] = line[15] = line[16] = line[31] = '\r';
+    line[32] = '\n';
+    std::string expected_all{}, expected_crlf{};
+    for (size_t i = 0; i < line.size(); ++i) {
+      if (line[i] != '\r')
+        expected_all += line[i];
+      if (line[i] != '\r' || line[i + 1] != '\n')
+        expected_crlf += line[i];
+    }
+    ntest::assert_stdstr(expected_all, strip(line, cr_removal::all));
+    ntest::assert_stdstr(expected_crlf, strip(line, cr_removal::crlf));
+
+    {
+      auto const path = ntest::scratch_dir() / "text_file.txt";
+      std::string const raw("one\r\ntwo\0three\rfour\r\n", 22);
+      std::ofstream(path, std::ios::binary) << raw;
+
+      ntest::assert_stdstr(std::string("one\ntwo\0threefour\n", 19), util::load_text_file(path));
+      ntest::assert_stdstr(std::string("one\ntwo\0three\rfour\n", 20), util::load_text_file(path, cr_removal::crlf));
+    }
+  });
+
+  ntest::test("binary file digest", [] {
+    auto const digest_path = ntest::scratch_dir() / "big1.digest";
+    ntest::write_binary_file_digest(digest_path, "dupes/big1.bin", 4096);
+    ntest::assert_binary_file_digest(digest_path, "dupes/big1.bin");
+
+    // 20000 bytes in 4 KiB chunks
+    std::ifstream digest(digest_path);
+    std::string line{};
+    size_t num_chunks = 0;
+    while (std::getline(digest, line))
+      num_chunks += line.starts_with("chunk ");
+    ntest::assert_uint64(5, num_chunks);
+  });
+
+  ntest::test("arr_mismatch", [] {
+    using ntest::internal::arr_mismatch;
+
+    // past the first memcmp block
+    std::vector<uint8_t> a(10'000, 7), b = a;
+    ntest::assert_uint64(SIZE_MAX, arr_mismatch(a.data(), a.size(), b.data(), b.size()));
+    b[5'000] = 8;
+    ntest::assert_uint64(5'000, arr_mismatch(a.data(), a.size(), b.data(), b.size()));
+    // a prefix differs where the shorter one ends
+    ntest::assert_uint64(3, arr_mismatch(a.data(), 3, a.data(), 4));
+
+    // compared by value, not by bytes
+    double const zeros[] { 0.0, 1.0 }, negative_zeros[] { -0.0, 1.0 };
+    ntest::assert_uint64(SIZE_MAX, arr_mismatch(zeros, 2, negative_zeros, 2));
+  });
+
+  ntest::test("hash64", [] {
+    using util::hash64;
+
+    ntest::assert_uint64(0xEF46DB3751D8E999, hash64("", 0));
+    ntest::assert_uint64(0x44BC2CF5AD770999, hash64("abc", 3));
+    ntest::assert_uint64(0xFBCEA83C8A378BF1, hash64("Nobody inspects the spammish repetition", 39));
+  });
+
+  ntest::test("format_file_size", [] {
     using util::format_file_size;
 
     ntest::assert_stdstr("0 B", format_file_size(0));
@@ -181,6 +1458,33 @@ int main(void) {
     ntest::assert_stdstr("1.00 GB", format_file_size(1'073'741'824));
     ntest::assert_stdstr("1024.00 GB", format_file_size(1'099'511'627'775));
     ntest::assert_stdstr("1.00 TB", format_file_size(1'099'511'627'776));
+    // 1.125 KB and 1.375 KB, exact ties round to even like printf
+    ntest::assert_stdstr("1.12 KB", format_file_size(1152));
+    ntest::assert_stdstr("1.38 KB", format_file_size(1408));
+    ntest::assert_stdstr("16777216.00 TB", format_file_size(UINTMAX_MAX));
+  });
+
+  ntest::test("make_str and format_to", [] {
+    using util::make_str;
+
+    ntest::assert_stdstr("no fields {}", make_str("no fields {{}}"));
+    ntest::assert_stdstr("-7 x 2.5 abc", make_str("{} {} {} {}", -7, 'x', 2.5, "abc"));
+    ntest::assert_stdstr("[ab  |  12|1.00 KB]", make_str("[{:<4}|{:>4}|{}]", std::string("ab"), 12u, util::file_size{ 1024 }));
+    ntest::assert_stdstr("toolong", make_str("{:>3}", "toolong"));
+
+    std::string buf = "keep ";
+    util::format_to(buf, "{}/{}", 1, 2);
+    ntest::assert_stdstr("keep 1/2", buf);
+  });
+
+  auto const run = ntest::run_tests();
+  std::cout << run.num_cases << " cases, " << run.num_cases_failed << " failed\n";
+
+  if (benchmark) {
+    // after the tests, so nothing else competes for the machine
+    ntest::config::set_bench_baseline("fileutil.bench.baseline");
+    register_benchmarks();
+    ntest::run_tests(1);
   }
 
   auto const res = ntest::generate_report("fileutil");
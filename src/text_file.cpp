@@ -0,0 +1,189 @@
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define TEXT_FILE_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#include "text_file.hpp"
+
+namespace fs = std::filesystem;
+using util::cr_removal;
+
+namespace {
+
+  // Copies `width` chars from `src` to `dst` leaving out those whose bit is set in `drop_mask`.
+  char *copy_except(char *dst, char const *const src, unsigned const width, uint32_t drop_mask) {
+    unsigned from = 0;
+    while (drop_mask != 0) {
+      unsigned const idx = static_cast<unsigned>(std::countr_zero(drop_mask));
+      std::memmove(dst, src + from, idx - from);
+      dst += idx - from;
+      from = idx + 1;
+      drop_mask &= drop_mask - 1;
+    }
+    std::memmove(dst, src + from, width - from);
+    return dst + (width - from);
+  }
+
+  char *strip_scalar(char *dst, char const *src, char const *const end, cr_removal const mode) {
+    for (; src < end; ++src) {
+      bool const drop = *src == '\r' && (mode == cr_removal::all || (src + 1 < end && src[1] == '\n'));
+      if (!drop) {
+        *dst++ = *src;
+      }
+    }
+    return dst;
+  }
+
+#ifdef TEXT_FILE_X86
+
+  // The vector loops stop 1 char short of a full chunk so crlf mode can look at
+  // the char after it, the scalar loop does the rest.
+
+  char *strip_sse2(char *dst, char const *src, char const *const end, cr_removal const mode) {
+    __m128i const cr = _mm_set1_epi8('\r');
+    __m128i const lf = _mm_set1_epi8('\n');
+
+    while (end - src > 16) {
+      __m128i const chunk = _mm_loadu_si128(reinterpret_cast<__m128i const *>(src));
+      __m128i drop = _mm_cmpeq_epi8(chunk, cr);
+      if (mode == cr_removal::crlf) {
+        __m128i const next = _mm_loadu_si128(reinterpret_cast<__m128i const *>(src + 1));
+        drop = _mm_and_si128(drop, _mm_cmpeq_epi8(next, lf));
+      }
+
+      auto const drop_mask = static_cast<uint32_t>(_mm_movemask_epi8(drop));
+      if (drop_mask == 0) {
+        if (dst != src) {
+          _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), chunk);
+        }
+        dst += 16;
+      } else {
+        dst = copy_except(dst, src, 16, drop_mask);
+      }
+      src += 16;
+    }
+
+    return strip_scalar(dst, src, end, mode);
+  }
+
+#if defined(__GNUC__) || defined(__clang__)
+  __attribute__((target("avx2")))
+#endif
+  char *strip_avx2(char *dst, char const *src, char const *const end, cr_removal const mode) {
+    __m256i const cr = _mm256_set1_epi8('\r');
+    __m256i const lf = _mm256_set1_epi8('\n');
+
+    while (end - src > 32) {
+      __m256i const chunk = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(src));
+      __m256i drop = _mm256_cmpeq_epi8(chunk, cr);
+      if (mode == cr_removal::crlf) {
+        __m256i const next = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(src + 1));
+        drop = _mm256_and_si256(drop, _mm256_cmpeq_epi8(next, lf));
+      }
+
+      auto const drop_mask = static_cast<uint32_t>(_mm256_movemask_epi8(drop));
+      if (drop_mask == 0) {
+        if (dst != src) {
+          _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst), chunk);
+        }
+        dst += 32;
+      } else {
+        dst = copy_except(dst, src, 32, drop_mask);
+      }
+      src += 32;
+    }
+
+    return strip_scalar(dst, src, end, mode);
+  }
+
+  bool cpu_has_avx2() {
+#ifdef _MSC_VER
+    int regs[4];
+    __cpuid(regs, 0);
+    if (regs[0] < 7)
+      return false;
+    __cpuid(regs, 1);
+    bool const os_saves_ymm = (regs[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6;
+    __cpuidex(regs, 7, 0);
+    return os_saves_ymm && (regs[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+  }
+
+#endif // TEXT_FILE_X86
+
+  using strip_fn = char *(*)(char *, char const *, char const *, cr_removal);
+
+  strip_fn pick_strip_fn() {
+#ifdef TEXT_FILE_X86
+    return cpu_has_avx2() ? strip_avx2 : strip_sse2;
+#else
+    return strip_scalar;
+#endif
+  }
+
+} // namespace
+
+char *util::strip_carriage_returns(char *const dst, char const *const src, size_t const size, cr_removal const mode) {
+  if (mode == cr_removal::none) {
+    std::memmove(dst, src, size);
+    return dst + size;
+  }
+  static strip_fn const strip = pick_strip_fn();
+  return strip(dst, src, src + size, mode);
+}
+
+std::string util::load_text_file(fs::path const &path, cr_removal const mode) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file.is_open()) {
+    throw std::runtime_error("unable to open file '" + path.string() + "'");
+  }
+
+  // big enough to amortize read calls, small enough for a block to still be in
+  // cache when it's compacted
+  size_t constexpr block_size = 1024 * 1024;
+
+  std::error_code ec{};
+  uintmax_t const expected_size = fs::file_size(path, ec);
+
+  std::string contents{};
+  contents.resize(ec ? block_size : static_cast<size_t>(expected_size));
+  size_t len = 0;
+
+  for (;;) {
+    if (len == contents.size()) {
+      if (file.peek() == std::char_traits<char>::eof())
+        break;
+      // larger than its size said, e.g. it's growing or a special file
+      contents.resize(contents.size() + block_size);
+    }
+
+    char *const block = contents.data() + len;
+    file.read(block, static_cast<std::streamsize>(std::min(block_size, contents.size() - len)));
+    auto const num_read = static_cast<size_t>(file.gcount());
+    if (num_read == 0) {
+      if (file.bad())
+        throw std::runtime_error("unable to read file '" + path.string() + "'");
+      break;
+    }
+
+    // a CR ending the previous block was kept, in case this block doesn't start with LF
+    bool const split_crlf = mode == cr_removal::crlf && len > 0 && block[-1] == '\r' && block[0] == '\n';
+    char *const dst = split_crlf ? block - 1 : block;
+    len = static_cast<size_t>(strip_carriage_returns(dst, block, num_read, mode) - contents.data());
+  }
+
+  contents.resize(len);
+  return contents;
+}
@@ -0,0 +1,32 @@
+#ifndef TEXT_FILE_HPP
+#define TEXT_FILE_HPP
+
+#include <cstddef>
+#include <filesystem>
+#include <string>
+
+namespace util {
+
+// Which carriage returns load_text_file drops.
+enum class cr_removal {
+  none,
+  // every '\r'
+  all,
+  // only the '\r' of "\r\n" pairs, so lone CRs survive
+  crlf,
+};
+
+// Compacts `size` chars at `src` to `dst`, dropping carriage returns per `mode`,
+// and returns the new end. `dst` may equal `src`, to compact in place, but must
+// not be after it. A '\r' ending the range is kept in crlf mode, as what follows
+// it is unknown. Uses SSE2 or AVX2 when the CPU has them.
+char *strip_carriage_returns(char *dst, char const *src, std::size_t size, cr_removal mode);
+
+// Reads a whole file as text, in large blocks which have their carriage returns
+// stripped in place right after being read. Unlike getline, embedded NULs are kept.
+// Throws std::runtime_error if the file cannot be opened or read.
+std::string load_text_file(std::filesystem::path const &path, cr_removal mode = cr_removal::all);
+
+} // namespace util
+
+#endif // TEXT_FILE_HPP
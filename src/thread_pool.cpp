@@ -0,0 +1,385 @@
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#ifdef _WIN32
+#include <climits>
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <fstream>
+#include <sched.h>
+#endif
+
+#include "thread_pool.hpp"
+
+namespace {
+
+  // which pool's worker the calling thread is, if any
+  thread_local util::thread_pool const *t_pool = nullptr;
+  thread_local size_t t_worker_idx = SIZE_MAX;
+
+  struct shared_pool {
+    std::mutex mutex{};
+    std::unique_ptr<util::thread_pool> pool{};
+  };
+
+  shared_pool &shared_state() {
+    static shared_pool state{};
+    return state;
+  }
+
+#ifdef _WIN32
+
+  // CPUs are numbered group * 64 + index within the group. A thread can only be
+  // kept to CPUs of one processor group, which a NUMA node always is within.
+  std::vector<size_t> allowed_cpus(int const numa_node) {
+    GROUP_AFFINITY current{};
+    if (!GetThreadGroupAffinity(GetCurrentThread(), &current)) {
+      return {};
+    }
+
+    GROUP_AFFINITY allowed = current;
+    if (numa_node >= 0) {
+      if (numa_node > USHRT_MAX || !GetNumaNodeProcessorMaskEx(static_cast<USHORT>(numa_node), &allowed)) {
+        return {};
+      }
+      if (allowed.Group == current.Group) {
+        allowed.Mask &= current.Mask;
+      }
+    }
+
+    std::vector<size_t> cpus{};
+    for (size_t bit = 0; bit < 64; ++bit) {
+      if ((allowed.Mask >> bit) & 1) {
+        cpus.push_back(size_t(allowed.Group) * 64 + bit);
+      }
+    }
+    return cpus;
+  }
+
+  void set_affinity(std::vector<size_t> const &cpus) {
+    GROUP_AFFINITY affinity{};
+    affinity.Group = static_cast<WORD>(cpus.front() / 64);
+    for (size_t const cpu : cpus) {
+      affinity.Mask |= KAFFINITY(1) << (cpu % 64);
+    }
+    // a hint, the workers run fine wherever they're scheduled
+    SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr);
+  }
+
+#elif defined(__linux__)
+
+  std::vector<size_t> allowed_cpus(int const numa_node) {
+    cpu_set_t current;
+    CPU_ZERO(&current);
+    if (sched_getaffinity(0, sizeof(current), &current) != 0) {
+      return {};
+    }
+
+    std::vector<size_t> cpus{};
+    auto const add = [&](size_t const cpu) {
+      if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &current)) {
+        cpus.push_back(cpu);
+      }
+    };
+
+    if (numa_node < 0) {
+      for (size_t cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        add(cpu);
+      }
+      return cpus;
+    }
+
+    // ranges like "0-3,8-11"
+    std::ifstream list("/sys/devices/system/node/node" + std::to_string(numa_node) + "/cpulist");
+    size_t first = 0, last = 0;
+    while (list >> first) {
+      last = first;
+      if (list.peek() == '-') {
+        list.get();
+        list >> last;
+      }
+      for (size_t cpu = first; cpu <= last; ++cpu) {
+        add(cpu);
+      }
+      if (list.peek() != ',') {
+        break;
+      }
+      list.get();
+    }
+    return cpus;
+  }
+
+  void set_affinity(std::vector<size_t> const &cpus) {
+    cpu_set_t affinity;
+    CPU_ZERO(&affinity);
+    for (size_t const cpu : cpus) {
+      CPU_SET(cpu, &affinity);
+    }
+    // a hint, the workers run fine wherever they're scheduled
+    sched_setaffinity(0, sizeof(affinity), &affinity);
+  }
+
+#else
+
+  // no portable way to pin threads elsewhere, so there are no CPUs to pin to
+  std::vector<size_t> allowed_cpus(int) {
+    return {};
+  }
+
+  void set_affinity(std::vector<size_t> const &) {}
+
+#endif
+
+} // namespace
+
+util::thread_pool::thread_pool() : thread_pool(options{}) {}
+
+util::thread_pool::thread_pool(options const &opts) {
+  size_t const num_threads = opts.num_threads != 0
+    ? opts.num_threads
+    : std::max(std::thread::hardware_concurrency(), 1u);
+
+  std::vector<size_t> cpus{};
+  if (opts.pin_to_cpus || opts.numa_node >= 0) {
+    cpus = allowed_cpus(opts.numa_node);
+    if (opts.numa_node >= 0 && cpus.empty()) {
+      throw std::invalid_argument("NUMA node " + std::to_string(opts.numa_node) + " has no CPUs to run on");
+    }
+  }
+
+  // every deque exists before any worker starts, they may steal from each other straight away
+  m_workers.reserve(num_threads);
+  for (size_t i = 0; i < num_threads; ++i) {
+    m_workers.push_back(std::make_unique<worker>());
+  }
+
+  for (size_t i = 0; i < num_threads; ++i) {
+    std::vector<size_t> worker_cpus{};
+    if (!cpus.empty()) {
+      worker_cpus = opts.pin_to_cpus ? std::vector<size_t>{ cpus[i % cpus.size()] } : cpus;
+    }
+    m_workers[i]->thread = std::thread([this, i, worker_cpus = std::move(worker_cpus)]() {
+      work(i, worker_cpus);
+    });
+  }
+}
+
+util::thread_pool::~thread_pool() {
+  {
+    std::lock_guard<std::mutex> const lock(m_sleep_mutex);
+    m_stopping = true;
+  }
+  m_wake.notify_all();
+
+  for (auto &w : m_workers) {
+    w->thread.join();
+  }
+}
+
+void util::thread_pool::submit(std::function<void ()> task) {
+  size_t const idx = on_worker()
+    ? t_worker_idx
+    : m_next_worker.fetch_add(1, std::memory_order_relaxed) % m_workers.size();
+
+  // counted before it's pushed, so the count is never below what a worker can take
+  ++m_num_queued;
+  {
+    worker &w = *m_workers[idx];
+    std::lock_guard<std::mutex> const lock(w.mutex);
+    w.tasks.push_back(std::move(task));
+  }
+
+  if (m_num_sleeping.load() > 0) {
+    // under the lock, so a worker between checking for tasks and sleeping doesn't miss it
+    std::lock_guard<std::mutex> const lock(m_sleep_mutex);
+    m_wake.notify_one();
+  }
+}
+
+bool util::thread_pool::on_worker() const {
+  return t_pool == this;
+}
+
+bool util::thread_pool::run_pending_task() {
+  std::function<void ()> task{};
+  if (!take_task(on_worker() ? t_worker_idx : SIZE_MAX, task)) {
+    return false;
+  }
+  task();
+  return true;
+}
+
+bool util::thread_pool::take_task(size_t const idx, std::function<void ()> &task) {
+  if (m_num_queued.load(std::memory_order_relaxed) == 0) {
+    return false;
+  }
+
+  if (idx != SIZE_MAX) {
+    worker &own = *m_workers[idx];
+    std::lock_guard<std::mutex> const lock(own.mutex);
+    if (!own.tasks.empty()) {
+      task = std::move(own.tasks.back());
+      own.tasks.pop_back();
+      --m_num_queued;
+      return true;
+    }
+  }
+
+  // starting past its own deque, so thieves spread out over the others
+  size_t const num_workers = m_workers.size();
+  size_t const first = idx != SIZE_MAX ? idx + 1 : m_next_worker.load(std::memory_order_relaxed);
+  for (size_t i = 0; i < num_workers; ++i) {
+    worker &victim = *m_workers[(first + i) % num_workers];
+    std::lock_guard<std::mutex> const lock(victim.mutex);
+    if (!victim.tasks.empty()) {
+      task = std::move(victim.tasks.front());
+      victim.tasks.pop_front();
+      --m_num_queued;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void util::thread_pool::work(size_t const idx, std::vector<size_t> const &cpus) {
+  t_pool = this;
+  t_worker_idx = idx;
+  if (!cpus.empty()) {
+    set_affinity(cpus);
+  }
+
+  std::function<void ()> task{};
+  for (;;) {
+    if (take_task(idx, task)) {
+      task();
+      task = nullptr;
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(m_sleep_mutex);
+    ++m_num_sleeping;
+    m_wake.wait(lock, [this]() { return m_num_queued.load() > 0 || m_stopping; });
+    --m_num_sleeping;
+    if (m_stopping && m_num_queued.load() == 0) {
+      return;
+    }
+  }
+}
+
+util::thread_pool &util::thread_pool::shared() {
+  shared_pool &state = shared_state();
+  std::lock_guard<std::mutex> const lock(state.mutex);
+  if (state.pool == nullptr) {
+    state.pool = std::make_unique<thread_pool>();
+  }
+  return *state.pool;
+}
+
+void util::thread_pool::configure_shared(options const &opts) {
+  shared_pool &state = shared_state();
+  std::lock_guard<std::mutex> const lock(state.mutex);
+  if (state.pool != nullptr) {
+    throw std::logic_error("the shared thread pool is already running");
+  }
+  state.pool = std::make_unique<thread_pool>(opts);
+}
+
+util::task_group::~task_group() {
+  cancel();
+  wait_for_tasks(std::chrono::steady_clock::time_point::max());
+}
+
+void util::task_group::run(std::function<void ()> task) {
+  {
+    std::lock_guard<std::mutex> const lock(m_mutex);
+    ++m_num_pending;
+  }
+
+  m_pool.submit([this, task = std::move(task)]() {
+    if (!m_stop.stop_requested()) {
+      try {
+        task();
+      } catch (...) {
+        {
+          std::lock_guard<std::mutex> const lock(m_mutex);
+          if (m_error == nullptr) {
+            m_error = std::current_exception();
+          }
+        }
+        m_stop.request_stop();
+      }
+    }
+    task_done();
+  });
+}
+
+void util::task_group::wait() {
+  wait_for_tasks(std::chrono::steady_clock::time_point::max());
+  rethrow_error();
+}
+
+bool util::task_group::wait_until(std::chrono::steady_clock::time_point const deadline) {
+  if (!wait_for_tasks(deadline)) {
+    return false;
+  }
+  rethrow_error();
+  return true;
+}
+
+void util::task_group::task_done() {
+  // notified under the lock, a waiter can't return and destroy the group in between
+  std::lock_guard<std::mutex> const lock(m_mutex);
+  if (--m_num_pending == 0) {
+    m_done.notify_all();
+  }
+}
+
+bool util::task_group::wait_for_tasks(std::chrono::steady_clock::time_point const deadline) {
+  using clock = std::chrono::steady_clock;
+
+  auto const all_done = [this]() { return m_num_pending == 0; };
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  if (!m_pool.on_worker()) {
+    if (deadline == clock::time_point::max()) {
+      m_done.wait(lock, all_done);
+      return true;
+    }
+    return m_done.wait_until(lock, deadline, all_done);
+  }
+
+  // A worker runs queued tasks, the group's or any other's, while it waits. Blocking
+  // instead could leave the group's own tasks queued with every worker waiting.
+  while (!all_done()) {
+    auto const now = clock::now();
+    if (now >= deadline) {
+      return false;
+    }
+
+    lock.unlock();
+    bool const ran = m_pool.run_pending_task();
+    lock.lock();
+
+    if (!ran) {
+      // the rest are running elsewhere, check back shortly in case they queue more
+      m_done.wait_until(lock, std::min(deadline, now + std::chrono::milliseconds(1)), all_done);
+    }
+  }
+  return true;
+}
+
+void util::task_group::rethrow_error() {
+  std::exception_ptr error{};
+  {
+    std::lock_guard<std::mutex> const lock(m_mutex);
+    error = std::exchange(m_error, nullptr);
+  }
+  if (error != nullptr) {
+    std::rethrow_exception(error);
+  }
+}
@@ -0,0 +1,139 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stop_token>
+#include <thread>
+#include <vector>
+
+namespace util {
+
+// Threads the actions run their parallel work on, so running several things
+// at once (e.g. batch lines which each walk a tree) shares one set of threads
+// rather than each spinning up its own. Every worker has its own deque of tasks:
+// it pushes and pops at the back, so the task it queued last runs next while its
+// data is still in cache, and idle workers steal from the front of the others'.
+class thread_pool {
+public:
+  struct options {
+    // 0 = std::thread::hardware_concurrency()
+    std::size_t num_threads = 0;
+    // Pins each worker to its own CPU, in order, wrapping around if there are
+    // more workers than CPUs.
+    bool pin_to_cpus = false;
+    // Keeps the workers on the CPUs of this NUMA node, -1 = any.
+    int numa_node = -1;
+  };
+
+  // With the default options.
+  thread_pool();
+  // Throws std::invalid_argument if `opts.numa_node` has no CPUs the process may use.
+  explicit thread_pool(options const &opts);
+  // Runs whatever is still queued, then joins the workers.
+  ~thread_pool();
+
+  thread_pool(thread_pool const &) = delete;
+  thread_pool &operator=(thread_pool const &) = delete;
+
+  [[nodiscard]] std::size_t num_threads() const { return m_workers.size(); }
+
+  // Queues `task`. From one of the pool's workers it goes on that worker's own
+  // deque, from any other thread on the workers' deques in turn. A task which
+  // throws terminates the program, run it in a task_group to have the exception
+  // passed on instead.
+  void submit(std::function<void ()> task);
+
+  // True on one of this pool's workers.
+  [[nodiscard]] bool on_worker() const;
+
+  // Runs one queued task on the calling worker, its own newest if it has any,
+  // else one stolen from another. Returns false if none was queued.
+  bool run_pending_task();
+
+  // The process's pool, created with the options given to configure_shared, or
+  // the defaults if there were none, on first use.
+  [[nodiscard]] static thread_pool &shared();
+
+  // Creates the shared pool, main does this with the global options. Throws
+  // std::logic_error if it was already created, and whatever the constructor throws.
+  static void configure_shared(options const &opts);
+
+private:
+  struct worker {
+    std::mutex mutex{};
+    std::deque<std::function<void ()>> tasks{};
+    std::thread thread{};
+  };
+
+  void work(std::size_t idx, std::vector<std::size_t> const &cpus);
+
+  // Takes the newest task of worker `idx`, or the oldest of another. `idx` may be
+  // SIZE_MAX for a thread which isn't a worker, it only steals.
+  bool take_task(std::size_t idx, std::function<void ()> &task);
+
+  std::vector<std::unique_ptr<worker>> m_workers{};
+
+  // queued in any deque and not yet taken, checked by idle workers before they sleep
+  std::atomic<std::size_t> m_num_queued = 0;
+  std::atomic<std::size_t> m_num_sleeping = 0;
+  std::atomic<std::size_t> m_next_worker = 0;
+  std::mutex m_sleep_mutex{};
+  std::condition_variable m_wake{};
+  bool m_stopping = false;
+};
+
+// Tasks run on a pool which can be waited for and cancelled together. Tasks may
+// run more tasks in their own group, and groups may be nested: a worker waiting
+// for a group runs queued tasks meanwhile, so waiting never ties up a worker
+// while there's work to do.
+class task_group {
+public:
+  explicit task_group(thread_pool &pool = thread_pool::shared()) : m_pool(pool) {}
+  // Cancels what hasn't started and waits for the rest, so no task outlives the
+  // group. An exception a task threw is dropped.
+  ~task_group();
+
+  task_group(task_group const &) = delete;
+  task_group &operator=(task_group const &) = delete;
+
+  // Queues `task` on the pool. Once the group is cancelled, tasks which haven't
+  // started are skipped.
+  void run(std::function<void ()> task);
+
+  // Waits until every task run in the group is done, then rethrows the first
+  // exception one threw, if any did. A task throwing cancels the group.
+  void wait();
+
+  // Like wait, but gives up at `deadline`, returning false if tasks are left.
+  bool wait_until(std::chrono::steady_clock::time_point deadline);
+
+  // Skips the tasks which haven't started, running ones can check stop_token().
+  void cancel() { m_stop.request_stop(); }
+
+  [[nodiscard]] std::stop_token stop_token() const { return m_stop.get_token(); }
+
+private:
+  void task_done();
+  // Returns false if tasks are left at `deadline`.
+  bool wait_for_tasks(std::chrono::steady_clock::time_point deadline);
+  void rethrow_error();
+
+  thread_pool &m_pool;
+  std::stop_source m_stop{};
+  std::mutex m_mutex{};
+  std::condition_variable m_done{};
+  std::size_t m_num_pending = 0;
+  std::exception_ptr m_error{};
+};
+
+} // namespace util
+
+#endif // THREAD_POOL_HPP
@@ -1,100 +1,142 @@
+#include <charconv>
+#include <cstring>
 #include <filesystem>
 #include <iostream>
 #include <stdexcept>
 #include <sstream>
-#include <cstdarg>
-
-#include <boost/program_options.hpp>
 
 #include "util.hpp"
 
 using namespace std;
 
-string util::make_str(char const *const fmt, ...) {
-  size_t const buf_size = 1024;
-  char buffer[buf_size];
+void util::detail::format_literal(string &out, string_view &fmt, format_field &field) {
+  // the format string was validated at compile time, so this doesn't check it again
+  while (!fmt.empty()) {
+    size_t const brace = fmt.find_first_of("{}");
+    out.append(fmt.substr(0, brace));
+    if (brace == string_view::npos) {
+      fmt = {};
+      return;
+    }
+
+    if (fmt[brace] == '}' || fmt[brace + 1] == '{') {
+      // escaped brace
+      out.push_back(fmt[brace]);
+      fmt.remove_prefix(brace + 2);
+      continue;
+    }
+
+    field = {};
+    size_t i = brace + 1;
+    if (fmt[i] == ':') {
+      field.align = fmt[i + 1];
+      i += 2;
+      while (fmt[i] != '}') {
+        field.width = field.width * 10 + static_cast<size_t>(fmt[i] - '0');
+        ++i;
+      }
+    }
+    fmt.remove_prefix(i + 1);
+    return;
+  }
+}
 
-  va_list args;
-  va_start(args, fmt);
-  [[maybe_unused]] int const cnt = vsnprintf(buffer, sizeof(buffer), fmt, args);
-  va_end(args);
+void util::detail::format_padded(
+  string &out,
+  format_field const field,
+  char const default_align,
+  string_view const text
+) {
+  size_t const padding = field.width > text.size() ? field.width - text.size() : 0;
+  bool const left = (field.align == 0 ? default_align : field.align) == '<';
+
+  if (!left)
+    out.append(padding, ' ');
+  out.append(text);
+  if (left)
+    out.append(padding, ' ');
+}
 
-  return std::string(buffer);
+void util::detail::format_arg(string &out, format_field const field, double const value) {
+  char digits[32];
+  auto const result = to_chars(digits, digits + sizeof(digits), value, chars_format::general, 6);
+  format_padded(out, field, '>', string_view(digits, static_cast<size_t>(result.ptr - digits)));
+}
+
+void util::detail::format_arg(string &out, format_field const field, file_size const value) {
+  char buf[max_file_size_len];
+  format_padded(out, field, '>', format_file_size(value.bytes, buf));
 }
 
 fstream util::open_file(char const *const file_path, int const flags) {
   bool const for_reading = (flags & 1) == 1;
 
   if (for_reading && !filesystem::exists(file_path))
-    throw std::runtime_error(make_str("file '%s' not found", file_path));
+    throw std::runtime_error(make_str("file '{}' not found", file_path));
 
   fstream file(file_path, static_cast<ios_base::openmode>(flags));
 
   if (!file.is_open())
-    throw std::runtime_error(make_str("unable to open file '%s'", file_path));
+    throw std::runtime_error(make_str("unable to open file '{}'", file_path));
 
   if (!file)
-    throw std::runtime_error(make_str("file '%s' in bad state", file_path));
+    throw std::runtime_error(make_str("file '{}' in bad state", file_path));
 
   return file;
 }
 
-vector<char> util::extract_bin_file_contents(char const *const file_path) {
-  fstream file = util::open_file(file_path, ios::binary | ios::in);
-  auto const file_size = filesystem::file_size(file_path);
-  vector<char> vec(file_size);
-  file.read(vec.data(), file_size);
-  return vec;
-}
-
-string util::extract_txt_file_contents(char const *const file_path) {
-  fstream file = util::open_file(file_path, ios::in);
-  auto const file_size = filesystem::file_size(file_path);
-
-  string content{};
-  content.reserve(file_size);
-
-  getline(file, content, '\0');
-
-  // remove any \r characters
-  content.erase(
-    remove(content.begin(), content.end(), '\r'),
-    content.end()
-  );
-
-  return content;
-}
-
 string util::format_file_size(uintmax_t const size) {
-  char out[21];
-  format_file_size(size, out, sizeof(out));
-  return string(out);
+  char buf[max_file_size_len];
+  return string(format_file_size(size, buf));
 }
 
-void util::format_file_size(
-  uintmax_t const file_size,
-  char *const out,
-  size_t const out_size
-) {
+string_view util::format_file_size(uintmax_t const size, char (&buf)[max_file_size_len]) {
   char const *units[] = { "B", "KB", "MB", "GB", "TB" };
   size_t constexpr largest_unit_idx = util::lengthof(units) - 1;
   size_t unit_idx = 0;
 
-  double size = static_cast<double>(file_size);
-
-  while (size >= 1024 && unit_idx < largest_unit_idx) {
-    size /= 1024;
+  while (unit_idx < largest_unit_idx && (size >> (10 * (unit_idx + 1))) > 0) {
     ++unit_idx;
   }
 
-  char const *const fmt =
-    unit_idx == 0
+  char *pos = buf;
+  char *const end = buf + max_file_size_len;
+
+  if (unit_idx == 0) {
     // no digits after decimal point for bytes
     // because showing a fraction of a byte doesn't make sense
-    ? "%.0lf %s"
-    // 2 digits after decimal points for denominations
-    // greater than bytes
-    : "%.2lf %s";
+    pos = to_chars(pos, end, size).ptr;
+  } else {
+    // 2 digits after decimal points for denominations greater than bytes,
+    // in fixed point: whole units, then the remainder scaled to hundredths
+    unsigned const shift = static_cast<unsigned>(10 * unit_idx);
+    uintmax_t const mask = (uintmax_t(1) << shift) - 1;
+
+    uintmax_t whole = size >> shift;
+    // remainder < 2^40, so this can't overflow
+    uintmax_t const scaled = (size & mask) * 100;
+    uintmax_t hundredths = scaled >> shift;
+    uintmax_t const lost = scaled & mask;
+    uintmax_t const half = uintmax_t(1) << (shift - 1);
+
+    if (lost > half || (lost == half && (hundredths & 1) == 1)) {
+      ++hundredths;
+    }
+    if (hundredths == 100) {
+      ++whole;
+      hundredths = 0;
+    }
+
+    pos = to_chars(pos, end, whole).ptr;
+    *pos++ = '.';
+    *pos++ = static_cast<char>('0' + hundredths / 10);
+    *pos++ = static_cast<char>('0' + hundredths % 10);
+  }
+
+  *pos++ = ' ';
+  for (char const *unit = units[unit_idx]; *unit != '\0'; ++unit) {
+    *pos++ = *unit;
+  }
 
-  snprintf(out, out_size, fmt, size, units[unit_idx]);
+  return string_view(buf, static_cast<size_t>(pos - buf));
 }
@@ -1,12 +1,20 @@
 #ifndef UTIL_HPP
 #define UTIL_HPP
 
+#include <charconv>
+#include <concepts>
 #include <cstdint>
+#include <cstring>
 #include <fstream>
 #include <string>
+#include <string_view>
+#include <type_traits>
 #include <vector>
 #include <optional>
 
+#include "hash.hpp"
+#include "program-options.hpp"
+
 #ifdef _MSC_VER
   #define MICROSOFT_COMPILER 1
 #elif __GNUC__
@@ -20,10 +28,121 @@
 namespace util {
 
 std::fstream open_file(char const *pathname, int flags);
-std::vector<char> extract_bin_file_contents(char const *pathname);
-std::string extract_txt_file_contents(char const *pathname);
 
-std::string make_str(char const *const fmt, ...);
+// Number of fields in a format string, see format_string. Returns SIZE_MAX if `fmt` is malformed.
+consteval std::size_t count_format_fields(std::string_view const fmt) {
+  std::size_t num_fields = 0;
+  for (std::size_t i = 0; i < fmt.size(); ++i) {
+    if (fmt[i] == '}') {
+      if (i + 1 == fmt.size() || fmt[i + 1] != '}')
+        return SIZE_MAX;
+      ++i;
+    } else if (fmt[i] == '{') {
+      if (i + 1 < fmt.size() && fmt[i + 1] == '{') {
+        ++i;
+        continue;
+      }
+      ++i;
+      if (i + 1 < fmt.size() && fmt[i] == ':' && (fmt[i + 1] == '<' || fmt[i + 1] == '>')) {
+        i += 2;
+        while (i < fmt.size() && fmt[i] >= '0' && fmt[i] <= '9')
+          ++i;
+      }
+      if (i == fmt.size() || fmt[i] != '}')
+        return SIZE_MAX;
+      ++num_fields;
+    }
+  }
+  return num_fields;
+}
+
+// A format string for format_to and make_str, checked against the number of
+// arguments at compile time. Fields are "{}", or "{:<N}" and "{:>N}" to pad the
+// value to N characters, left or right aligned (by default strings are left
+// aligned, numbers right aligned). "{{" and "}}" are literal braces.
+template <typename... Args>
+class format_string {
+public:
+  template <typename Str>
+  requires std::convertible_to<Str const &, std::string_view>
+  consteval format_string(Str const &fmt) : m_fmt(fmt) {
+    if (count_format_fields(m_fmt) != sizeof...(Args)) {
+      // not a constant expression, so a mismatch fails to compile
+      throw "format string is malformed or doesn't match the number of arguments";
+    }
+  }
+
+  [[nodiscard]] constexpr std::string_view str() const { return m_fmt; }
+
+private:
+  std::string_view m_fmt;
+};
+
+// A file size for format_to, formatted like format_file_size.
+struct file_size {
+  std::uintmax_t bytes;
+};
+
+namespace detail {
+
+  struct format_field {
+    // 0 for the default of the value's type
+    char align = 0;
+    std::size_t width = 0;
+  };
+
+  // Appends the text of `fmt` up to its next field and parses the field, consuming both.
+  void format_literal(std::string &out, std::string_view &fmt, format_field &field);
+
+  void format_padded(std::string &out, format_field field, char default_align, std::string_view text);
+
+  inline void format_arg(std::string &out, format_field const field, std::string_view const value) {
+    format_padded(out, field, '<', value);
+  }
+
+  inline void format_arg(std::string &out, format_field const field, char const value) {
+    format_padded(out, field, '<', std::string_view(&value, 1));
+  }
+
+  template <std::integral Ty>
+  requires (!std::same_as<Ty, char> && !std::same_as<Ty, bool>)
+  void format_arg(std::string &out, format_field const field, Ty const value) {
+    char digits[24];
+    auto const result = std::to_chars(digits, digits + sizeof(digits), value);
+    format_padded(out, field, '>', std::string_view(digits, static_cast<std::size_t>(result.ptr - digits)));
+  }
+
+  // Same as an std::ostream with default flags, i.e. %g with 6 significant digits.
+  void format_arg(std::string &out, format_field field, double value);
+
+  void format_arg(std::string &out, format_field field, file_size value);
+
+} // namespace detail
+
+// Appends `args` formatted by `fmt` to `out` and returns it. Reusing `out` for
+// many rows (clear() keeps its capacity) makes formatting allocation-free.
+template <typename... Args>
+std::string &format_to(
+  std::string &out,
+  format_string<std::type_identity_t<Args>...> const fmt,
+  Args const &...args)
+{
+  std::string_view rest = fmt.str();
+  detail::format_field field{};
+  ((detail::format_literal(out, rest, field), detail::format_arg(out, field, args)), ...);
+  detail::format_literal(out, rest, field);
+  return out;
+}
+
+template <typename... Args>
+[[nodiscard]] std::string make_str(
+  format_string<std::type_identity_t<Args>...> const fmt,
+  Args const &...args)
+{
+  std::string str{};
+  format_to(str, fmt, args...);
+  return str;
+}
 
 template <typename ElemTy>
 bool vectors_same(
@@ -33,7 +152,7 @@ bool vectors_same(
   if (v1.size() != v2.size()) {
     return false;
   } else {
-    return std::memcmp(v1.data(), v2.data(), v1.size()) == 0;
+    return v1.empty() || std::memcmp(v1.data(), v2.data(), v1.size() * sizeof(ElemTy)) == 0;
   }
 }
 
@@ -43,25 +162,31 @@ consteval [[nodiscard]] std::size_t lengthof(ElemTy (&)[Length]) {
   return Length;
 }
 
+// Longest result of format_file_size, "16777216.00 TB".
+inline constexpr std::size_t max_file_size_len = 14;
+
+// Formats `size` in the largest unit up to TB which keeps it >= 1, e.g. "1023 B"
+// or "1.50 KB", with 2 decimals rounded to nearest (ties to even, as printf does).
+// Writes to `buf` and returns the part of it in use, so nothing is allocated.
+std::string_view format_file_size(std::uintmax_t size, char (&buf)[max_file_size_len]);
 [[nodiscard]] std::string format_file_size(std::uintmax_t size);
-void format_file_size(std::uintmax_t size, char *out, std::size_t outSize);
 
 template <typename Ty>
 [[nodiscard]] std::optional<Ty> get_required_option(
   char const *const full_name,
   char const *const short_name,
-  boost::program_options::variables_map const &var_map,
+  opts::parsed const &var_map,
   std::vector<std::string> &errors)
 {
   if (var_map.count(full_name) == 0) {
-      errors.emplace_back(make_str("(--%s, -%s) required option missing", full_name, short_name));
+      errors.emplace_back(make_str("(--{}, -{}) required option missing", full_name, short_name));
       return std::nullopt;
   }
 
   try {
-      return var_map.at(full_name).as<Ty>();
+      return var_map.as<Ty>(full_name);
   } catch (...) {
-      errors.emplace_back(make_str("(--%s, -%s) unable to parse value", full_name, short_name));
+      errors.emplace_back(make_str("(--{}, -{}) unable to parse value", full_name, short_name));
       return std::nullopt;
   }
 }
@@ -70,7 +195,7 @@ template <typename Ty>
 [[nodiscard]] std::optional<Ty> get_nonrequired_option(
   char const *const full_name,
   char const *const short_name,
-  boost::program_options::variables_map const &var_map,
+  opts::parsed const &var_map,
   std::vector<std::string> &errors)
 {
   if (var_map.count(full_name) == 0) {
@@ -78,9 +203,9 @@ template <typename Ty>
   }
 
   try {
-      return var_map.at(full_name).as<Ty>();
+      return var_map.as<Ty>(full_name);
   } catch (...) {
-      errors.emplace_back(make_str("(--%s , -%s) unable to parse value", full_name, short_name));
+      errors.emplace_back(make_str("(--{} , -{}) unable to parse value", full_name, short_name));
       return std::nullopt;
   }
 }
@@ -88,7 +213,7 @@ template <typename Ty>
 inline
 [[nodiscard]] bool get_flag_option(
   char const *const option_name,
-  boost::program_options::variables_map const &var_map)
+  opts::parsed const &var_map)
 {
   return var_map.count(option_name) > 0;
 }
@@ -0,0 +1,504 @@
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <filesystem>
+#include <iterator>
+#include <mutex>
+#include <random>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#ifdef _WIN32
+#include <cwctype>
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <set>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/sysmacros.h>
+#endif
+#endif
+
+#include "thread_pool.hpp"
+#include "walk.hpp"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+  struct pending_dir {
+    fs::path path;
+    uint64_t ino;
+    size_t parent_id;
+    size_t root_idx;
+  };
+
+  class walker {
+  public:
+    walker(walk::options const &opts, walk::file_callback const &on_file, walk::dir_callback const &on_dir)
+      : m_opts(opts)
+      , m_on_file(on_file)
+      , m_on_dir(on_dir)
+    {}
+
+    walk::summary run();
+
+  private:
+    // Everything a worker touches while listing a directory, so workers only share the queue.
+    struct worker_state {
+      size_t idx = 0;
+      std::mt19937_64 rng{};
+      std::bernoulli_distribution sample{};
+      // the directory being listed
+      size_t dir_id = 0;
+      size_t root_idx = 0;
+      // subdirectories found by the current scan, queued once it's done
+      std::vector<pending_dir> children{};
+
+#ifndef _WIN32
+      struct listed_entry {
+        std::string name;
+        ino_t ino;
+        unsigned char type;
+      };
+      std::vector<listed_entry> entries{};
+#endif
+    };
+
+    void work(worker_state &ws);
+
+    // Lists `dir`, reporting its files through emit_file and its subdirectories through add_child.
+    void scan(pending_dir const &dir, worker_state &ws);
+
+    void emit_file(
+      fs::path const &path,
+      uintmax_t const size,
+      walk::file_times const &times,
+      walk::file_id const id,
+      worker_state const &ws
+    ) {
+      m_on_file({ path, size, times, id, ws.dir_id, ws.root_idx, ws.idx });
+    }
+
+    void add_child(fs::path &&path, uint64_t const ino, worker_state &ws) {
+      if (m_opts.sample_fraction < 1.0 && !ws.sample(ws.rng)) {
+        ++m_num_dirs_skipped;
+        return;
+      }
+      ws.children.push_back({ std::move(path), ino, ws.dir_id, ws.root_idx });
+    }
+
+    // Checking the clock on every entry would cost more than it saves, do it periodically.
+    bool out_of_time(size_t const entry_idx) {
+      if (m_out_of_time.load(std::memory_order_relaxed)) {
+        return true;
+      }
+      if (entry_idx % 1024 == 0 &&
+          (std::chrono::steady_clock::now() >= m_opts.deadline || m_opts.stop.stop_requested())) {
+        m_out_of_time.store(true, std::memory_order_relaxed);
+        return true;
+      }
+      return false;
+    }
+
+#ifndef _WIN32
+    // Returns false if the directory was entered before.
+    bool mark_visited(dev_t const dev, ino_t const ino) {
+      std::lock_guard<std::mutex> const lock(m_visited_mutex);
+      return m_visited_dirs.emplace(dev, ino).second;
+    }
+#endif
+
+    static bool higher_inode(pending_dir const &lhs, pending_dir const &rhs) {
+      return lhs.ino > rhs.ino;
+    }
+
+    walk::options const &m_opts;
+    walk::file_callback const &m_on_file;
+    walk::dir_callback const &m_on_dir;
+
+    std::mutex m_pending_mutex{};
+    std::condition_variable m_pending_changed{};
+    // Directories waiting to be listed. In listing order this is a stack (depth-first,
+    // like std::filesystem::recursive_directory_iterator), in inode order it's a min-heap
+    // so that the next directory visited is always the one with the lowest inode.
+    std::vector<pending_dir> m_pending{};
+    // workers in the middle of a scan, which may still queue more directories
+    size_t m_num_busy = 0;
+
+    std::atomic<size_t> m_next_dir_id = 0;
+    std::atomic<size_t> m_num_dirs_visited = 0;
+    std::atomic<size_t> m_num_dirs_skipped = 0;
+    std::atomic<bool> m_out_of_time = false;
+
+#ifndef _WIN32
+    // (device, inode) of every directory entered, only needed to break symlink cycles
+    std::mutex m_visited_mutex{};
+    std::set<std::pair<dev_t, ino_t>> m_visited_dirs{};
+#endif
+  };
+
+} // namespace
+
+walk::summary walker::run() {
+  // reversed, so the first root is the first one popped
+  for (size_t i = m_opts.roots.size(); i-- > 0;) {
+    m_pending.push_back({ m_opts.roots[i], 0, SIZE_MAX, i });
+
+#ifndef _WIN32
+    struct stat st;
+    if (m_opts.follow_sym_links && stat(m_opts.roots[i].c_str(), &st) == 0) {
+      mark_visited(st.st_dev, st.st_ino);
+    }
+#endif
+  }
+
+  size_t const num_threads = std::max(m_opts.num_threads, size_t(1));
+  double const sample_fraction = std::clamp(m_opts.sample_fraction, 0.0, 1.0);
+
+  std::vector<worker_state> workers(num_threads);
+  for (size_t i = 0; i < num_threads; ++i) {
+    workers[i].idx = i;
+    workers[i].rng.seed(m_opts.sample_seed + i);
+    workers[i].sample = std::bernoulli_distribution(sample_fraction);
+  }
+
+  // the calling thread is the first worker, the rest run on the pool
+  util::task_group listing{};
+  for (size_t i = 1; i < num_threads; ++i) {
+    listing.run([this, &ws = workers[i]]() { work(ws); });
+  }
+  work(workers.front());
+  listing.wait();
+
+  return { m_num_dirs_visited.load(), m_num_dirs_skipped.load(), !m_out_of_time.load() };
+}
+
+void walker::work(worker_state &ws) {
+  for (;;) {
+    pending_dir dir;
+    {
+      std::unique_lock<std::mutex> lock(m_pending_mutex);
+      m_pending_changed.wait(lock, [this]() {
+        return !m_pending.empty() || m_num_busy == 0 || m_out_of_time.load(std::memory_order_relaxed);
+      });
+
+      if (m_pending.empty() || out_of_time(0)) {
+        // nobody left who could queue more work, wake the other idle workers so they see it too
+        lock.unlock();
+        m_pending_changed.notify_all();
+        return;
+      }
+
+      if (m_opts.inode_order) {
+        std::pop_heap(m_pending.begin(), m_pending.end(), higher_inode);
+      }
+      dir = std::move(m_pending.back());
+      m_pending.pop_back();
+      ++m_num_busy;
+    }
+
+    ws.dir_id = m_next_dir_id++;
+    ws.root_idx = dir.root_idx;
+    ws.children.clear();
+
+    try {
+      scan(dir, ws);
+
+      if (m_on_dir) {
+        m_on_dir({ ws.dir_id, dir.parent_id, ws.children.size(), ws.idx });
+      }
+    } catch (...) {
+      // a callback threw, stop the other workers rather than leave them waiting on this one
+      {
+        std::lock_guard<std::mutex> const lock(m_pending_mutex);
+        m_out_of_time.store(true, std::memory_order_relaxed);
+        --m_num_busy;
+      }
+      m_pending_changed.notify_all();
+      throw;
+    }
+
+    {
+      std::lock_guard<std::mutex> const lock(m_pending_mutex);
+      if (m_opts.inode_order) {
+        for (auto &child : ws.children) {
+          m_pending.push_back(std::move(child));
+          std::push_heap(m_pending.begin(), m_pending.end(), higher_inode);
+        }
+      } else {
+        // reversed, so the first child listed is the first one popped
+        std::move(ws.children.rbegin(), ws.children.rend(), std::back_inserter(m_pending));
+      }
+      --m_num_busy;
+    }
+    m_pending_changed.notify_all();
+  }
+}
+
+#ifdef _WIN32
+
+namespace {
+
+  // Closes a listing however the scan is left, the callbacks may throw.
+  struct find_closer {
+    HANDLE handle;
+    ~find_closer() { FindClose(handle); }
+  };
+
+} // namespace
+
+// FILETIME counts 100 ns intervals since 1601-01-01
+static int64_t to_unix_time(FILETIME const &ft) {
+  int64_t const ticks = static_cast<int64_t>((uint64_t(ft.dwHighDateTime) << 32) | ft.dwLowDateTime);
+  return ticks == 0 ? walk::unknown_time : (ticks - 116'444'736'000'000'000) / 10'000'000;
+}
+
+void walker::scan(pending_dir const &dir, worker_state &ws) {
+  // FindFirstFile/FindNextFile don't expose file IDs, so `inode_order` has no effect here.
+  // They do return size and timestamps with each entry though, so nothing needs a separate stat.
+
+  WIN32_FIND_DATAW data;
+  HANDLE const find = FindFirstFileExW((dir.path / L"*").c_str(), FindExInfoBasic, &data,
+    FindExSearchNameMatch, nullptr, FIND_FIRST_EX_LARGE_FETCH);
+  if (find == INVALID_HANDLE_VALUE) {
+    // permission denied, or removed since it was listed
+    return;
+  }
+  find_closer const closer{ find };
+  ++m_num_dirs_visited;
+
+  size_t entry_idx = 0;
+  do {
+    if (out_of_time(++entry_idx)) {
+      break;
+    }
+
+    wchar_t const *const name = data.cFileName;
+    if (name[0] == L'.' && (name[1] == L'\0' || (name[1] == L'.' && name[2] == L'\0'))) {
+      continue;
+    }
+
+    // dwReserved0 holds the reparse tag, junctions aren't symlinks (same as std::filesystem)
+    bool const is_sym_link = (data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)
+      && data.dwReserved0 == IO_REPARSE_TAG_SYMLINK;
+
+    if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+      if (m_opts.recurse && (m_opts.follow_sym_links || !is_sym_link)) {
+        add_child(dir.path / name, 0, ws);
+      }
+      continue;
+    }
+
+    fs::path path = dir.path / name;
+
+    if (is_sym_link) {
+      // the entry describes the link, follow it like std::filesystem::file_size does
+      std::error_code ec{};
+      uintmax_t const size = fs::file_size(path, ec);
+      if (!ec) {
+        emit_file(path, size, { walk::unknown_time, walk::unknown_time, walk::unknown_time }, walk::unknown_file_id, ws);
+      }
+      continue;
+    }
+
+    uintmax_t const size = (uintmax_t(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+    walk::file_times const times{
+      to_unix_time(data.ftLastAccessTime),
+      to_unix_time(data.ftLastWriteTime),
+      to_unix_time(data.ftCreationTime),
+    };
+
+    emit_file(path, size, times, walk::unknown_file_id, ws);
+  } while (FindNextFileW(find, &data));
+}
+
+uint64_t walk::device_id(fs::path const &path) {
+  // drive letters are case insensitive, UNC roots ("\\server\share") are close enough
+  std::error_code ec{};
+  auto volume = fs::absolute(path, ec).root_name().native();
+  std::transform(volume.begin(), volume.end(), volume.begin(), [](wchar_t const c) {
+    return static_cast<wchar_t>(std::towlower(c));
+  });
+  return std::hash<fs::path::string_type>{}(volume);
+}
+
+walk::file_id walk::file_id_of(fs::path const &path) {
+  // no flag to not follow reparse points, so a symlink opens its target
+  HANDLE const file = CreateFileW(path.c_str(), FILE_READ_ATTRIBUTES,
+    FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+    FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    return walk::unknown_file_id;
+  }
+
+  BY_HANDLE_FILE_INFORMATION info;
+  bool const ok = GetFileInformationByHandle(file, &info) != FALSE;
+  CloseHandle(file);
+  if (!ok) {
+    return walk::unknown_file_id;
+  }
+  return { info.dwVolumeSerialNumber, (uint64_t(info.nFileIndexHigh) << 32) | info.nFileIndexLow };
+}
+
+#else // POSIX
+
+namespace {
+
+  // Closes a listing however the scan is left, the callbacks may throw.
+  struct dir_closer {
+    DIR *stream;
+    ~dir_closer() { closedir(stream); }
+  };
+
+  struct entry_stat {
+    mode_t mode;
+    dev_t dev;
+    ino_t ino;
+    uintmax_t size;
+    walk::file_times times;
+  };
+
+  // Follows symlinks, like std::filesystem::file_size.
+  bool stat_entry(int const dir_fd, char const *const name, entry_stat &out) {
+#ifdef STATX_BTIME
+    // statx is the only call which returns the birth time, and it costs the same as fstatat
+    struct statx stx;
+    unsigned const mask = STATX_TYPE | STATX_MODE | STATX_INO | STATX_SIZE
+      | STATX_ATIME | STATX_MTIME | STATX_BTIME;
+    if (statx(dir_fd, name, 0, mask, &stx) != 0) {
+      return false;
+    }
+    out.mode = stx.stx_mode;
+    out.dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+    out.ino = stx.stx_ino;
+    out.size = stx.stx_size;
+    out.times.access = (stx.stx_mask & STATX_ATIME) ? stx.stx_atime.tv_sec : walk::unknown_time;
+    out.times.modify = (stx.stx_mask & STATX_MTIME) ? stx.stx_mtime.tv_sec : walk::unknown_time;
+    out.times.birth = (stx.stx_mask & STATX_BTIME) ? stx.stx_btime.tv_sec : walk::unknown_time;
+#else
+    struct stat st;
+    if (fstatat(dir_fd, name, &st, 0) != 0) {
+      return false;
+    }
+    out.mode = st.st_mode;
+    out.dev = st.st_dev;
+    out.ino = st.st_ino;
+    out.size = static_cast<uintmax_t>(st.st_size);
+    out.times = { st.st_atime, st.st_mtime, walk::unknown_time };
+#endif
+    return true;
+  }
+
+} // namespace
+
+void walker::scan(pending_dir const &dir, worker_state &ws) {
+  DIR *const dir_stream = opendir(dir.path.c_str());
+  if (dir_stream == nullptr) {
+    // permission denied, or removed since it was listed
+    return;
+  }
+  dir_closer const closer{ dir_stream };
+  ++m_num_dirs_visited;
+  int const dir_fd = dirfd(dir_stream);
+
+  // buffer the whole listing first, so entries can be stat'ed in inode order
+  auto &entries = ws.entries;
+  entries.clear();
+  while (dirent const *const ent = readdir(dir_stream)) {
+    char const *const name = ent->d_name;
+    if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+      continue;
+    }
+    entries.push_back({ name, ent->d_ino, ent->d_type });
+  }
+
+  if (m_opts.inode_order) {
+    std::sort(entries.begin(), entries.end(), [](auto const &lhs, auto const &rhs) {
+      return lhs.ino < rhs.ino;
+    });
+  }
+
+  size_t entry_idx = 0;
+  for (auto const &entry : entries) {
+    if (out_of_time(++entry_idx)) {
+      break;
+    }
+
+    if (entry.type == DT_DIR && !m_opts.follow_sym_links) {
+      // a real directory, no stat needed to either skip it or descend into it
+      if (m_opts.recurse) {
+        add_child(dir.path / entry.name, entry.ino, ws);
+      }
+      continue;
+    }
+
+    entry_stat st;
+    if (!stat_entry(dir_fd, entry.name.c_str(), st)) {
+      continue;
+    }
+
+    if (S_ISDIR(st.mode)) {
+      if (!m_opts.recurse) {
+        continue;
+      }
+
+      bool const is_sym_link = entry.type == DT_LNK || (entry.type == DT_UNKNOWN && [&]() {
+        struct stat lst;
+        return fstatat(dir_fd, entry.name.c_str(), &lst, AT_SYMLINK_NOFOLLOW) == 0
+          && S_ISLNK(lst.st_mode);
+      }());
+
+      if (is_sym_link && !m_opts.follow_sym_links) {
+        continue;
+      }
+      if (m_opts.follow_sym_links && !mark_visited(st.dev, st.ino)) {
+        continue;
+      }
+
+      add_child(dir.path / entry.name, st.ino, ws);
+      continue;
+    }
+
+    // std::filesystem::file_size fails on anything that isn't a regular file
+    if (!S_ISREG(st.mode)) {
+      continue;
+    }
+
+    walk::file_id const id{ static_cast<uint64_t>(st.dev), static_cast<uint64_t>(st.ino) };
+    emit_file(dir.path / entry.name, st.size, st.times, id, ws);
+  }
+}
+
+uint64_t walk::device_id(fs::path const &path) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    return 0;
+  }
+  return static_cast<uint64_t>(st.st_dev);
+}
+
+walk::file_id walk::file_id_of(fs::path const &path) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    return walk::unknown_file_id;
+  }
+  return { static_cast<uint64_t>(st.st_dev), static_cast<uint64_t>(st.st_ino) };
+}
+
+#endif // _WIN32
+
+walk::summary walk::files(
+  walk::options const &opts,
+  walk::file_callback const &on_file,
+  walk::dir_callback const &on_dir
+) {
+  walker w(opts, on_file, on_dir);
+  return w.run();
+}
@@ -0,0 +1,116 @@
+#ifndef WALK_HPP
+#define WALK_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <stop_token>
+#include <vector>
+
+// Directory traversal shared by the actions which scan a tree of files.
+namespace walk {
+
+struct options {
+  std::vector<std::filesystem::path> roots;
+  bool recurse = false;
+  bool follow_sym_links = false;
+  // Buffers each directory's listing and stats its entries in inode order,
+  // then descends into child directories in inode order too. Cuts seeking on
+  // spinning disks, where inode order roughly follows on-disk placement. POSIX only.
+  bool inode_order = false;
+  // Probability of descending into each child directory, 1 = visit everything.
+  // A skipped directory's whole subtree is skipped.
+  double sample_fraction = 1.0;
+  std::uint64_t sample_seed = 0;
+  // The walk stops early once this point in time is reached.
+  std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+  // The walk stops early once a stop is requested, just as at the deadline.
+  std::stop_token stop = {};
+  // Directories are listed by this many workers, pulling from a shared queue:
+  // the calling thread and tasks on the shared thread pool. With 1 the walk runs
+  // on the calling thread.
+  size_t num_threads = 1;
+};
+
+// Timestamps in seconds since the Unix epoch.
+struct file_times {
+  std::int64_t access;
+  std::int64_t modify;
+  // creation time, not recorded by every filesystem
+  std::int64_t birth;
+};
+
+// For a timestamp the platform or filesystem doesn't provide.
+inline constexpr std::int64_t unknown_time = INT64_MIN;
+
+// The same for every path to one file, i.e. its hard links, and symlinks to it.
+// Device and inode on POSIX, volume serial number and file index on Windows.
+struct file_id {
+  std::uint64_t device;
+  std::uint64_t index;
+
+  bool operator==(file_id const &) const = default;
+  auto operator<=>(file_id const &) const = default;
+};
+
+// For a file whose id wasn't looked up.
+inline constexpr file_id unknown_file_id{ 0, 0 };
+
+struct file_info {
+  std::filesystem::path const &path;
+  uintmax_t size;
+  // Come from the same call which fetches the size (statx, or the directory
+  // listing itself on Windows), so they cost no extra syscalls.
+  file_times times;
+  // From the same call as the size on POSIX. The Windows directory listing
+  // doesn't have it, there it's unknown_file_id, see file_id_of.
+  file_id id;
+  // Sequence number of the file's directory, unique within one walk.
+  size_t dir_id;
+  // index into options::roots
+  size_t root_idx;
+  // [0, options::num_threads), for keeping per-thread state without locking
+  size_t worker_idx;
+};
+
+// Reported once a directory has been listed, after all of its files,
+// by the same worker which reported the files.
+struct dir_info {
+  size_t dir_id;
+  // SIZE_MAX for a root
+  size_t parent_id;
+  // child directories queued to be visited, i.e. not skipped by sampling
+  size_t num_children;
+  size_t worker_idx;
+};
+
+using file_callback = std::function<void (file_info const &)>;
+using dir_callback = std::function<void (dir_info const &)>;
+
+struct summary {
+  size_t num_dirs_visited;
+  // not descended into because of sampling
+  size_t num_dirs_skipped;
+  // false if the deadline was reached or a stop requested before the walk finished
+  bool complete;
+};
+
+// Calls `on_file` for every regular file under `opts.roots` whose size
+// can be determined. Entries which cannot be accessed are silently skipped.
+// If given, `on_dir` is called for every directory taken off the queue.
+// With more than one thread, callbacks are called concurrently from all of them.
+// An exception a callback throws stops the walk and is passed on.
+summary files(options const &opts, file_callback const &on_file, dir_callback const &on_dir = nullptr);
+
+// Identifies the storage device `path` lives on (st_dev on POSIX, the volume on Windows),
+// so that walks of roots on different devices can be scheduled independently.
+uint64_t device_id(std::filesystem::path const &path);
+
+// Looks up the id of the file at `path`, following symlinks. Costs opening the
+// file on Windows. Returns unknown_file_id if it can't be accessed.
+file_id file_id_of(std::filesystem::path const &path);
+
+} // namespace walk
+
+#endif // WALK_HPP